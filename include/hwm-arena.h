@@ -0,0 +1,151 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2009, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef HWM_ARENA_H
+#define HWM_ARENA_H
+
+#include <stdlib.h>
+
+#include <hwm-buffer.h>
+
+/**
+ * @file
+ *
+ * This file provides an arena that HWM buffers can use for their
+ * storage.  An arena hands out memory from large contiguous slabs.
+ * When a buffer grows, and its storage is the most recent allocation
+ * in the arena, it's extended in place.  Freeing individual
+ * allocations is (nearly) a no-op; instead, hwm_arena_reset() releases
+ * everything that the arena has handed out in one step, while keeping
+ * the slabs around for the next round of allocations.
+ *
+ * After an arena is reset, any buffers whose storage came from it must
+ * be reinitialized with hwm_buffer_init_in_arena() (or simply
+ * abandoned); you must not call hwm_buffer_done() on them.
+ */
+
+
+/**
+ * The default size of each slab in an arena, used if you pass in 0
+ * to hwm_arena_init().
+ */
+
+#define HWM_ARENA_DEFAULT_SLAB_SIZE  65536
+
+
+/**
+ * One of the slabs that an arena hands out memory from.
+ *
+ * @private
+ */
+
+typedef struct hwm_arena_slab  hwm_arena_slab_t;
+
+
+/**
+ * An arena of memory for HWM buffers.  The fields of the struct are
+ * considered private — you should not access them directly.
+ */
+
+typedef struct hwm_arena
+{
+    /**
+     * The size of each slab that we allocate.  Allocations larger
+     * than this get a slab of their own.
+     *
+     * @private
+     */
+
+    size_t  slab_size;
+
+    /**
+     * The first slab in the arena's list of slabs.
+     *
+     * @private
+     */
+
+    hwm_arena_slab_t  *first;
+
+    /**
+     * The slab that we're currently allocating from.  Slabs before
+     * this one in the list are full; slabs after it are unused.
+     *
+     * @private
+     */
+
+    hwm_arena_slab_t  *current;
+
+    /**
+     * The most recent allocation in the current slab.  This is the
+     * only allocation that can grow in place.
+     *
+     * @private
+     */
+
+    void  *last;
+} hwm_arena_t;
+
+
+/**
+ * An allocator that hands out memory from an arena.  The allocator's
+ * context pointer must be an hwm_arena_t.
+ */
+
+extern const hwm_allocator_t  hwm_arena_allocator;
+
+
+/**
+ * Initialize a new arena.  Slabs of slab_size bytes are allocated as
+ * they're needed; if slab_size is 0, we use
+ * HWM_ARENA_DEFAULT_SLAB_SIZE.
+ */
+
+void
+hwm_arena_init(hwm_arena_t *arena, size_t slab_size);
+
+
+/**
+ * Finalize an arena, freeing all of its slabs.  Any buffers using the
+ * arena are invalid afterwards.
+ */
+
+void
+hwm_arena_done(hwm_arena_t *arena);
+
+
+/**
+ * Release everything that the arena has handed out, without freeing
+ * its slabs.  This takes constant time, regardless of how many
+ * buffers were using the arena.
+ */
+
+void
+hwm_arena_reset(hwm_arena_t *arena);
+
+
+/**
+ * Allocate size bytes from the arena.  Return NULL if we need a new
+ * slab but can't allocate one.
+ */
+
+void *
+hwm_arena_alloc(hwm_arena_t *arena, size_t size);
+
+
+/**
+ * Initialize a new HWM buffer whose storage comes from the given
+ * arena.
+ */
+
+void
+hwm_buffer_init_in_arena(hwm_buffer_t *hwm, hwm_arena_t *arena);
+
+
+#endif /* HWM_ARENA_H */
@@ -11,9 +11,13 @@
 #ifndef HWM_BUFFER_H
 #define HWM_BUFFER_H
 
+#include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 /**
  * @mainpage High-water mark buffers
@@ -64,6 +68,19 @@
  * functions), the original data will be copied into memory that the
  * buffer controls.
  *
+ * hwm_buffer_load_file() and hwm_buffer_load_fd() use the same
+ * mechanism to load files without copying them: the file is mapped
+ * into memory, and the buffer points at the mapping until the first
+ * time that it's modified.
+ *
+ * Going the other way, hwm_buffer_append_from_fd() and
+ * hwm_buffer_append_from_fd_until_eof() read from a file descriptor
+ * directly into the unused space at the end of the buffer, so data
+ * coming in from a socket or pipe doesn't have to be staged in a
+ * separate buffer and then appended.  hwm_buffer_write_fd() writes
+ * any number of buffers to a file descriptor with writev(), without
+ * concatenating them first.
+ *
  * @section lists List functions
  *
  * It's also possible to use an HWM buffer as an expandable array,
@@ -71,6 +88,55 @@
  * each take in an additional parameter, which is the type of the list
  * elements.  This allows you to specify the size of the list in terms
  * of a number of elements.
+ *
+ * @section growth Growth policies
+ *
+ * By default, a buffer grows to exactly the size that's needed to
+ * hold its new contents.  That's ideal when a buffer is loaded with
+ * values of similar sizes, but it means that building up a large
+ * value a little bit at a time reallocates the buffer on every
+ * append.  You can give a buffer a different growth policy, either
+ * when initializing it (hwm_buffer_init_with_growth() or
+ * HWM_BUFFER_INIT_WITH_GROWTH()) or later on with
+ * hwm_buffer_set_growth().  The library provides exact, doubling,
+ * 1.5x, page-rounded, size-class, and capped-linear policies; you can
+ * also define your own.
+ *
+ * @section allocators Allocators
+ *
+ * A buffer's storage comes from malloc, realloc, and free unless you
+ * say otherwise.  To place a buffer's storage somewhere else, such as
+ * in an arena or a custom heap, fill in an hwm_allocator_t and pass
+ * it (along with a context pointer) to
+ * hwm_buffer_init_with_allocator() or
+ * hwm_buffer_new_with_allocator().  Every allocation that the buffer
+ * makes will then go through that allocator.  The hwm-arena.h file
+ * provides one such allocator, which hands out memory from large
+ * slabs that can all be released at once.  The hwm-mmap.h file
+ * provides another, which places large buffers in their own memory
+ * mappings so that they can grow without copying.
+ *
+ * @section trimming Trimming
+ *
+ * A high-water mark buffer never gives back memory on its own.  That's
+ * usually what you want, but a single unusually large value can pin
+ * a large allocation for the rest of the buffer's life.  You can
+ * release excess storage explicitly with hwm_buffer_trim().  You can
+ * also turn on decay with hwm_buffer_set_decay(): after a given number
+ * of consecutive clears in which the buffer used only a small part of
+ * its allocation, hwm_buffer_clear() shrinks the allocation down to
+ * the largest size that was actually used in those cycles.
+ *
+ * @section chains Chains
+ *
+ * Even with a generous growth policy, a contiguous buffer that keeps
+ * growing must eventually copy everything it holds into a larger
+ * allocation.  For large append-only payloads, the hwm-chain.h file
+ * provides a segmented buffer, which stores its contents in a list of
+ * HWM buffers and never copies data once it's been appended.  For
+ * streaming data that's consumed from the front as it arrives, the
+ * hwm-ring.h file provides a ring buffer whose contents are always
+ * contiguous, and which can be viewed as an HWM buffer.
  */
 
 /**
@@ -81,6 +147,192 @@
  */
 
 
+/**
+ * A growth policy for an HWM buffer.  Whenever a buffer needs more
+ * memory than it has currently allocated, it asks its growth policy
+ * how large the new allocation should be.  The policy's grow function
+ * receives the current allocated size (0 if nothing has been
+ * allocated yet) and the number of bytes that are actually needed;
+ * it should return the number of bytes to allocate.  If it returns
+ * less than requested_size, the buffer allocates exactly
+ * requested_size bytes instead.
+ *
+ * The param field is available to the grow function to use as it
+ * sees fit; the capped-linear policy, for instance, uses it as its
+ * threshold.
+ */
+
+typedef struct hwm_growth_policy
+{
+    size_t
+    (*grow)(const struct hwm_growth_policy *policy,
+            size_t allocated_size, size_t requested_size);
+
+    size_t  param;
+} hwm_growth_policy_t;
+
+
+/**
+ * The “exact” growth policy, which allocates exactly as much memory
+ * as is requested.  This is the policy used by buffers that don't
+ * specify one.
+ */
+
+extern const hwm_growth_policy_t  hwm_growth_exact;
+
+/**
+ * A growth policy that at least doubles the allocated size each time
+ * the buffer grows.
+ */
+
+extern const hwm_growth_policy_t  hwm_growth_double;
+
+/**
+ * A growth policy that grows the allocated size by at least half each
+ * time the buffer grows.
+ */
+
+extern const hwm_growth_policy_t  hwm_growth_one_and_half;
+
+/**
+ * A growth policy that rounds the requested size up to a multiple of
+ * the system page size.
+ */
+
+extern const hwm_growth_policy_t  hwm_growth_page;
+
+/**
+ * A growth policy that rounds the requested size up to the next
+ * allocator-style size class.  There are four size classes for each
+ * power of two (for instance, 64, 80, 96 and 112), so the allocated
+ * size grows by between 12.5% and 25% each time.
+ */
+
+extern const hwm_growth_policy_t  hwm_growth_size_class;
+
+/**
+ * The grow function for the capped-linear growth policy.  Use the
+ * HWM_GROWTH_CAPPED_LINEAR() macro to define a policy that uses it.
+ *
+ * @private
+ */
+
+size_t
+hwm_growth_capped_linear_grow(const hwm_growth_policy_t *policy,
+                              size_t allocated_size,
+                              size_t requested_size);
+
+/**
+ * Staticly initialize an hwm_growth_policy_t that doubles the
+ * allocated size until it reaches threshold bytes, and from then on
+ * grows it in threshold-sized increments.
+ */
+
+#define HWM_GROWTH_CAPPED_LINEAR(threshold) \
+    { hwm_growth_capped_linear_grow, (threshold) }
+
+
+/**
+ * A memory allocator for an HWM buffer's storage.  Each function
+ * receives the context pointer that was given along with the
+ * allocator when the buffer was initialized.  The reallocate and
+ * deallocate functions are also told the size of the existing
+ * allocation, for allocators that don't keep track of this
+ * themselves.
+ *
+ * The usable_size function is optional.  If provided, it's called
+ * after each allocation, and should return how many bytes of the new
+ * allocation can actually be used (which must be at least the number
+ * of bytes requested).  The buffer will make use of any slack before
+ * asking for more memory.
+ *
+ * The advise function is also optional.  If provided, it's called
+ * with the buffer's advice flags (see hwm_buffer_set_advice()) after
+ * each allocation, and with the buffer's on-clear flags whenever the
+ * buffer is cleared.  Allocators are free to ignore any flags that
+ * they can't honor.
+ */
+
+typedef struct hwm_allocator
+{
+    void *
+    (*allocate)(void *ctx, size_t size);
+
+    void *
+    (*reallocate)(void *ctx, void *ptr, size_t old_size, size_t new_size);
+
+    void
+    (*deallocate)(void *ctx, void *ptr, size_t size);
+
+    size_t
+    (*usable_size)(void *ctx, void *ptr, size_t size);
+
+    void
+    (*advise)(void *ctx, void *ptr, size_t size, unsigned int flags);
+} hwm_allocator_t;
+
+
+/**
+ * Advice flag: back the buffer's storage with transparent huge pages,
+ * if possible.
+ */
+
+#define HWM_BUFFER_ADVISE_HUGEPAGE  0x0001
+
+/**
+ * Advice flag: the buffer's storage will be accessed sequentially.
+ */
+
+#define HWM_BUFFER_ADVISE_SEQUENTIAL  0x0002
+
+/**
+ * Advice flag: the buffer's storage will be needed soon, so the
+ * kernel should fault it in ahead of time.
+ */
+
+#define HWM_BUFFER_ADVISE_WILLNEED  0x0004
+
+/**
+ * Advice flag: when the buffer is cleared, give its storage's pages
+ * back to the kernel immediately, while keeping the address space.
+ */
+
+#define HWM_BUFFER_ADVISE_DONTNEED_ON_CLEAR  0x0008
+
+/**
+ * Advice flag: when the buffer is cleared, let the kernel reclaim its
+ * storage's pages lazily, if it needs the memory.
+ */
+
+#define HWM_BUFFER_ADVISE_FREE_ON_CLEAR  0x0010
+
+/**
+ * The advice flags that apply to newly allocated storage.
+ */
+
+#define HWM_BUFFER_ADVISE_ALLOCATE_FLAGS \
+    (HWM_BUFFER_ADVISE_HUGEPAGE | \
+     HWM_BUFFER_ADVISE_SEQUENTIAL | \
+     HWM_BUFFER_ADVISE_WILLNEED)
+
+/**
+ * The advice flags that apply when a buffer is cleared.
+ */
+
+#define HWM_BUFFER_ADVISE_CLEAR_FLAGS \
+    (HWM_BUFFER_ADVISE_DONTNEED_ON_CLEAR | \
+     HWM_BUFFER_ADVISE_FREE_ON_CLEAR)
+
+
+/**
+ * The default allocator, which uses the C library's malloc, realloc,
+ * and free functions.  This is the allocator used by buffers that
+ * don't specify one.
+ */
+
+extern const hwm_allocator_t  hwm_allocator_default;
+
+
 /**
  * A high-water mark buffer.  The fields of the struct are considered
  * private — you should not access them directly.  Instead, use one of
@@ -124,7 +376,8 @@ typedef struct hwm_buffer
      * buffer has been populated using the “point” functions, this is
      * a pointer to memory that isn't controlled by the buffer.  When
      * the buffer has been populated using the “load” or “append”
-     * functions, this is a pointer to the memory that we control.
+     * functions, this is a pointer to the memory that we control,
+     * just past any bytes that have been consumed.
      *
      * @private
      */
@@ -138,6 +391,117 @@ typedef struct hwm_buffer
      */
 
     void  *buf;
+
+    /**
+     * The growth policy that decides how much memory to allocate
+     * when the buffer grows.  If NULL, we use hwm_growth_exact.
+     *
+     * @private
+     */
+
+    const hwm_growth_policy_t  *growth;
+
+    /**
+     * The allocator that provides the buffer's storage.  If NULL, we
+     * use hwm_allocator_default.
+     *
+     * @private
+     */
+
+    const hwm_allocator_t  *allocator;
+
+    /**
+     * The context pointer that's passed in to each of the allocator's
+     * functions.
+     *
+     * @private
+     */
+
+    void  *allocator_ctx;
+
+    /**
+     * The number of consecutive underused clear cycles after which
+     * we release the buffer's excess storage, or 0 if decay is
+     * disabled.
+     *
+     * @private
+     */
+
+    unsigned int  decay_cycles;
+
+    /**
+     * The number of consecutive underused clear cycles that we've
+     * seen so far.
+     *
+     * @private
+     */
+
+    unsigned int  decay_count;
+
+    /**
+     * The largest amount of storage used during the current run of
+     * underused cycles.
+     *
+     * @private
+     */
+
+    size_t  decay_peak;
+
+    /**
+     * The advice flags that are passed to the allocator's advise
+     * function.
+     *
+     * @private
+     */
+
+    unsigned int  advice;
+
+    /**
+     * A read-only file mapping that the buffer's data currently points
+     * into, or NULL.  The buffer is responsible for unmapping it.
+     *
+     * @private
+     */
+
+    void  *mapping;
+
+    /**
+     * The length of the file mapping.
+     *
+     * @private
+     */
+
+    size_t  mapping_size;
+
+    /**
+     * Storage that the buffer's data currently points into, and that
+     * is shared with other buffers by hwm_buffer_share(), or NULL.
+     * The buffer holds one of the storage's references.
+     *
+     * @private
+     */
+
+    struct hwm_buffer_shared  *shared;
+
+    /**
+     * The number of bytes at the start of buf that have been removed
+     * with hwm_buffer_consume(), but not yet reclaimed.  When the
+     * buffer's data is in its own storage, data is always equal to
+     * buf + consumed.  If the data is somewhere else, this is 0.
+     *
+     * @private
+     */
+
+    size_t  consumed;
+
+    /**
+     * The state of the buffer's incremental content hash, or NULL if
+     * it hasn't been enabled with hwm_buffer_enable_hash().
+     *
+     * @private
+     */
+
+    struct hwm_buffer_hash  *hash;
 } hwm_buffer_t;
 
 
@@ -146,7 +510,26 @@ typedef struct hwm_buffer
  * memory.
  */
 
-#define HWM_BUFFER_INIT(src, size) { 0, (size), 0, (src), NULL }
+#define HWM_BUFFER_INIT(src, size) \
+    { 0, (size), 0, (src), NULL, NULL, NULL, NULL }
+
+
+/**
+ * Staticly initialize an empty hwm_buffer_t that uses the given
+ * growth policy.
+ */
+
+#define HWM_BUFFER_INIT_WITH_GROWTH(policy) \
+    { 0, 0, 0, NULL, NULL, (policy), NULL, NULL }
+
+
+/**
+ * Staticly initialize an empty hwm_buffer_t that gets its storage
+ * from the given allocator.
+ */
+
+#define HWM_BUFFER_INIT_WITH_ALLOCATOR(allocator, ctx) \
+    { 0, 0, 0, NULL, NULL, NULL, (allocator), (ctx) }
 
 
 /**
@@ -241,6 +624,40 @@ void
 hwm_buffer_init(hwm_buffer_t *hwm);
 
 
+/**
+ * Initialize a new HWM buffer that has already been allocated, using
+ * the given growth policy.  A NULL policy is the same as
+ * hwm_growth_exact.
+ */
+
+void
+hwm_buffer_init_with_growth(hwm_buffer_t *hwm,
+                            const hwm_growth_policy_t *policy);
+
+
+/**
+ * Initialize a new HWM buffer that has already been allocated, whose
+ * storage will come from the given allocator.  The ctx pointer is
+ * passed in to each of the allocator's functions.  A NULL allocator
+ * is the same as hwm_allocator_default.
+ */
+
+void
+hwm_buffer_init_with_allocator(hwm_buffer_t *hwm,
+                               const hwm_allocator_t *allocator,
+                               void *ctx);
+
+
+/**
+ * Change the growth policy of an existing HWM buffer.  This only
+ * affects future allocations; the buffer's current contents and
+ * allocation are left alone.
+ */
+
+void
+hwm_buffer_set_growth(hwm_buffer_t *hwm, const hwm_growth_policy_t *policy);
+
+
 /**
  * Finalize an HWM buffer.  Doesn't deallocate the buffer, so this is
  * safe to call on stack-allocated buffers.
@@ -250,6 +667,40 @@ void
 hwm_buffer_done(hwm_buffer_t *hwm);
 
 
+/**
+ * The ratio used to decide whether a buffer with decay enabled is
+ * underused.  A clear cycle counts as underused if the buffer held no
+ * more than 1/HWM_BUFFER_DECAY_RATIO of its allocated size.
+ */
+
+#define HWM_BUFFER_DECAY_RATIO  4
+
+
+/**
+ * Enable or disable decay for an HWM buffer.  If cycles is nonzero,
+ * then once hwm_buffer_clear() has been called that many times in a
+ * row with the buffer underused (see HWM_BUFFER_DECAY_RATIO), it
+ * trims the buffer's storage down to the largest size used during
+ * those cycles.  A cycles value of 0 disables decay.
+ */
+
+void
+hwm_buffer_set_decay(hwm_buffer_t *hwm, unsigned int cycles);
+
+
+/**
+ * Set the advice flags for an HWM buffer.  These are hints about how
+ * the buffer's storage will be used, which are passed along to the
+ * buffer's allocator.  The flags take effect the next time the buffer
+ * allocates storage or is cleared.  The default allocator ignores
+ * them; hwm_mmap_allocator honors them for storage that it places in
+ * memory mappings.
+ */
+
+void
+hwm_buffer_set_advice(hwm_buffer_t *hwm, unsigned int flags);
+
+
 /**
  * Create a new HWM buffer on the heap.  Return NULL if we can't
  * allocate a new instance.
@@ -259,6 +710,16 @@ hwm_buffer_t *
 hwm_buffer_new();
 
 
+/**
+ * Create a new HWM buffer using the given allocator.  The
+ * hwm_buffer_t itself is also allocated using the allocator.  Return
+ * NULL if we can't allocate a new instance.
+ */
+
+hwm_buffer_t *
+hwm_buffer_new_with_allocator(const hwm_allocator_t *allocator, void *ctx);
+
+
 /**
  * Finalize and free a heap-allocated HWM buffer.
  */
@@ -276,7 +737,8 @@ hwm_buffer_is_empty(hwm_buffer_t *hwm);
 
 
 /**
- * Clear the HWM buffer.  Return true if this is successful, false
+ * Clear the HWM buffer.  If decay is enabled, this might also trim
+ * the buffer's storage.  Return true if this is successful, false
  * otherwise.
  */
 
@@ -286,14 +748,46 @@ hwm_buffer_clear(hwm_buffer_t *hwm);
 
 /**
  * Ensure that the HWM buffer has enough allocated space to store a
- * value of size bytes.  If we can't allocate enough space, return
- * false.  Otherwise, return true.
+ * value of size bytes.  If the buffer needs to grow, its growth
+ * policy decides how much memory is actually allocated.  (If part of
+ * the buffer has been consumed, the space is counted from the start
+ * of the remaining contents.)  If we can't allocate enough space,
+ * return false.  Otherwise, return true.
  */
 
 bool
 hwm_buffer_ensure_size(hwm_buffer_t *hwm, size_t size);
 
 
+/**
+ * Shrink the HWM buffer's storage so that at most keep bytes are
+ * allocated.  If the buffer's current contents live in its storage,
+ * we never trim below its current size.  Trimming to 0 bytes frees
+ * the storage entirely.  If we can't reallocate the storage, return
+ * false, leaving the buffer untouched.  Otherwise, return true.
+ */
+
+bool
+hwm_buffer_trim(hwm_buffer_t *hwm, size_t keep);
+
+
+/**
+ * Remove size bytes from the front of the buffer, in constant time.
+ * If size is larger than the buffer's contents, the buffer is
+ * emptied.  The remaining contents stay where they are; the space that
+ * was consumed is only reclaimed, by moving the remaining contents
+ * back to the start of the buffer's storage, when the buffer would
+ * otherwise have to grow, and there are at least as many consumed
+ * bytes as remaining bytes (or moving the contents avoids growing
+ * altogether).  If everything has been consumed, the space is
+ * reclaimed immediately.  This makes it cheap to parse many small
+ * records out of a buffer, one after the other.
+ */
+
+void
+hwm_buffer_consume(hwm_buffer_t *hwm, size_t size);
+
+
 /**
  * Ensure that the HWM buffer has enough allocated space to store the
  * given number of elements of the specified type.  If we can't
@@ -336,6 +830,58 @@ bool
 hwm_buffer_append_mem(hwm_buffer_t *hwm, const void *src, size_t size);
 
 
+/**
+ * Appends several regions of memory to the HWM buffer, one after the
+ * other.  The buffer is expanded once, to hold all of them, before
+ * anything is copied, so this is cheaper than calling
+ * hwm_buffer_append_mem() for each region.  If we can't expand the
+ * buffer, we return false, and the buffer is left unchanged.
+ */
+
+bool
+hwm_buffer_append_iov(hwm_buffer_t *hwm, const struct iovec *iov,
+                      size_t count);
+
+
+/**
+ * Appends several regions of memory to the HWM buffer, just like
+ * hwm_buffer_append_iov().  The regions are given as pairs of
+ * arguments — a <code>const void *</code> pointer followed by a
+ * <code>size_t</code> size (which must really be a size_t, and not
+ * an int) — and the list is terminated by a NULL pointer.
+ */
+
+bool
+hwm_buffer_append_mems(hwm_buffer_t *hwm, ...);
+
+
+/**
+ * Make room for at least size more bytes at the end of the HWM buffer,
+ * and return a pointer to that space, so that a producer can write
+ * its output directly into the buffer, rather than into a scratch
+ * area that then has to be appended.  If the buffer is pointing at
+ * some other memory, its contents are copied into its own storage
+ * first, just as with the “append” functions.  Nothing is added to
+ * the buffer until you call hwm_buffer_commit().  The pointer is only
+ * valid until the buffer is next modified.  If we can't expand the
+ * buffer, we return NULL.
+ */
+
+void *
+hwm_buffer_reserve(hwm_buffer_t *hwm, size_t size);
+
+
+/**
+ * Add size bytes to the end of the HWM buffer's contents.  They must
+ * have been written into the space returned by the most recent call
+ * to hwm_buffer_reserve() (or hwm_buffer_reserve_list_elems()), and
+ * size must not be more than the amount that was reserved.
+ */
+
+#define hwm_buffer_commit(hwm, size) \
+    ((void) ((hwm)->current_size += (size)))
+
+
 /**
  * Copy data out of the HWM buffer into some other destination.  We
  * will not copy more than max_size bytes — if there's more data in
@@ -382,9 +928,153 @@ hwm_buffer_append_str(hwm_buffer_t *hwm, const char *src);
 
 
 /**
- * Copy data into the HWM buffer from another HWM buffer.  You don't
- * need to call hwm_buffer_ensure_size() first; this function does
- * that itself.  If the copying fails for some reason, we return
+ * Appends several NUL-terminated strings to the HWM buffer, one after
+ * the other.  Just like with hwm_buffer_append_str(), the buffer's
+ * existing NUL terminator is overwritten, and the result has a single
+ * NUL terminator at the end.  The buffer is expanded once, to hold
+ * all of the strings, before anything is copied.  If we can't expand
+ * the buffer, we return false, and the buffer is left unchanged.
+ */
+
+bool
+hwm_buffer_append_strv(hwm_buffer_t *hwm, const char *const *strs,
+                       size_t count);
+
+
+/**
+ * Appends several NUL-terminated strings to the HWM buffer, just like
+ * hwm_buffer_append_strv().  The strings are given as separate
+ * arguments, and the list is terminated by a NULL pointer.
+ */
+
+bool
+hwm_buffer_append_strs(hwm_buffer_t *hwm, ...);
+
+
+/**
+ * Appends printf-style formatted output to the HWM buffer.  Just like
+ * with hwm_buffer_append_str(), the buffer's existing NUL terminator
+ * is overwritten, and the output's NUL terminator is included in the
+ * buffer.  The output is formatted directly into the buffer's unused
+ * space; only if it doesn't fit do we expand the buffer and format it
+ * again.  None of the arguments can point into the buffer itself.  If
+ * we can't expand the buffer, or there's an output error, we return
+ * false, and the buffer is left unchanged.
+ */
+
+bool
+hwm_buffer_appendf(hwm_buffer_t *hwm, const char *fmt, ...);
+
+
+/**
+ * Appends printf-style formatted output to the HWM buffer, just like
+ * hwm_buffer_appendf(), but with the arguments given as a va_list.
+ */
+
+bool
+hwm_buffer_vappendf(hwm_buffer_t *hwm, const char *fmt, va_list args);
+
+
+/**
+ * Load printf-style formatted output into the HWM buffer, replacing
+ * its contents.  The output's NUL terminator is included in the
+ * buffer, just like with hwm_buffer_load_str().  None of the
+ * arguments can point into the buffer itself.  If we can't expand the
+ * buffer, or there's an output error, we return false, and the buffer
+ * is left empty.
+ */
+
+bool
+hwm_buffer_loadf(hwm_buffer_t *hwm, const char *fmt, ...);
+
+
+/**
+ * Load printf-style formatted output into the HWM buffer, just like
+ * hwm_buffer_loadf(), but with the arguments given as a va_list.
+ */
+
+bool
+hwm_buffer_vloadf(hwm_buffer_t *hwm, const char *fmt, va_list args);
+
+
+/**
+ * The most characters that hwm_buffer_append_u64() can produce.
+ */
+
+#define HWM_BUFFER_U64_MAX_LENGTH  20
+
+/**
+ * The most characters that hwm_buffer_append_i64() can produce.
+ */
+
+#define HWM_BUFFER_I64_MAX_LENGTH  21
+
+/**
+ * The most characters that hwm_buffer_append_u64_hex() can produce.
+ */
+
+#define HWM_BUFFER_U64_HEX_MAX_LENGTH  16
+
+/**
+ * The most characters that hwm_buffer_append_double() can produce.
+ */
+
+#define HWM_BUFFER_DOUBLE_MAX_LENGTH  32
+
+
+/**
+ * Append the decimal representation of an unsigned integer to the
+ * HWM buffer.  Like hwm_buffer_append_mem(), and unlike
+ * hwm_buffer_appendf(), this doesn't add a NUL terminator, so a
+ * series of numbers and other data can be appended back to back.  We
+ * reserve room for the longest possible result up front, and format
+ * the number directly into the buffer.  If we can't expand the
+ * buffer, we return false, and the buffer is left unchanged.
+ */
+
+bool
+hwm_buffer_append_u64(hwm_buffer_t *hwm, uint64_t value);
+
+
+/**
+ * Append the decimal representation of a signed integer to the HWM
+ * buffer, just like hwm_buffer_append_u64().
+ */
+
+bool
+hwm_buffer_append_i64(hwm_buffer_t *hwm, int64_t value);
+
+
+/**
+ * Append the hexadecimal representation of an unsigned integer to the
+ * HWM buffer, just like hwm_buffer_append_u64().  The digits are
+ * lowercase, and there's no “0x” prefix.
+ */
+
+bool
+hwm_buffer_append_u64_hex(hwm_buffer_t *hwm, uint64_t value);
+
+
+/**
+ * Append the decimal representation of a double to the HWM buffer,
+ * just like hwm_buffer_append_u64().  We produce the shortest string
+ * of digits that reads back (with strtod(), for instance) as exactly
+ * the same value, and if there's more than one, the one that's
+ * closest to the value.
+ * Numbers are written the way JavaScript writes them, such as “123”,
+ * “0.001”, “1e21”, and “1.5e-7”, except that there's no “+” in
+ * positive exponents.  Infinities and NaNs are written as “inf”,
+ * “-inf”, and “nan”.
+ */
+
+bool
+hwm_buffer_append_double(hwm_buffer_t *hwm, double value);
+
+
+/**
+ * Copy data into the HWM buffer from another HWM buffer.  You don't
+ * need to call hwm_buffer_ensure_size() first; this function does
+ * that itself.  If the copying fails for some reason, we return
  * false.
  */
 
@@ -392,6 +1082,163 @@ bool
 hwm_buffer_load_buf(hwm_buffer_t *hwm, const hwm_buffer_t *src);
 
 
+/**
+ * Make dest refer to the same contents as src, without copying them.
+ * The two buffers share src's storage, which is reference counted, and
+ * freed when the last buffer using it lets go of it.  Neither buffer
+ * can change the shared storage: the first time that either one is
+ * written to (by hwm_buffer_writable_mem(), any of the append
+ * functions, and so on), it copies its contents into its own storage
+ * first, exactly like a buffer created with hwm_buffer_point_at_mem()
+ * would.  Loading new contents into a buffer, or calling
+ * hwm_buffer_clear() or hwm_buffer_done(), releases its reference
+ * without copying anything.
+ *
+ * Any number of buffers can share the same storage, and they can
+ * release it from different threads.  The first call that shares a
+ * buffer's own storage moves that storage out of src, so src has to
+ * copy its contents on its next write, too.  If src points at memory
+ * that it doesn't own (see hwm_buffer_point_at_mem()), dest points at
+ * the same memory, and the same rules about its lifetime apply.
+ * Return false if we can't allocate the reference count; in that case,
+ * neither buffer is changed.
+ */
+
+bool
+hwm_buffer_share(hwm_buffer_t *dest, hwm_buffer_t *src);
+
+
+/**
+ * Flag for hwm_buffer_load_file() and hwm_buffer_load_fd(): always
+ * read the file into the buffer's own storage, rather than mapping
+ * it.
+ */
+
+#define HWM_BUFFER_LOAD_FILE_NO_MMAP  0x0001
+
+/**
+ * Flag for hwm_buffer_load_file() and hwm_buffer_load_fd(): fault in
+ * the whole mapping up front, rather than as it's read.
+ */
+
+#define HWM_BUFFER_LOAD_FILE_POPULATE  0x0002
+
+/**
+ * Flag for hwm_buffer_load_file() and hwm_buffer_load_fd(): the file
+ * will be read sequentially, so the kernel should read ahead
+ * aggressively.
+ */
+
+#define HWM_BUFFER_LOAD_FILE_SEQUENTIAL  0x0004
+
+
+/**
+ * Load the contents of a file into the HWM buffer.  If possible, we
+ * don't copy the file at all; instead, we map it into memory, and
+ * point the buffer at the mapping, just like the “point” functions do.
+ * The first time you modify the buffer, the contents are copied into
+ * the buffer's own storage, and the mapping is released.  Files that
+ * can't be mapped are read into the buffer's own storage instead.  If
+ * we can't open or read the file, we return false, and errno
+ * describes the error.
+ */
+
+bool
+hwm_buffer_load_file(hwm_buffer_t *hwm, const char *path,
+                     unsigned int flags);
+
+
+/**
+ * Load the contents of an open file descriptor into the HWM buffer.
+ * This works just like hwm_buffer_load_file().  Regular files are
+ * mapped, starting at offset 0, regardless of the descriptor's
+ * current position; anything else, such as a pipe or a socket, is
+ * read until end-of-file.  The descriptor can be closed as soon as
+ * this function returns.
+ */
+
+bool
+hwm_buffer_load_fd(hwm_buffer_t *hwm, int fd, unsigned int flags);
+
+
+/**
+ * The number of bytes that hwm_buffer_append_from_fd() reads when you
+ * don't give it a limit, and the amount that
+ * hwm_buffer_append_from_fd_until_eof() grows the buffer by when its
+ * unused space fills up.
+ */
+
+#define HWM_BUFFER_READ_CHUNK_SIZE  65536
+
+
+/**
+ * Read at most max bytes from a file descriptor, appending them to the
+ * HWM buffer.  If max is 0, we read at most
+ * HWM_BUFFER_READ_CHUNK_SIZE bytes.  The buffer is grown first (using
+ * its growth policy) so that there's room for max bytes, and the data
+ * is read directly into the buffer's unused space, without any
+ * intermediate copy.  We make a single read() call, retrying it if
+ * it's interrupted by a signal.
+ *
+ * We return the number of bytes appended, or 0 at end-of-file.  If we
+ * can't expand the buffer, or the read fails, we return -1, and errno
+ * describes the error; for a non-blocking descriptor with no data
+ * available, this will be EAGAIN or EWOULDBLOCK.  The buffer's
+ * existing contents are left intact either way.
+ */
+
+ssize_t
+hwm_buffer_append_from_fd(hwm_buffer_t *hwm, int fd, size_t max);
+
+
+/**
+ * Read from a file descriptor until end-of-file, appending everything
+ * to the HWM buffer.  Whenever the buffer's unused space fills up, we
+ * grow it by at least HWM_BUFFER_READ_CHUNK_SIZE bytes (the growth
+ * policy decides the actual size), so each read() call fills as much
+ * of the buffer as the descriptor will give us.
+ *
+ * We return true once we reach end-of-file.  If we can't expand the
+ * buffer, or a read fails, we return false, and errno describes the
+ * error.  For a non-blocking descriptor, this will be EAGAIN or
+ * EWOULDBLOCK once there's no more data available for now; you can
+ * call this function again when the descriptor is readable.  In all
+ * cases, if bytes_read isn't NULL, it's set to the number of bytes
+ * that were appended by this call.
+ */
+
+bool
+hwm_buffer_append_from_fd_until_eof(hwm_buffer_t *hwm, int fd,
+                                    size_t *bytes_read);
+
+
+/**
+ * Write the contents of several HWM buffers to a file descriptor, one
+ * after the other, as if they had been concatenated into a single
+ * buffer.  The buffers can own their data or point at someone else's;
+ * either way, nothing is copied.  We pass as many buffers as we can
+ * to each writev() call, and keep calling it until everything has
+ * been written, retrying if we're interrupted by a signal.
+ *
+ * The written parameter lets you resume an interrupted write.  On
+ * input, it's the number of bytes (counting from the start of the
+ * first buffer) that have already been written, and which we should
+ * skip; on output, it's updated to include everything that this call
+ * wrote.  It can be NULL, in which case we start at the beginning.
+ *
+ * We return true once every byte has been written.  If a write fails,
+ * we return false, and errno describes the error.  For a non-blocking
+ * descriptor, this will be EAGAIN or EWOULDBLOCK once the descriptor
+ * can't accept any more data for now; you can call this function
+ * again, with the same buffers and written count, when the descriptor
+ * is writable.
+ */
+
+bool
+hwm_buffer_write_fd(int fd, const hwm_buffer_t *const *bufs, size_t count,
+                    size_t *written);
+
+
 /**
  * Append one list element to the buffer, returning a pointer to it.
  * If we need to expand the buffer, but can't, we return NULL.
@@ -413,6 +1260,428 @@ void *
 _hwm_buffer_append_list_elem(hwm_buffer_t *hwm, size_t elem_size);
 
 
+/**
+ * Make room for at least count more elements at the end of a list
+ * buffer, returning a pointer to the first of them.  Nothing is added
+ * to the list until you call hwm_buffer_commit_list_elems().  If we
+ * need to expand the buffer, but can't, we return NULL.
+ */
+
+#define hwm_buffer_reserve_list_elems(hwm, type, count)         \
+    ((type *) _hwm_buffer_reserve_list_elems(hwm, sizeof(type), count))
+
+/**
+ * Does the actual work for hwm_buffer_reserve_list_elems().
+ *
+ * @private
+ */
+
+void *
+_hwm_buffer_reserve_list_elems(hwm_buffer_t *hwm, size_t elem_size,
+                               size_t count);
+
+/**
+ * Add count elements, which must have been written into the space
+ * returned by hwm_buffer_reserve_list_elems(), to the end of a list
+ * buffer.
+ */
+
+#define hwm_buffer_commit_list_elems(hwm, type, count) \
+    hwm_buffer_commit(hwm, sizeof(type) * (count))
+
+
+/**
+ * SIMD level: portable scalar code only.
+ */
+
+#define HWM_SIMD_SCALAR  0
+
+/**
+ * SIMD level: SSE4.2 (and the SSSE3 instructions that it implies).
+ */
+
+#define HWM_SIMD_SSE4  1
+
+/**
+ * SIMD level: AVX2.
+ */
+
+#define HWM_SIMD_AVX2  2
+
+
+/**
+ * Return the SIMD level that the library's vectorized functions (such
+ * as the hex and base64 codecs) use.  This is the best level that the
+ * CPU supports, but no higher than the limit set by
+ * hwm_simd_limit().
+ */
+
+int
+hwm_simd_level(void);
+
+
+/**
+ * Limit the SIMD level that the library's vectorized functions use to
+ * at most max_level, and return the resulting level.  Every level
+ * produces the same results, so this is only useful for testing and
+ * benchmarking the lower levels.  The limit applies to the whole
+ * process, and shouldn't be changed while other threads are using the
+ * library.
+ */
+
+int
+hwm_simd_limit(int max_level);
+
+
+/**
+ * Append the hexadecimal encoding of a region of memory to the HWM
+ * buffer, two lowercase digits per byte.  Like
+ * hwm_buffer_append_mem(), this doesn't add a NUL terminator.  The
+ * memory can't point into the buffer itself.  If we can't expand the
+ * buffer, we return false, and the buffer is left unchanged.
+ */
+
+bool
+hwm_buffer_append_hex(hwm_buffer_t *hwm, const void *src, size_t size);
+
+
+/**
+ * Decode size characters of hexadecimal, in either case, and append
+ * the resulting bytes to the HWM buffer.  The characters can't point
+ * into the buffer itself.  If the input has an odd number of
+ * characters, or contains anything other than hex digits, we return
+ * false, with errno set to EINVAL.  We also return false if we can't
+ * expand the buffer.  Either way, the buffer is left unchanged.
+ */
+
+bool
+hwm_buffer_append_from_hex(hwm_buffer_t *hwm,
+                           const char *src, size_t size);
+
+
+/**
+ * Append the base64 encoding of a region of memory to the HWM buffer,
+ * using the standard alphabet from RFC 4648, with padding.  Like
+ * hwm_buffer_append_mem(), this doesn't add a NUL terminator.  The
+ * memory can't point into the buffer itself.  If we can't expand the
+ * buffer, we return false, and the buffer is left unchanged.
+ */
+
+bool
+hwm_buffer_append_base64(hwm_buffer_t *hwm, const void *src, size_t size);
+
+
+/**
+ * Decode size characters of padded base64, using the standard
+ * alphabet, and append the resulting bytes to the HWM buffer.  The
+ * characters can't point into the buffer itself.  If the input isn't
+ * a multiple of four characters long, or contains anything outside of
+ * the alphabet (including whitespace, or padding anywhere but at the
+ * end), we return false, with errno set to EINVAL.  We also return
+ * false if we can't expand the buffer.  Either way, the buffer is left
+ * unchanged.
+ */
+
+bool
+hwm_buffer_append_from_base64(hwm_buffer_t *hwm,
+                              const char *src, size_t size);
+
+
+/**
+ * Returned by the search functions when there's no match.
+ */
+
+#define HWM_BUFFER_NOT_FOUND  ((size_t) -1)
+
+
+/**
+ * Return the offset of the first occurrence of byte in the buffer's
+ * contents, starting the search at offset start.  Return
+ * HWM_BUFFER_NOT_FOUND if there isn't one.  Like the other search
+ * functions, this works the same whether the buffer owns its data or
+ * points at someone else's; for a string buffer, the NUL terminator
+ * is part of the contents that are searched.
+ */
+
+size_t
+hwm_buffer_find_byte(const hwm_buffer_t *hwm, size_t start, uint8_t byte);
+
+
+/**
+ * Return the offset of the first byte in the buffer's contents,
+ * starting at offset start, that's one of the set_size bytes in set.
+ * Return HWM_BUFFER_NOT_FOUND if there isn't one.  Sets of up to
+ * sixteen bytes are searched with vector instructions.
+ */
+
+size_t
+hwm_buffer_find_any(const hwm_buffer_t *hwm, size_t start,
+                    const void *set, size_t set_size);
+
+
+/**
+ * Return the offset of the first occurrence of a region of memory in
+ * the buffer's contents, starting the search at offset start.  An
+ * empty needle matches at start.  Return HWM_BUFFER_NOT_FOUND if there
+ * isn't a match.
+ */
+
+size_t
+hwm_buffer_find_mem(const hwm_buffer_t *hwm, size_t start,
+                    const void *needle, size_t needle_size);
+
+
+/**
+ * Return the number of times that byte occurs in the buffer's
+ * contents.
+ */
+
+size_t
+hwm_buffer_count_byte(const hwm_buffer_t *hwm, uint8_t byte);
+
+
+/**
+ * An iterator over the fields of a region of memory, which are
+ * separated by a delimiter byte.  The fields of the struct are
+ * considered private.
+ */
+
+typedef struct hwm_buffer_split
+{
+    /**
+     * The start of the next field.
+     *
+     * @private
+     */
+
+    const uint8_t  *next;
+
+    /**
+     * The end of the memory that's being split.
+     *
+     * @private
+     */
+
+    const uint8_t  *end;
+
+    /**
+     * The start of the block of memory (up to 64 bytes) that we last
+     * scanned for delimiters.
+     *
+     * @private
+     */
+
+    const uint8_t  *block;
+
+    /**
+     * The end of the block that we last scanned.
+     *
+     * @private
+     */
+
+    const uint8_t  *block_end;
+
+    /**
+     * A bitmask of the delimiters in the last block that we haven't
+     * returned yet.
+     *
+     * @private
+     */
+
+    uint64_t  mask;
+
+    /**
+     * The byte that separates the fields.
+     *
+     * @private
+     */
+
+    uint8_t  delimiter;
+
+    /**
+     * Whether we've returned the last field.
+     *
+     * @private
+     */
+
+    bool  done;
+} hwm_buffer_split_t;
+
+
+/**
+ * Start splitting the buffer's contents into fields.  The fields are
+ * returned as pointers into the buffer, so nothing is allocated or
+ * copied, but the buffer can't be modified until you're done with the
+ * split.  For a string buffer, the NUL terminator is part of the last
+ * field; use hwm_buffer_split_init_mem() with the string's length to
+ * leave it out.
+ */
+
+void
+hwm_buffer_split_init(hwm_buffer_split_t *split, const hwm_buffer_t *hwm,
+                      uint8_t delimiter);
+
+
+/**
+ * Start splitting a region of memory into fields, just like
+ * hwm_buffer_split_init().
+ */
+
+void
+hwm_buffer_split_init_mem(hwm_buffer_split_t *split, const void *src,
+                          size_t size, uint8_t delimiter);
+
+
+/**
+ * Return the next field in *field and *size, and return true; or
+ * return false if there aren't any more fields.  Each delimiter ends a
+ * field, and the last field runs to the end of the memory, so
+ * “a,,b,” has four fields, the second and fourth of which are empty.
+ * Empty memory has no fields at all.
+ */
+
+bool
+hwm_buffer_split_next(hwm_buffer_split_t *split,
+                      const void **field, size_t *size);
+
+
+/**
+ * Start maintaining an incremental hash of the buffer's contents, so
+ * that hwm_buffer_hash() doesn't have to rehash the whole buffer each
+ * time it's called.  The hash is brought up to date as data is added
+ * with hwm_buffer_append_mem(), hwm_buffer_append_str(), and the
+ * hwm_buffer_load_*() functions; anything else that adds to the
+ * buffer is caught up with the next time the hash is requested.
+ * Anything that can change bytes that were already hashed — such as
+ * hwm_buffer_writable_mem(), hwm_buffer_consume(), or pointing the
+ * buffer somewhere else — throws the hash away, and it's recomputed
+ * from scratch the next time it's needed.  Return false if we can't
+ * allocate the hash's state.
+ */
+
+bool
+hwm_buffer_enable_hash(hwm_buffer_t *hwm);
+
+
+/**
+ * Stop maintaining an incremental hash of the buffer's contents.
+ */
+
+void
+hwm_buffer_disable_hash(hwm_buffer_t *hwm);
+
+
+/**
+ * Return a 64-bit hash of the buffer's contents.  This is the same as
+ * calling hwm_buffer_hash_mem() on the contents, but if incremental
+ * hashing is enabled, only the data that's been added since the last
+ * call needs to be hashed.  The hash is XXH64, with a seed of 0; it's
+ * fast and well-distributed, but not cryptographic.
+ */
+
+uint64_t
+hwm_buffer_hash(hwm_buffer_t *hwm);
+
+
+/**
+ * Return a 64-bit hash of a region of memory.  This is the same hash
+ * that hwm_buffer_hash() uses.
+ */
+
+uint64_t
+hwm_buffer_hash_mem(const void *src, size_t size);
+
+
+/**
+ * Return the CRC-32C (Castagnoli) checksum of the buffer's contents.
+ * This uses the CPU's crc32 instruction if it has SSE4.2.
+ */
+
+uint32_t
+hwm_buffer_crc32c(const hwm_buffer_t *hwm);
+
+
+/**
+ * Extend a running CRC-32C checksum with the buffer's contents,
+ * starting at the given offset.  If crc is the checksum of the first
+ * start bytes of the buffer, the result is the checksum of all of it,
+ * so a buffer that's being appended to can be checksummed a piece at
+ * a time.  Pass in a crc of 0 to start a new checksum.
+ */
+
+uint32_t
+hwm_buffer_crc32c_extend(const hwm_buffer_t *hwm, uint32_t crc,
+                         size_t start);
+
+
+/**
+ * Extend a running CRC-32C checksum with a region of memory.  Pass in
+ * a crc of 0 to start a new checksum.
+ */
+
+uint32_t
+hwm_buffer_crc32c_mem(uint32_t crc, const void *src, size_t size);
+
+
+/**
+ * Return whether two buffers have the same contents.  If both buffers
+ * have up-to-date incremental hashes (see hwm_buffer_enable_hash()),
+ * buffers with different hashes are rejected without comparing their
+ * contents.
+ */
+
+bool
+hwm_buffer_equal(const hwm_buffer_t *a, const hwm_buffer_t *b);
+
+
+/**
+ * Return whether the buffer's contents are the same as a region of
+ * memory.
+ */
+
+bool
+hwm_buffer_equal_mem(const hwm_buffer_t *hwm, const void *src, size_t size);
+
+
+/**
+ * Compare the contents of two buffers lexicographically, as unsigned
+ * bytes.  If one buffer is a prefix of the other, the shorter one
+ * comes first.  Return a negative number, zero, or a positive number
+ * if a comes before, is equal to, or comes after b.
+ */
+
+int
+hwm_buffer_cmp(const hwm_buffer_t *a, const hwm_buffer_t *b);
+
+
+/**
+ * Return whether the buffer's contents start with the given bytes.
+ */
+
+bool
+hwm_buffer_has_prefix(const hwm_buffer_t *hwm,
+                      const void *prefix, size_t size);
+
+
+/**
+ * Return whether the buffer's contents end with the given bytes.
+ * Remember that string buffers include their NUL terminator.
+ */
+
+bool
+hwm_buffer_has_suffix(const hwm_buffer_t *hwm,
+                      const void *suffix, size_t size);
+
+
+/**
+ * Return the number of bytes at the start of two buffers that are the
+ * same.
+ */
+
+size_t
+hwm_buffer_common_prefix_size(const hwm_buffer_t *a, const hwm_buffer_t *b);
+
+
 /**
  * Print the contents of the buffer to the specified stream.  The data
  * is printed in the following format:
@@ -420,10 +1689,84 @@ _hwm_buffer_append_list_elem(hwm_buffer_t *hwm, size_t elem_size);
  * <pre>
  *   00 01 02 03 04 05 06 07   08 09 0a 0b 0c 0d 0e 0f
  *     <i>etc.</i></pre>
+ *
+ * This is the same as calling hwm_buffer_fprint_hexdump() with no
+ * flags.
  */
 
 void
 hwm_buffer_fprint(FILE *stream, hwm_buffer_t *hwm);
 
 
+/**
+ * A hex dump flag that starts each line with an offset column, giving
+ * the offset of the line's first byte in hex.
+ */
+
+#define HWM_BUFFER_HEXDUMP_OFFSET  0x0001
+
+/**
+ * A hex dump flag that ends each line with an ASCII gutter, showing
+ * the line's printable characters, with a “.” in place of each
+ * unprintable one.
+ */
+
+#define HWM_BUFFER_HEXDUMP_ASCII  0x0002
+
+
+/**
+ * Return the number of characters in a hex dump of size bytes of
+ * data, whose offset column (if any) starts at start_offset.  This is
+ * exactly the amount of space that hwm_buffer_format_hexdump() needs.
+ */
+
+size_t
+hwm_buffer_hexdump_size(size_t size, size_t start_offset,
+                        unsigned int flags);
+
+
+/**
+ * Render a hex dump of size bytes of data into dest, which must have
+ * room for hwm_buffer_hexdump_size() characters.  The dump uses the
+ * same layout as hwm_buffer_fprint(), with sixteen bytes per line and
+ * a newline at the end of each line, including the last.  flags is a
+ * combination of the HWM_BUFFER_HEXDUMP_* flags; if the offset column
+ * is included, the first byte's offset is start_offset.  No NUL
+ * terminator is written.  Return the number of characters written.
+ */
+
+size_t
+hwm_buffer_format_hexdump(char *dest, const void *src, size_t size,
+                          size_t start_offset, unsigned int flags);
+
+
+/**
+ * Append a hex dump of size bytes of data to the HWM buffer, just like
+ * hwm_buffer_format_hexdump().  Like hwm_buffer_append_mem(), this
+ * doesn't add a NUL terminator.  The data can't point into the buffer
+ * itself.  If we can't expand the buffer, we return false, and the
+ * buffer is left unchanged.
+ */
+
+bool
+hwm_buffer_append_hexdump(hwm_buffer_t *hwm, const void *src, size_t size,
+                          size_t start_offset, unsigned int flags);
+
+
+/**
+ * Print a hex dump of part of the buffer's contents to the specified
+ * stream.  The dump covers size bytes starting at offset, limited to
+ * the contents of the buffer; pass in SIZE_MAX to dump everything
+ * from offset onwards.  The offset column, if requested, gives each
+ * byte's offset within the buffer.  The whole dump is rendered into
+ * memory first, and then written with a single call to fwrite().
+ * Return false if we can't allocate memory for the dump, or if the
+ * write fails.
+ */
+
+bool
+hwm_buffer_fprint_hexdump(FILE *stream, const hwm_buffer_t *hwm,
+                          size_t offset, size_t size, unsigned int flags);
+
+
 #endif /* HWM_BUFFER_H */
@@ -0,0 +1,245 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2009, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef HWM_CHAIN_H
+#define HWM_CHAIN_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/uio.h>
+
+#include <hwm-buffer.h>
+
+/**
+ * @file
+ *
+ * This file provides a segmented buffer, or chain.  A chain stores its
+ * contents in a list of separate segments, rather than in a single
+ * contiguous block of memory.  When the last segment fills up, we
+ * start a new one, so data that's already been appended is never
+ * copied, no matter how large the chain gets.  Segments start small
+ * and double in size, up to a maximum, so that small payloads don't
+ * waste memory, and large ones don't need too many segments.
+ *
+ * Each segment is an HWM buffer.  Clearing the chain keeps the
+ * segments' allocations around, so a chain that's reused for a series
+ * of payloads reaches a high-water mark just like a single buffer
+ * does.
+ *
+ * A chain's contents can be handed to writev() as an array of iovecs,
+ * or visited one segment at a time with an iterator.  If you need the
+ * contents to be contiguous, hwm_chain_flatten() copies them into an
+ * HWM buffer.
+ */
+
+
+/**
+ * The default size of a chain's first segment, used if you pass in 0
+ * to hwm_chain_init().
+ */
+
+#define HWM_CHAIN_DEFAULT_FIRST_SEGMENT_SIZE  4096
+
+/**
+ * The default maximum size of a chain's segments, used if you pass in
+ * 0 to hwm_chain_init().
+ */
+
+#define HWM_CHAIN_DEFAULT_MAX_SEGMENT_SIZE  (1024 * 1024)
+
+
+/**
+ * A segmented buffer.  The fields of the struct are considered
+ * private — you should not access them directly.  Instead, use one of
+ * the accessor macros defined below.
+ */
+
+typedef struct hwm_chain
+{
+    /**
+     * The chain's segments, as a list of hwm_buffer_t.  This includes
+     * segments that aren't in use right now, but which have kept
+     * their allocations from before the chain was last cleared.
+     *
+     * @private
+     */
+
+    hwm_buffer_t  segments;
+
+    /**
+     * The number of segments that currently hold data.  All but the
+     * last of these are full.
+     *
+     * @private
+     */
+
+    size_t  segment_count;
+
+    /**
+     * The total number of bytes in the chain.
+     *
+     * @private
+     */
+
+    size_t  current_size;
+
+    /**
+     * The size of the first segment.
+     *
+     * @private
+     */
+
+    size_t  first_segment_size;
+
+    /**
+     * The maximum size of any segment.
+     *
+     * @private
+     */
+
+    size_t  max_segment_size;
+} hwm_chain_t;
+
+
+/**
+ * Return the total number of bytes in the chain.
+ */
+
+#define hwm_chain_current_size(chain) ((chain)->current_size)
+
+/**
+ * Return the number of segments that currently hold data.  This is the
+ * number of iovecs that hwm_chain_fill_iov() needs to describe the
+ * entire chain.
+ */
+
+#define hwm_chain_segment_count(chain) ((chain)->segment_count)
+
+
+/**
+ * An iterator over the segments of a chain.  The fields of the struct
+ * are considered private.
+ */
+
+typedef struct hwm_chain_iter
+{
+    /**
+     * The chain that we're iterating over.
+     *
+     * @private
+     */
+
+    const hwm_chain_t  *chain;
+
+    /**
+     * The index of the next segment to return.
+     *
+     * @private
+     */
+
+    size_t  index;
+} hwm_chain_iter_t;
+
+
+/**
+ * Initialize a new chain.  The first segment will be first_size
+ * bytes, and each later segment will be twice as large as the one
+ * before it, until they reach max_size bytes.  If you pass in the same
+ * value for both, every segment has the same size.  If either size is
+ * 0, we use the corresponding default.
+ */
+
+void
+hwm_chain_init(hwm_chain_t *chain, size_t first_size, size_t max_size);
+
+
+/**
+ * Finalize a chain, freeing all of its segments.
+ */
+
+void
+hwm_chain_done(hwm_chain_t *chain);
+
+
+/**
+ * Clear the contents of a chain, keeping its segments' allocations so
+ * that they can be reused.
+ */
+
+void
+hwm_chain_clear(hwm_chain_t *chain);
+
+
+/**
+ * Append a region of memory to the end of the chain.  If we need a new
+ * segment, but can't allocate one, we return false, and the chain is
+ * left unchanged.
+ */
+
+bool
+hwm_chain_append_mem(hwm_chain_t *chain, const void *src, size_t size);
+
+
+/**
+ * Append the characters of a NUL-terminated string to the end of the
+ * chain.  Unlike hwm_buffer_append_str(), the chain doesn't store a
+ * NUL terminator, since its contents aren't contiguous; if you need
+ * a C string, append a NUL before flattening the chain.  If we need
+ * a new segment, but can't allocate one, we return false, and the
+ * chain is left unchanged.
+ */
+
+bool
+hwm_chain_append_str(hwm_chain_t *chain, const char *src);
+
+
+/**
+ * Fill in an array of iovecs that describe the chain's contents,
+ * skipping the first offset bytes.  At most max_iov iovecs are filled
+ * in; we return the number that were.  The offset makes it easy to
+ * continue after a partial writev().  The iovecs are only valid until
+ * the chain is next modified.
+ */
+
+size_t
+hwm_chain_fill_iov(const hwm_chain_t *chain, size_t offset,
+                   struct iovec *iov, size_t max_iov);
+
+
+/**
+ * Copy the contents of the chain into an HWM buffer, replacing
+ * whatever the buffer used to contain.  Return false if we can't
+ * expand the buffer.
+ */
+
+bool
+hwm_chain_flatten(const hwm_chain_t *chain, hwm_buffer_t *hwm);
+
+
+/**
+ * Start iterating over the segments of a chain.
+ */
+
+void
+hwm_chain_iter_init(hwm_chain_iter_t *iter, const hwm_chain_t *chain);
+
+
+/**
+ * Return the next non-empty segment of the chain in *data and *size.
+ * Return false when there are no more segments.  The chain must not be
+ * modified while you're iterating over it.
+ */
+
+bool
+hwm_chain_iter_next(hwm_chain_iter_t *iter,
+                    const void **data, size_t *size);
+
+
+#endif /* HWM_CHAIN_H */
@@ -0,0 +1,102 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2009, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef HWM_MMAP_H
+#define HWM_MMAP_H
+
+#include <stdlib.h>
+
+#include <hwm-buffer.h>
+
+/**
+ * @file
+ *
+ * This file provides an allocator that places large buffers in
+ * anonymous memory mappings.  Allocations smaller than a threshold
+ * come from malloc as usual.  Once a buffer grows past the threshold,
+ * its storage is moved into its own mapping, and from then on it
+ * grows with mremap, which lets the kernel move the pages to a new
+ * address instead of copying the buffer's contents.  (On systems
+ * without mremap, we fall back on mapping a new region and copying.)
+ *
+ * Mappings that are at least 2MB long are aligned to a 2MB boundary,
+ * so that the kernel can back them with transparent huge pages.  This
+ * allocator honors all of the buffer advice flags (see
+ * hwm_buffer_set_advice()) for storage that lives in a mapping.
+ *
+ * You can also ask for each mapping to reserve a minimum amount of
+ * address space up front.  The kernel only commits pages as they're
+ * touched, so a buffer with a large reservation can grow into it
+ * without any system calls at all, while only using as much memory
+ * as it actually fills.
+ */
+
+
+/**
+ * The default threshold, used if the allocator's context pointer is
+ * NULL.
+ */
+
+#define HWM_MMAP_DEFAULT_THRESHOLD  (4 * 1024 * 1024)
+
+
+/**
+ * The configuration for an mmap allocator.  A pointer to one of these
+ * is the allocator's context pointer.
+ */
+
+typedef struct hwm_mmap_config
+{
+    /**
+     * Allocations of at least this many bytes are placed in their own
+     * memory mapping.
+     */
+
+    size_t  threshold;
+
+    /**
+     * The minimum size of each memory mapping.  The buffer can grow
+     * to this size without reallocating.  0 means that each mapping
+     * is just large enough for the requested size.
+     */
+
+    size_t  reserve;
+} hwm_mmap_config_t;
+
+
+/**
+ * Staticly initialize an hwm_mmap_config_t.
+ */
+
+#define HWM_MMAP_CONFIG_INIT(threshold, reserve) \
+    { (threshold), (reserve) }
+
+
+/**
+ * An allocator that places large allocations in anonymous memory
+ * mappings.  The allocator's context pointer must be an
+ * hwm_mmap_config_t, or NULL to use the default threshold.
+ */
+
+extern const hwm_allocator_t  hwm_mmap_allocator;
+
+
+/**
+ * Initialize a new HWM buffer that uses an mmap allocator with the
+ * given configuration.  The configuration must remain valid for as
+ * long as the buffer does.  If config is NULL, we use the default
+ * threshold and no reservation.
+ */
+
+void
+hwm_buffer_init_with_mmap(hwm_buffer_t *hwm, hwm_mmap_config_t *config);
+
+
+#endif /* HWM_MMAP_H */
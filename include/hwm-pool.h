@@ -0,0 +1,400 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2009, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef HWM_POOL_H
+#define HWM_POOL_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <hwm-buffer.h>
+
+/**
+ * @file
+ *
+ * This file provides a pool of HWM buffers.  A buffer only gets to
+ * reuse its high-water allocation as long as someone keeps it alive;
+ * a pool lets request-scoped code do that without keeping track of
+ * the buffers itself.  Buffers that are released back into the pool
+ * keep their allocations, and are sorted into bins by size class.
+ * When someone acquires a buffer, we hand out the smallest retained
+ * buffer that's already large enough, rather than creating a new one
+ * that starts from zero.
+ *
+ * An hwm_pool_t is not thread-safe.  For buffers that are acquired
+ * and released from several threads (possibly different ones for the
+ * same buffer), use an hwm_mt_pool_t instead.  It keeps a fixed number
+ * of buffer slots on a lock-free free list, with a small per-thread
+ * cache in front of it, so that acquiring and releasing a buffer
+ * usually doesn't touch any shared state at all.
+ */
+
+
+/**
+ * The number of size-class bins in a pool.  Bin n holds buffers whose
+ * allocated size is at least 2<sup>n</sup> bytes, but less than
+ * 2<sup>n+1</sup>.
+ */
+
+#define HWM_POOL_BIN_COUNT  (sizeof(size_t) * 8)
+
+
+/**
+ * A buffer that's managed by a pool.
+ *
+ * @private
+ */
+
+typedef struct hwm_pool_entry  hwm_pool_entry_t;
+
+
+/**
+ * A pool of HWM buffers.  The fields of the struct are considered
+ * private — you should not access them directly.  Instead, use one of
+ * the accessor macros defined below.
+ */
+
+typedef struct hwm_pool
+{
+    /**
+     * The retained buffers in each size class.
+     *
+     * @private
+     */
+
+    hwm_pool_entry_t  *bins[HWM_POOL_BIN_COUNT];
+
+    /**
+     * The maximum number of buffers that we'll retain, or 0 if
+     * there's no limit.
+     *
+     * @private
+     */
+
+    size_t  max_buffers;
+
+    /**
+     * The maximum number of allocated bytes that we'll retain, or 0
+     * if there's no limit.
+     *
+     * @private
+     */
+
+    size_t  max_bytes;
+
+    /**
+     * The number of buffers that we're currently retaining.
+     *
+     * @private
+     */
+
+    size_t  retained_buffers;
+
+    /**
+     * The number of allocated bytes that we're currently retaining.
+     *
+     * @private
+     */
+
+    size_t  retained_bytes;
+
+    /**
+     * The number of times that hwm_pool_acquire() was able to reuse a
+     * retained buffer.
+     *
+     * @private
+     */
+
+    size_t  hits;
+
+    /**
+     * The number of times that hwm_pool_acquire() had to create a new
+     * buffer.
+     *
+     * @private
+     */
+
+    size_t  misses;
+
+    /**
+     * The growth policy given to new buffers.
+     *
+     * @private
+     */
+
+    const hwm_growth_policy_t  *growth;
+} hwm_pool_t;
+
+
+/**
+ * Return the number of times that the pool was able to hand out a
+ * retained buffer.
+ */
+
+#define hwm_pool_hits(pool) ((pool)->hits)
+
+/**
+ * Return the number of times that the pool had to create a new
+ * buffer.
+ */
+
+#define hwm_pool_misses(pool) ((pool)->misses)
+
+/**
+ * Return the number of buffers that the pool is currently retaining.
+ */
+
+#define hwm_pool_retained_buffers(pool) ((pool)->retained_buffers)
+
+/**
+ * Return the number of allocated bytes that the pool is currently
+ * retaining.
+ */
+
+#define hwm_pool_retained_bytes(pool) ((pool)->retained_bytes)
+
+
+/**
+ * Initialize a new pool.  The pool will retain at most max_buffers
+ * released buffers, whose allocations add up to at most max_bytes
+ * bytes.  A limit of 0 means that there is no limit.
+ */
+
+void
+hwm_pool_init(hwm_pool_t *pool, size_t max_buffers, size_t max_bytes);
+
+
+/**
+ * Finalize a pool, freeing all of the buffers that it's retaining.
+ * Buffers that are still acquired must not be released afterwards.
+ */
+
+void
+hwm_pool_done(hwm_pool_t *pool);
+
+
+/**
+ * Set the growth policy that's given to buffers that the pool creates.
+ */
+
+void
+hwm_pool_set_growth(hwm_pool_t *pool, const hwm_growth_policy_t *policy);
+
+
+/**
+ * Acquire an empty buffer from the pool, with at least min_size bytes
+ * already allocated.  If there's a retained buffer that's large
+ * enough, we return it; otherwise we create a new one.  Return NULL if
+ * we can't allocate the buffer.
+ */
+
+hwm_buffer_t *
+hwm_pool_acquire(hwm_pool_t *pool, size_t min_size);
+
+
+/**
+ * Release a buffer back into the pool.  The buffer must have come from
+ * hwm_pool_acquire() on the same pool.  It's cleared, and either
+ * retained (along with its allocation) or freed, depending on the
+ * pool's limits.  Any settings made on the buffer since it was
+ * acquired (its growth policy, hash, advice, and decay) are reset, so
+ * that the next user sees a fresh buffer.
+ */
+
+void
+hwm_pool_release(hwm_pool_t *pool, hwm_buffer_t *hwm);
+
+
+/**
+ * The number of buffers that each thread keeps in its private cache
+ * for an hwm_mt_pool_t.
+ */
+
+#define HWM_MT_POOL_CACHE_SIZE  32
+
+
+/**
+ * One of the buffer slots in a concurrent pool.
+ *
+ * @private
+ */
+
+typedef struct hwm_mt_pool_slot  hwm_mt_pool_slot_t;
+
+/**
+ * A per-thread cache of buffer slots for a concurrent pool.
+ *
+ * @private
+ */
+
+typedef struct hwm_mt_pool_cache  hwm_mt_pool_cache_t;
+
+
+/**
+ * A thread-safe pool of HWM buffers.  The fields of the struct are
+ * considered private — you should not access them directly.
+ */
+
+typedef struct hwm_mt_pool
+{
+    /**
+     * The pool's buffer slots.
+     *
+     * @private
+     */
+
+    hwm_mt_pool_slot_t  *slots;
+
+    /**
+     * The number of slots in the pool.
+     *
+     * @private
+     */
+
+    uint32_t  capacity;
+
+    /**
+     * The head of the shared free list.  The lower 32 bits are one
+     * more than the index of the first free slot (so that 0 means
+     * that the list is empty); the upper 32 bits are a tag that's
+     * incremented on every update, so that a compare-and-swap can't
+     * be fooled by a slot that was popped and pushed back in the
+     * meantime.
+     *
+     * @private
+     */
+
+    uint64_t  free_head;
+
+    /**
+     * Every per-thread cache that's been created for this pool.
+     * Caches are never removed from this list until the pool is
+     * finalized; when a thread exits, its cache is emptied and made
+     * available to the next new thread.
+     *
+     * @private
+     */
+
+    hwm_mt_pool_cache_t  *caches;
+
+    /**
+     * The key that we use to find the current thread's cache.
+     *
+     * @private
+     */
+
+    pthread_key_t  cache_key;
+
+    /**
+     * Released buffers whose allocation is larger than this have
+     * their storage freed.  0 means that there is no limit.
+     *
+     * @private
+     */
+
+    size_t  max_retained_size;
+
+    /**
+     * Hits and misses for threads that couldn't create a cache.
+     *
+     * @private
+     */
+
+    size_t  hits;
+    size_t  misses;
+
+    /**
+     * The growth policy given to the pool's buffers.
+     *
+     * @private
+     */
+
+    const hwm_growth_policy_t  *growth;
+} hwm_mt_pool_t;
+
+
+/**
+ * Initialize a new concurrent pool with room for capacity buffers.
+ * Released buffers whose allocations are larger than
+ * max_retained_size bytes have their storage freed; a limit of 0
+ * means that there is no limit.  If the pool runs out of slots,
+ * hwm_mt_pool_acquire() hands out ordinary heap-allocated buffers,
+ * which are freed when they're released.  Return false if we can't
+ * allocate the pool's slots.
+ */
+
+bool
+hwm_mt_pool_init(hwm_mt_pool_t *pool, uint32_t capacity,
+                 size_t max_retained_size);
+
+
+/**
+ * Finalize a concurrent pool, freeing all of its buffers.  Every
+ * buffer must have been released before you call this, and no other
+ * thread may be using the pool.
+ */
+
+void
+hwm_mt_pool_done(hwm_mt_pool_t *pool);
+
+
+/**
+ * Set the growth policy that's given to the pool's buffers.  This
+ * must be called before the pool is used.
+ */
+
+void
+hwm_mt_pool_set_growth(hwm_mt_pool_t *pool,
+                       const hwm_growth_policy_t *policy);
+
+
+/**
+ * Acquire an empty buffer from the pool, with at least min_size bytes
+ * allocated.  This can be called from any thread.  Return NULL if we
+ * can't allocate the buffer.
+ */
+
+hwm_buffer_t *
+hwm_mt_pool_acquire(hwm_mt_pool_t *pool, size_t min_size);
+
+
+/**
+ * Release a buffer back into the pool.  The buffer must have come from
+ * hwm_mt_pool_acquire() on the same pool, but it can be released from
+ * any thread.  As with hwm_pool_release(), the buffer's settings are
+ * reset along with its contents.
+ */
+
+void
+hwm_mt_pool_release(hwm_mt_pool_t *pool, hwm_buffer_t *hwm);
+
+
+/**
+ * Return the number of times that the pool was able to hand out a
+ * buffer that already had enough storage.  The result is only
+ * approximate while other threads are using the pool.
+ */
+
+size_t
+hwm_mt_pool_hits(hwm_mt_pool_t *pool);
+
+
+/**
+ * Return the number of times that the pool had to allocate storage for
+ * an acquired buffer.  The result is only approximate while other
+ * threads are using the pool.
+ */
+
+size_t
+hwm_mt_pool_misses(hwm_mt_pool_t *pool);
+
+
+#endif /* HWM_POOL_H */
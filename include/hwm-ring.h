@@ -0,0 +1,211 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2009, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef HWM_RING_H
+#define HWM_RING_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <hwm-buffer.h>
+
+/**
+ * @file
+ *
+ * This file provides a ring buffer whose contents are always
+ * contiguous in memory.  The ring's storage is a shared memory object
+ * that's mapped twice, back to back, so the byte just past the end of
+ * the first mapping is the first byte of the storage again.  Data that
+ * wraps around the end of the ring can therefore be read (and free
+ * space can be written) as a single contiguous region, and parsers
+ * never have to deal with the wraparound themselves.
+ *
+ * Data is added with a reserve/commit pair: hwm_ring_reserve() returns
+ * a pointer to at least the requested amount of free space, which you
+ * fill in (for instance, with read()) before calling hwm_ring_commit()
+ * with the number of bytes that you actually wrote.  Data is removed
+ * from the front with hwm_ring_consume().  Neither ever copies data.
+ *
+ * Like an HWM buffer, a ring only grows: if a reservation doesn't fit
+ * in the ring's free space, the ring's storage is replaced by a larger
+ * one, and the contents are copied over.  From then on, the ring keeps
+ * its new capacity.
+ *
+ * You can look at a ring's contents with an ordinary hwm_buffer_t by
+ * calling hwm_ring_view(), which points the buffer at them.
+ *
+ * Rings need Linux's memfd_create() system call.
+ */
+
+
+/**
+ * A double-mapped ring buffer.  The fields of the struct are
+ * considered private — you should not access them directly.  Instead,
+ * use one of the accessor macros defined below.
+ */
+
+typedef struct hwm_ring
+{
+    /**
+     * The start of the ring's double mapping, which is 2 * capacity
+     * bytes long, or NULL if we haven't allocated any storage yet.
+     *
+     * @private
+     */
+
+    void  *base;
+
+    /**
+     * The size of the ring's storage.  This is always a multiple of
+     * the page size.
+     *
+     * @private
+     */
+
+    size_t  capacity;
+
+    /**
+     * The offset of the first byte of the ring's contents.  This is
+     * always less than capacity (or 0, if there's no storage).
+     *
+     * @private
+     */
+
+    size_t  head;
+
+    /**
+     * The number of bytes in the ring.
+     *
+     * @private
+     */
+
+    size_t  current_size;
+} hwm_ring_t;
+
+
+/**
+ * Return the number of bytes in the ring.
+ */
+
+#define hwm_ring_current_size(ring) ((ring)->current_size)
+
+/**
+ * Return the size of the ring's storage.
+ */
+
+#define hwm_ring_capacity(ring) ((ring)->capacity)
+
+/**
+ * Return the number of bytes that can be added to the ring without
+ * growing it.
+ */
+
+#define hwm_ring_available(ring) \
+    ((ring)->capacity - (ring)->current_size)
+
+/**
+ * Return a const pointer to the ring's contents, cast to the desired
+ * type.  The contents are always contiguous.
+ */
+
+#define hwm_ring_mem(ring, type) \
+    ((const type *) ((const char *) (ring)->base + (ring)->head))
+
+
+/**
+ * Initialize a new ring with room for at least capacity bytes, which
+ * is rounded up to a multiple of the page size.  If capacity is 0, we
+ * don't allocate any storage until the first reservation.  Return
+ * false, with errno describing the error, if we can't create the
+ * ring's storage.
+ */
+
+bool
+hwm_ring_init(hwm_ring_t *ring, size_t capacity);
+
+
+/**
+ * Finalize a ring, unmapping its storage.
+ */
+
+void
+hwm_ring_done(hwm_ring_t *ring);
+
+
+/**
+ * Remove everything from the ring, keeping its storage.
+ */
+
+void
+hwm_ring_clear(hwm_ring_t *ring);
+
+
+/**
+ * Grow the ring's storage so that it can hold at least capacity bytes,
+ * keeping its contents.  The ring never shrinks.  Return false, with
+ * errno describing the error, if we can't create the new storage; the
+ * ring is left untouched in that case.
+ */
+
+bool
+hwm_ring_resize(hwm_ring_t *ring, size_t capacity);
+
+
+/**
+ * Return a pointer to at least size bytes of contiguous free space
+ * just past the end of the ring's contents.  If the ring doesn't have
+ * that much free space, we grow it to at least twice its current
+ * capacity first.  Nothing is added to the ring until you call
+ * hwm_ring_commit().  The pointer is valid until the ring is next
+ * modified.  Return NULL if we need to grow the ring, but can't.
+ */
+
+void *
+hwm_ring_reserve(hwm_ring_t *ring, size_t size);
+
+
+/**
+ * Add size bytes, which must have been written into the space returned
+ * by the last call to hwm_ring_reserve(), to the end of the ring.
+ */
+
+void
+hwm_ring_commit(hwm_ring_t *ring, size_t size);
+
+
+/**
+ * Remove size bytes from the front of the ring.  If size is larger
+ * than the ring's contents, the ring is emptied.
+ */
+
+void
+hwm_ring_consume(hwm_ring_t *ring, size_t size);
+
+
+/**
+ * Copy data onto the end of the ring, growing it if necessary.  Return
+ * false if we need to grow the ring, but can't.
+ */
+
+bool
+hwm_ring_append_mem(hwm_ring_t *ring, const void *src, size_t size);
+
+
+/**
+ * Point an HWM buffer at the ring's contents, so that they can be
+ * passed to anything that expects an hwm_buffer_t.  The view is only
+ * valid until the ring is next modified.
+ */
+
+void
+hwm_ring_view(const hwm_ring_t *ring, hwm_buffer_t *view);
+
+
+#endif /* HWM_RING_H */
@@ -9,9 +9,43 @@
  */
 
 #include <stdlib.h>
+#include <sys/mman.h>
 
 #include <hwm-buffer.h>
 
+#include "hwm-private.h"
+
+
+static void *
+default_allocate(void *ctx, size_t size)
+{
+    return malloc(size);
+}
+
+
+static void *
+default_reallocate(void *ctx, void *ptr, size_t old_size, size_t new_size)
+{
+    return realloc(ptr, new_size);
+}
+
+
+static void
+default_deallocate(void *ctx, void *ptr, size_t size)
+{
+    free(ptr);
+}
+
+
+const hwm_allocator_t  hwm_allocator_default =
+{
+    default_allocate,
+    default_reallocate,
+    default_deallocate,
+    NULL,
+    NULL
+};
+
 
 void
 hwm_buffer_init(hwm_buffer_t *hwm)
@@ -26,19 +60,84 @@ hwm_buffer_init(hwm_buffer_t *hwm)
     hwm->allocation_count = 0;
     hwm->data = NULL;
     hwm->buf = NULL;
+    hwm->growth = NULL;
+    hwm->allocator = NULL;
+    hwm->allocator_ctx = NULL;
+    hwm->decay_cycles = 0;
+    hwm->decay_count = 0;
+    hwm->decay_peak = 0;
+    hwm->advice = 0;
+    hwm->mapping = NULL;
+    hwm->mapping_size = 0;
+    hwm->shared = NULL;
+    hwm->consumed = 0;
+    hwm->hash = NULL;
+}
+
+
+void
+hwm_buffer_init_with_growth(hwm_buffer_t *hwm,
+                            const hwm_growth_policy_t *policy)
+{
+    hwm_buffer_init(hwm);
+    hwm->growth = policy;
+}
+
+
+void
+hwm_buffer_init_with_allocator(hwm_buffer_t *hwm,
+                               const hwm_allocator_t *allocator,
+                               void *ctx)
+{
+    hwm_buffer_init(hwm);
+    hwm->allocator = allocator;
+    hwm->allocator_ctx = ctx;
+}
+
+
+void
+hwm_buffer_set_growth(hwm_buffer_t *hwm, const hwm_growth_policy_t *policy)
+{
+    hwm->growth = policy;
+}
+
+
+void
+hwm_buffer_set_decay(hwm_buffer_t *hwm, unsigned int cycles)
+{
+    hwm->decay_cycles = cycles;
+    hwm->decay_count = 0;
+    hwm->decay_peak = 0;
+}
+
+
+void
+hwm_buffer_set_advice(hwm_buffer_t *hwm, unsigned int flags)
+{
+    hwm->advice = flags;
 }
 
 
 hwm_buffer_t *
 hwm_buffer_new()
+{
+    return hwm_buffer_new_with_allocator(NULL, NULL);
+}
+
+
+hwm_buffer_t *
+hwm_buffer_new_with_allocator(const hwm_allocator_t *allocator, void *ctx)
 {
     hwm_buffer_t  *result = NULL;
 
+    if (allocator == NULL)
+        allocator = &hwm_allocator_default;
+
     /*
      * Try to allocate a new buffer.
      */
 
-    result = (hwm_buffer_t *) malloc(sizeof(hwm_buffer_t));
+    result = (hwm_buffer_t *) allocator->allocate(ctx, sizeof(hwm_buffer_t));
     if (result == NULL)
         return NULL;
 
@@ -46,23 +145,48 @@ hwm_buffer_new()
      * If that worked, initialize and return the buffer.
      */
 
-    hwm_buffer_init(result);
+    hwm_buffer_init_with_allocator(result, allocator, ctx);
     return result;
 }
 
 
+void
+_hwm_buffer_release_data(hwm_buffer_t *hwm)
+{
+    if (hwm->mapping != NULL)
+    {
+        munmap(hwm->mapping, hwm->mapping_size);
+        hwm->mapping = NULL;
+        hwm->mapping_size = 0;
+    }
+
+    if (hwm->shared != NULL)
+        _hwm_buffer_release_shared(hwm);
+
+    hwm->consumed = 0;
+    hwm_buffer_invalidate_hash(hwm);
+}
+
+
 void
 hwm_buffer_done(hwm_buffer_t *hwm)
 {
     /*
-     * Free the internal buffer, if there is one.
+     * Release anything that the data points at, and free the internal
+     * buffer, if there is one.
      */
 
+    _hwm_buffer_release_data(hwm);
+
     if (hwm->buf != NULL)
-        free(hwm->buf);
+        hwm_buffer_deallocate(hwm, hwm->buf, hwm->allocated_size);
+
+    hwm_buffer_disable_hash(hwm);
 
     /*
-     * Reset the fields to zero.
+     * Reset the fields to zero.  The growth policy and allocator are
+     * part of the buffer's configuration, not its contents, so we
+     * leave them alone.
      */
 
     hwm->allocated_size = 0;
@@ -70,12 +194,22 @@ hwm_buffer_done(hwm_buffer_t *hwm)
     hwm->allocation_count = 0;
     hwm->data = NULL;
     hwm->buf = NULL;
+    hwm->decay_count = 0;
+    hwm->decay_peak = 0;
 }
 
 
 void
 hwm_buffer_free(hwm_buffer_t *hwm)
 {
+    /*
+     * The buffer struct itself came from the buffer's allocator, so
+     * that's where we have to return it.
+     */
+
+    const hwm_allocator_t  *allocator = hwm_buffer_allocator(hwm);
+    void  *ctx = hwm->allocator_ctx;
+
     hwm_buffer_done(hwm);
-    free(hwm);
+    allocator->deallocate(ctx, hwm, sizeof(hwm_buffer_t));
 }
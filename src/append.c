@@ -8,23 +8,19 @@
  * ----------------------------------------------------------------------
  */
 
+#include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
+#include <sys/uio.h>
 
 #include <hwm-buffer.h>
 
+#include "hwm-private.h"
 
-/**
- * A helper method for the append family of functions.  Ensures that
- * the buffer is at least as large as new_size.  In addition, if the
- * buffer currently points at some other piece of memory, rather than
- * at its own internal buffer, we copy that data into the internal
- * buffer.  The caller is responsible for ensuring that <code>new_size
- * >= hwm->current_size</code>.
- */
 
-static bool
-grow_and_copy(hwm_buffer_t *hwm, size_t new_size)
+bool
+_hwm_buffer_grow_and_copy(hwm_buffer_t *hwm, size_t new_size)
 {
     /*
      * Make sure we've got enough space in the internal buffer to copy
@@ -39,11 +35,12 @@ grow_and_copy(hwm_buffer_t *hwm, size_t new_size)
      * copy it into our buffer first.
      */
 
-    if (hwm->data != hwm->buf)
+    if (!hwm_buffer_owns_data(hwm))
     {
         if (hwm->current_size > 0)
             memcpy(hwm->buf, hwm->data, hwm->current_size);
 
+        _hwm_buffer_release_data(hwm);
         hwm->data = hwm->buf;
     }
 
@@ -59,10 +56,16 @@ grow_and_copy(hwm_buffer_t *hwm, size_t new_size)
 void *
 _hwm_buffer_writable_mem(hwm_buffer_t *hwm)
 {
-    if (grow_and_copy(hwm, hwm->current_size))
-        return hwm->buf;
-    else
+    if (!_hwm_buffer_grow_and_copy(hwm, hwm->current_size))
         return NULL;
+
+    /*
+     * The caller can change any of the bytes, so we can't trust the
+     * hash anymore.
+     */
+
+    hwm_buffer_invalidate_hash(hwm);
+    return hwm_buffer_owned_mem(hwm);
 }
 
 
@@ -83,7 +86,7 @@ hwm_buffer_append_mem(hwm_buffer_t *hwm, const void *src, size_t size)
      * at the internal buffer, returning an error code if we can't.
      */
 
-    if (!grow_and_copy(hwm, new_size))
+    if (!_hwm_buffer_grow_and_copy(hwm, new_size))
     {
         return false;
     }
@@ -92,12 +95,122 @@ hwm_buffer_append_mem(hwm_buffer_t *hwm, const void *src, size_t size)
      * Once we've got the space, copy the data over.
      */
 
-    memcpy(hwm->buf + hwm->current_size, src, size);
+    memcpy(hwm_buffer_owned_mem(hwm) + hwm->current_size, src, size);
     hwm->current_size += size;
+    hwm_buffer_update_hash(hwm);
+    return true;
+}
+
+
+bool
+hwm_buffer_append_iov(hwm_buffer_t *hwm, const struct iovec *iov,
+                      size_t count)
+{
+    size_t  new_size = hwm->current_size;
+    void  *dest;
+    size_t  i;
+
+    /*
+     * Figure out how much total space we need for the old data and
+     * all of the new pieces, so that we only have to grow once.
+     */
+
+    for (i = 0; i < count; i++)
+    {
+        if (iov[i].iov_len > SIZE_MAX - new_size)
+            return false;
+
+        new_size += iov[i].iov_len;
+    }
+
+    if (!_hwm_buffer_grow_and_copy(hwm, new_size))
+    {
+        return false;
+    }
+
+    dest = hwm_buffer_owned_mem(hwm) + hwm->current_size;
+
+    for (i = 0; i < count; i++)
+    {
+        memcpy(dest, iov[i].iov_base, iov[i].iov_len);
+        dest += iov[i].iov_len;
+    }
+
+    hwm->current_size = new_size;
     return true;
 }
 
 
+bool
+hwm_buffer_append_mems(hwm_buffer_t *hwm, ...)
+{
+    va_list  args;
+    size_t  new_size = hwm->current_size;
+    const void  *src;
+    void  *dest;
+
+    /*
+     * We go through the arguments twice: once to add up the sizes,
+     * and once to copy the data.
+     */
+
+    va_start(args, hwm);
+    while ((src = va_arg(args, const void *)) != NULL)
+    {
+        size_t  size = va_arg(args, size_t);
+
+        if (size > SIZE_MAX - new_size)
+        {
+            va_end(args);
+            return false;
+        }
+
+        new_size += size;
+    }
+    va_end(args);
+
+    if (!_hwm_buffer_grow_and_copy(hwm, new_size))
+    {
+        return false;
+    }
+
+    dest = hwm_buffer_owned_mem(hwm) + hwm->current_size;
+
+    va_start(args, hwm);
+    while ((src = va_arg(args, const void *)) != NULL)
+    {
+        size_t  size = va_arg(args, size_t);
+
+        memcpy(dest, src, size);
+        dest += size;
+    }
+    va_end(args);
+
+    hwm->current_size = new_size;
+    return true;
+}
+
+
+void *
+hwm_buffer_reserve(hwm_buffer_t *hwm, size_t size)
+{
+    if (size > SIZE_MAX - hwm->current_size)
+        return NULL;
+
+    /*
+     * Make sure we've allocated enough space and that we're pointing
+     * at the internal buffer, returning an error code if we can't.
+     */
+
+    if (!_hwm_buffer_grow_and_copy(hwm, hwm->current_size + size))
+    {
+        return NULL;
+    }
+
+    return hwm_buffer_owned_mem(hwm) + hwm->current_size;
+}
+
+
 bool
 hwm_buffer_append_str(hwm_buffer_t *hwm, const char *src)
 {
@@ -136,7 +249,7 @@ hwm_buffer_append_str(hwm_buffer_t *hwm, const char *src)
      * at the internal buffer, returning an error code if we can't.
      */
 
-    if (!grow_and_copy(hwm, new_size))
+    if (!_hwm_buffer_grow_and_copy(hwm, new_size))
     {
         return false;
     }
@@ -147,8 +260,121 @@ hwm_buffer_append_str(hwm_buffer_t *hwm, const char *src)
      * terminator.
      */
 
-    memcpy(hwm->buf + modified_current_size, src, size);
+    memcpy(hwm_buffer_owned_mem(hwm) + modified_current_size, src, size);
     hwm->current_size = modified_current_size + size;
+    hwm_buffer_update_hash(hwm);
+    return true;
+}
+
+
+bool
+hwm_buffer_append_strv(hwm_buffer_t *hwm, const char *const *strs,
+                       size_t count)
+{
+    size_t  modified_current_size;
+    size_t  new_size;
+    char  *dest;
+    size_t  i;
+
+    /*
+     * Overwrite any existing NUL terminator, just like
+     * hwm_buffer_append_str() does, and leave room for a single new
+     * one at the end.
+     */
+
+    modified_current_size =
+        (hwm->current_size == 0)?
+        0:
+        hwm->current_size - 1;
+
+    new_size = modified_current_size + 1;
+
+    for (i = 0; i < count; i++)
+    {
+        size_t  length = strlen(strs[i]);
+
+        if (length > SIZE_MAX - new_size)
+            return false;
+
+        new_size += length;
+    }
+
+    if (!_hwm_buffer_grow_and_copy(hwm, new_size))
+    {
+        return false;
+    }
+
+    dest = hwm_buffer_owned_mem(hwm) + modified_current_size;
+
+    for (i = 0; i < count; i++)
+    {
+        size_t  length = strlen(strs[i]);
+
+        memcpy(dest, strs[i], length);
+        dest += length;
+    }
+
+    *dest = '\0';
+    hwm->current_size = new_size;
+    return true;
+}
+
+
+bool
+hwm_buffer_append_strs(hwm_buffer_t *hwm, ...)
+{
+    va_list  args;
+    size_t  modified_current_size;
+    size_t  new_size;
+    const char  *src;
+    char  *dest;
+
+    modified_current_size =
+        (hwm->current_size == 0)?
+        0:
+        hwm->current_size - 1;
+
+    new_size = modified_current_size + 1;
+
+    /*
+     * We go through the arguments twice: once to add up the lengths,
+     * and once to copy the strings.
+     */
+
+    va_start(args, hwm);
+    while ((src = va_arg(args, const char *)) != NULL)
+    {
+        size_t  length = strlen(src);
+
+        if (length > SIZE_MAX - new_size)
+        {
+            va_end(args);
+            return false;
+        }
+
+        new_size += length;
+    }
+    va_end(args);
+
+    if (!_hwm_buffer_grow_and_copy(hwm, new_size))
+    {
+        return false;
+    }
+
+    dest = hwm_buffer_owned_mem(hwm) + modified_current_size;
+
+    va_start(args, hwm);
+    while ((src = va_arg(args, const char *)) != NULL)
+    {
+        size_t  length = strlen(src);
+
+        memcpy(dest, src, length);
+        dest += length;
+    }
+    va_end(args);
+
+    *dest = '\0';
+    hwm->current_size = new_size;
     return true;
 }
 
@@ -177,7 +403,7 @@ _hwm_buffer_append_list_elem(hwm_buffer_t *hwm, size_t elem_size)
      * at the internal buffer, returning an error code if we can't.
      */
 
-    if (!grow_and_copy(hwm, new_size))
+    if (!_hwm_buffer_grow_and_copy(hwm, new_size))
     {
         return NULL;
     }
@@ -188,6 +414,41 @@ _hwm_buffer_append_list_elem(hwm_buffer_t *hwm, size_t elem_size)
      * before we appended a new element.)
      */
 
+    if (hwm->current_size % elem_size != 0)
+        hwm_buffer_invalidate_hash(hwm);
+
     hwm->current_size = new_size;
-    return (hwm->buf + (current_list_size * elem_size));
+    return (hwm_buffer_owned_mem(hwm) + (current_list_size * elem_size));
+}
+
+
+void *
+_hwm_buffer_reserve_list_elems(hwm_buffer_t *hwm, size_t elem_size,
+                               size_t count)
+{
+    size_t  current_list_size =
+        hwm->current_size / elem_size;
+    size_t  new_size;
+
+    if (count > SIZE_MAX / elem_size - current_list_size)
+        return NULL;
+
+    new_size = (current_list_size + count) * elem_size;
+
+    if (!_hwm_buffer_grow_and_copy(hwm, new_size))
+    {
+        return NULL;
+    }
+
+    /*
+     * Just like when appending a single element, any partial element
+     * at the end of the list is dropped, so that the reserved
+     * elements start on an element boundary.
+     */
+
+    if (hwm->current_size % elem_size != 0)
+        hwm_buffer_invalidate_hash(hwm);
+
+    hwm->current_size = current_list_size * elem_size;
+    return (hwm_buffer_owned_mem(hwm) + hwm->current_size);
 }
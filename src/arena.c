@@ -0,0 +1,294 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2009, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hwm-arena.h>
+#include <hwm-buffer.h>
+
+
+/**
+ * The alignment of every allocation that we hand out.
+ */
+
+#define ARENA_ALIGNMENT  16
+
+
+struct hwm_arena_slab
+{
+    /**
+     * The next slab in the arena.
+     */
+
+    hwm_arena_slab_t  *next;
+
+    /**
+     * The number of usable bytes in this slab.
+     */
+
+    size_t  size;
+
+    /**
+     * The number of bytes that have been handed out from this slab.
+     */
+
+    size_t  used;
+};
+
+
+/**
+ * The size of the slab header, rounded up so that the slab's memory
+ * starts on an aligned boundary.
+ */
+
+#define SLAB_HEADER_SIZE \
+    ((sizeof(hwm_arena_slab_t) + ARENA_ALIGNMENT - 1) & \
+     ~((size_t) ARENA_ALIGNMENT - 1))
+
+#define slab_mem(slab) (((uint8_t *) (slab)) + SLAB_HEADER_SIZE)
+
+
+static size_t
+align_size(size_t size)
+{
+    return (size + ARENA_ALIGNMENT - 1) & ~((size_t) ARENA_ALIGNMENT - 1);
+}
+
+
+void
+hwm_arena_init(hwm_arena_t *arena, size_t slab_size)
+{
+    /*
+     * We don't allocate any slabs until someone asks for memory.
+     */
+
+    arena->slab_size =
+        (slab_size == 0)? HWM_ARENA_DEFAULT_SLAB_SIZE: slab_size;
+    arena->first = NULL;
+    arena->current = NULL;
+    arena->last = NULL;
+}
+
+
+void
+hwm_arena_done(hwm_arena_t *arena)
+{
+    hwm_arena_slab_t  *slab = arena->first;
+
+    while (slab != NULL)
+    {
+        hwm_arena_slab_t  *next = slab->next;
+        free(slab);
+        slab = next;
+    }
+
+    arena->first = NULL;
+    arena->current = NULL;
+    arena->last = NULL;
+}
+
+
+void
+hwm_arena_reset(hwm_arena_t *arena)
+{
+    /*
+     * We only reset the first slab here.  The remaining slabs are
+     * reset as we move into them, so that this function doesn't have
+     * to walk the slab list.
+     */
+
+    arena->current = arena->first;
+    arena->last = NULL;
+
+    if (arena->current != NULL)
+        arena->current->used = 0;
+}
+
+
+/**
+ * Try to carve size bytes out of the current slab.
+ */
+
+static void *
+slab_alloc(hwm_arena_t *arena, size_t size)
+{
+    hwm_arena_slab_t  *slab = arena->current;
+    void  *result;
+
+    if (slab == NULL || slab->size - slab->used < size)
+        return NULL;
+
+    result = slab_mem(slab) + slab->used;
+    slab->used += align_size(size);
+    if (slab->used > slab->size)
+        slab->used = slab->size;
+
+    arena->last = result;
+    return result;
+}
+
+
+void *
+hwm_arena_alloc(hwm_arena_t *arena, size_t size)
+{
+    void  *result;
+    hwm_arena_slab_t  *slab;
+    size_t  slab_size;
+
+    /*
+     * The common case is that there's enough room in the current
+     * slab.
+     */
+
+    result = slab_alloc(arena, size);
+    if (result != NULL)
+        return result;
+
+    /*
+     * If not, move on to any slabs left over from before the last
+     * reset, skipping any that are too small.  Each one is reset as
+     * we enter it.  The last allocation lives in the slab we're
+     * leaving, so it can't be resized in place anymore, even if this
+     * allocation fails.
+     */
+
+    while (arena->current != NULL && arena->current->next != NULL)
+    {
+        arena->current = arena->current->next;
+        arena->current->used = 0;
+        arena->last = NULL;
+
+        result = slab_alloc(arena, size);
+        if (result != NULL)
+            return result;
+    }
+
+    /*
+     * Otherwise we need a new slab.  Allocations that are larger than
+     * our slab size get a slab of their own.
+     */
+
+    slab_size = (size > arena->slab_size)? size: arena->slab_size;
+    if (slab_size > SIZE_MAX - SLAB_HEADER_SIZE)
+        return NULL;
+
+    slab = (hwm_arena_slab_t *) malloc(SLAB_HEADER_SIZE + slab_size);
+    if (slab == NULL)
+        return NULL;
+
+    slab->next = NULL;
+    slab->size = slab_size;
+    slab->used = 0;
+
+    if (arena->current == NULL)
+        arena->first = slab;
+    else
+        arena->current->next = slab;
+
+    arena->current = slab;
+    return slab_alloc(arena, size);
+}
+
+
+/**
+ * Return whether ptr is the most recent allocation in the arena, and
+ * can therefore be resized in place.
+ */
+
+static bool
+is_last(hwm_arena_t *arena, void *ptr)
+{
+    return (ptr != NULL) && (ptr == arena->last);
+}
+
+
+static void *
+arena_allocate(void *ctx, size_t size)
+{
+    return hwm_arena_alloc((hwm_arena_t *) ctx, size);
+}
+
+
+static void *
+arena_reallocate(void *ctx, void *ptr, size_t old_size, size_t new_size)
+{
+    hwm_arena_t  *arena = (hwm_arena_t *) ctx;
+    void  *result;
+
+    /*
+     * If this is the most recent allocation, and the slab has room,
+     * we can grow (or shrink) it in place.
+     */
+
+    if (is_last(arena, ptr))
+    {
+        hwm_arena_slab_t  *slab = arena->current;
+        size_t  offset = ((uint8_t *) ptr) - slab_mem(slab);
+
+        if (new_size <= slab->size - offset)
+        {
+            slab->used = offset + align_size(new_size);
+            if (slab->used > slab->size)
+                slab->used = slab->size;
+            return ptr;
+        }
+    }
+
+    /*
+     * Otherwise we have to copy into a new allocation.  The old one
+     * is wasted until the arena is reset.
+     */
+
+    result = hwm_arena_alloc(arena, new_size);
+    if (result == NULL)
+        return NULL;
+
+    if (ptr != NULL)
+        memcpy(result, ptr, (old_size < new_size)? old_size: new_size);
+
+    return result;
+}
+
+
+static void
+arena_deallocate(void *ctx, void *ptr, size_t size)
+{
+    hwm_arena_t  *arena = (hwm_arena_t *) ctx;
+
+    /*
+     * We can only give back the most recent allocation; anything else
+     * is reclaimed when the arena is reset.
+     */
+
+    if (is_last(arena, ptr))
+    {
+        arena->current->used = ((uint8_t *) ptr) - slab_mem(arena->current);
+        arena->last = NULL;
+    }
+}
+
+
+const hwm_allocator_t  hwm_arena_allocator =
+{
+    arena_allocate,
+    arena_reallocate,
+    arena_deallocate,
+    NULL,
+    NULL
+};
+
+
+void
+hwm_buffer_init_in_arena(hwm_buffer_t *hwm, hwm_arena_t *arena)
+{
+    hwm_buffer_init_with_allocator(hwm, &hwm_arena_allocator, arena);
+}
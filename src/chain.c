@@ -0,0 +1,306 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2009, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include <hwm-buffer.h>
+#include <hwm-chain.h>
+
+#include "hwm-private.h"
+
+
+/**
+ * Return a pointer to one of the chain's segments.  The pointer is only
+ * valid until the list of segments grows.  The list always owns its
+ * data, so we can index straight into its storage.
+ */
+
+#define segment(chain, index) \
+    (((hwm_buffer_t *) hwm_buffer_owned_mem(&(chain)->segments)) + (index))
+
+#define const_segment(chain, index) \
+    hwm_buffer_list_elem(&(chain)->segments, hwm_buffer_t, index)
+
+
+/**
+ * Return the size of the index'th segment.
+ */
+
+static size_t
+segment_size(const hwm_chain_t *chain, size_t index)
+{
+    size_t  size = chain->first_segment_size;
+
+    while (index > 0 && size < chain->max_segment_size)
+    {
+        if (size > SIZE_MAX / 2)
+            return chain->max_segment_size;
+
+        size *= 2;
+        index--;
+    }
+
+    return (size < chain->max_segment_size)? size: chain->max_segment_size;
+}
+
+
+/**
+ * Start using the next segment in the chain, reusing a segment from
+ * before the chain was last cleared if there is one.  Return the new
+ * segment, or NULL if we can't allocate it.
+ */
+
+static hwm_buffer_t *
+next_segment(hwm_chain_t *chain)
+{
+    size_t  index = chain->segment_count;
+    hwm_buffer_t  *seg;
+
+    if (index <
+        hwm_buffer_current_list_size(&chain->segments, hwm_buffer_t))
+    {
+        seg = segment(chain, index);
+    }
+    else
+    {
+        seg = hwm_buffer_append_list_elem(&chain->segments, hwm_buffer_t);
+        if (seg == NULL)
+            return NULL;
+
+        hwm_buffer_init(seg);
+    }
+
+    if (!hwm_buffer_ensure_size(seg, segment_size(chain, index)))
+        return NULL;
+
+    chain->segment_count++;
+    return seg;
+}
+
+
+/**
+ * Undo a partially completed append, so that the chain is left the way
+ * we found it.  old_count and old_last_size are the number of segments
+ * in use, and the size of the last one, before the append.
+ */
+
+static void
+undo_append(hwm_chain_t *chain, size_t old_count, size_t old_last_size)
+{
+    while (chain->segment_count > old_count)
+    {
+        hwm_buffer_t  *seg = segment(chain, chain->segment_count - 1);
+        chain->current_size -= seg->current_size;
+        hwm_buffer_clear(seg);
+        chain->segment_count--;
+    }
+
+    if (old_count > 0)
+    {
+        hwm_buffer_t  *seg = segment(chain, old_count - 1);
+        chain->current_size -= seg->current_size - old_last_size;
+        seg->current_size = old_last_size;
+    }
+}
+
+
+void
+hwm_chain_init(hwm_chain_t *chain, size_t first_size, size_t max_size)
+{
+    if (first_size == 0)
+        first_size = HWM_CHAIN_DEFAULT_FIRST_SEGMENT_SIZE;
+
+    if (max_size == 0)
+        max_size = HWM_CHAIN_DEFAULT_MAX_SEGMENT_SIZE;
+
+    if (max_size < first_size)
+        max_size = first_size;
+
+    /*
+     * The list of segments is appended to one element at a time, so
+     * grow it geometrically.
+     */
+
+    hwm_buffer_init_with_growth(&chain->segments, &hwm_growth_double);
+    chain->segment_count = 0;
+    chain->current_size = 0;
+    chain->first_segment_size = first_size;
+    chain->max_segment_size = max_size;
+}
+
+
+void
+hwm_chain_done(hwm_chain_t *chain)
+{
+    size_t  count =
+        hwm_buffer_current_list_size(&chain->segments, hwm_buffer_t);
+    size_t  i;
+
+    for (i = 0; i < count; i++)
+        hwm_buffer_done(segment(chain, i));
+
+    hwm_buffer_done(&chain->segments);
+    chain->segment_count = 0;
+    chain->current_size = 0;
+}
+
+
+void
+hwm_chain_clear(hwm_chain_t *chain)
+{
+    size_t  i;
+
+    for (i = 0; i < chain->segment_count; i++)
+        hwm_buffer_clear(segment(chain, i));
+
+    chain->segment_count = 0;
+    chain->current_size = 0;
+}
+
+
+bool
+hwm_chain_append_mem(hwm_chain_t *chain, const void *src, size_t size)
+{
+    size_t  old_count = chain->segment_count;
+    size_t  old_last_size = 0;
+
+    if (old_count > 0)
+        old_last_size = segment(chain, old_count - 1)->current_size;
+
+    while (size > 0)
+    {
+        hwm_buffer_t  *seg = NULL;
+        size_t  room = 0;
+        size_t  copy_size;
+
+        if (chain->segment_count > 0)
+        {
+            seg = segment(chain, chain->segment_count - 1);
+            room = seg->allocated_size - seg->current_size;
+        }
+
+        if (room == 0)
+        {
+            seg = next_segment(chain);
+            if (seg == NULL)
+            {
+                undo_append(chain, old_count, old_last_size);
+                return false;
+            }
+
+            room = seg->allocated_size;
+        }
+
+        /*
+         * This never needs to grow the segment, so it can't fail.
+         */
+
+        copy_size = (size < room)? size: room;
+        hwm_buffer_append_mem(seg, src, copy_size);
+        chain->current_size += copy_size;
+        src += copy_size;
+        size -= copy_size;
+    }
+
+    return true;
+}
+
+
+bool
+hwm_chain_append_str(hwm_chain_t *chain, const char *src)
+{
+    return hwm_chain_append_mem(chain, src, strlen(src));
+}
+
+
+size_t
+hwm_chain_fill_iov(const hwm_chain_t *chain, size_t offset,
+                   struct iovec *iov, size_t max_iov)
+{
+    size_t  i;
+    size_t  iov_count = 0;
+
+    for (i = 0; i < chain->segment_count && iov_count < max_iov; i++)
+    {
+        const hwm_buffer_t  *seg = const_segment(chain, i);
+
+        if (offset >= seg->current_size)
+        {
+            offset -= seg->current_size;
+            continue;
+        }
+
+        iov[iov_count].iov_base = (void *) (seg->data + offset);
+        iov[iov_count].iov_len = seg->current_size - offset;
+        iov_count++;
+        offset = 0;
+    }
+
+    return iov_count;
+}
+
+
+bool
+hwm_chain_flatten(const hwm_chain_t *chain, hwm_buffer_t *hwm)
+{
+    size_t  i;
+
+    hwm_buffer_clear(hwm);
+
+    if (!hwm_buffer_ensure_size(hwm, chain->current_size))
+        return false;
+
+    for (i = 0; i < chain->segment_count; i++)
+    {
+        const hwm_buffer_t  *seg = const_segment(chain, i);
+
+        /*
+         * We've already made enough room, so this can't fail.
+         */
+
+        hwm_buffer_append_mem(hwm, seg->data, seg->current_size);
+    }
+
+    return true;
+}
+
+
+void
+hwm_chain_iter_init(hwm_chain_iter_t *iter, const hwm_chain_t *chain)
+{
+    iter->chain = chain;
+    iter->index = 0;
+}
+
+
+bool
+hwm_chain_iter_next(hwm_chain_iter_t *iter,
+                    const void **data, size_t *size)
+{
+    while (iter->index < iter->chain->segment_count)
+    {
+        const hwm_buffer_t  *seg =
+            const_segment(iter->chain, iter->index);
+
+        iter->index++;
+
+        if (seg->current_size > 0)
+        {
+            *data = seg->data;
+            *size = seg->current_size;
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,236 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2009, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <hwm-buffer.h>
+
+#include "hwm-private.h"
+
+#if defined(HWM_X86_SIMD)
+#include <immintrin.h>
+#endif
+
+
+/*
+ * Equality and prefix checks only need a yes or no, so they use
+ * memcmp(), which the C library already vectorizes.  Ordering and
+ * common prefixes need to know where the first difference is, so
+ * they use the mismatch kernels below.
+ */
+
+
+/*-----------------------------------------------------------------------
+ * Mismatch kernels
+ *
+ * Each returns the offset of the first byte where a and b differ, or
+ * size if they don't differ at all.
+ */
+
+static size_t
+mismatch_scalar(const uint8_t *a, const uint8_t *b, size_t size)
+{
+    size_t  i = 0;
+
+    /*
+     * Compare a word at a time, and then find the byte within the
+     * word that differs.
+     */
+
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t  a_word;
+        uint64_t  b_word;
+
+        memcpy(&a_word, a + i, sizeof(a_word));
+        memcpy(&b_word, b + i, sizeof(b_word));
+
+        if (a_word != b_word)
+            break;
+    }
+
+    while (i < size && a[i] == b[i])
+        i++;
+
+    return i;
+}
+
+
+#if defined(HWM_X86_SIMD)
+
+HWM_TARGET_SSE4
+static size_t
+mismatch_sse2(const uint8_t *a, const uint8_t *b, size_t size)
+{
+    size_t  i;
+
+    for (i = 0; i + 16 <= size; i += 16)
+    {
+        __m128i  a_chunk = _mm_loadu_si128((const __m128i *) (a + i));
+        __m128i  b_chunk = _mm_loadu_si128((const __m128i *) (b + i));
+        int  mask = _mm_movemask_epi8(_mm_cmpeq_epi8(a_chunk, b_chunk));
+
+        if (mask != 0xffff)
+            return i + __builtin_ctz(~mask);
+    }
+
+    return i + mismatch_scalar(a + i, b + i, size - i);
+}
+
+
+HWM_TARGET_AVX2
+static size_t
+mismatch_avx2(const uint8_t *a, const uint8_t *b, size_t size)
+{
+    size_t  i;
+
+    for (i = 0; i + 32 <= size; i += 32)
+    {
+        __m256i  a_chunk = _mm256_loadu_si256((const __m256i *) (a + i));
+        __m256i  b_chunk = _mm256_loadu_si256((const __m256i *) (b + i));
+        uint32_t  mask = (uint32_t) _mm256_movemask_epi8
+            (_mm256_cmpeq_epi8(a_chunk, b_chunk));
+
+        if (mask != UINT32_C(0xffffffff))
+            return i + __builtin_ctz(~mask);
+    }
+
+    return i + mismatch_scalar(a + i, b + i, size - i);
+}
+
+#endif
+
+
+static size_t
+mismatch(const uint8_t *a, const uint8_t *b, size_t size)
+{
+#if defined(HWM_X86_SIMD)
+    int  level = hwm_simd_level();
+
+    if (level >= HWM_SIMD_AVX2)
+        return mismatch_avx2(a, b, size);
+    if (level >= HWM_SIMD_SSE4)
+        return mismatch_sse2(a, b, size);
+#endif
+
+    return mismatch_scalar(a, b, size);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Public interface
+ */
+
+bool
+hwm_buffer_equal(const hwm_buffer_t *a, const hwm_buffer_t *b)
+{
+    uint64_t  a_hash;
+    uint64_t  b_hash;
+
+    if (a->current_size != b->current_size)
+        return false;
+
+    if (a->current_size == 0 || a->data == b->data)
+        return true;
+
+    /*
+     * If both buffers already know their hashes, different hashes
+     * mean different contents, without looking at any of the bytes.
+     */
+
+    if (_hwm_buffer_cached_hash(a, &a_hash) &&
+        _hwm_buffer_cached_hash(b, &b_hash) &&
+        a_hash != b_hash)
+    {
+        return false;
+    }
+
+    return memcmp(a->data, b->data, a->current_size) == 0;
+}
+
+
+bool
+hwm_buffer_equal_mem(const hwm_buffer_t *hwm, const void *src, size_t size)
+{
+    if (hwm->current_size != size)
+        return false;
+
+    return (size == 0) || (memcmp(hwm->data, src, size) == 0);
+}
+
+
+int
+hwm_buffer_cmp(const hwm_buffer_t *a, const hwm_buffer_t *b)
+{
+    size_t  size = (a->current_size < b->current_size)?
+        a->current_size:
+        b->current_size;
+
+    if (size > 0 && a->data != b->data)
+    {
+        const uint8_t  *a_data = hwm_buffer_mem(a, uint8_t);
+        const uint8_t  *b_data = hwm_buffer_mem(b, uint8_t);
+        size_t  diff = mismatch(a_data, b_data, size);
+
+        if (diff < size)
+            return (a_data[diff] < b_data[diff])? -1: 1;
+    }
+
+    /*
+     * If one buffer is a prefix of the other, the shorter one comes
+     * first.
+     */
+
+    if (a->current_size == b->current_size)
+        return 0;
+
+    return (a->current_size < b->current_size)? -1: 1;
+}
+
+
+bool
+hwm_buffer_has_prefix(const hwm_buffer_t *hwm,
+                      const void *prefix, size_t size)
+{
+    if (size > hwm->current_size)
+        return false;
+
+    return (size == 0) || (memcmp(hwm->data, prefix, size) == 0);
+}
+
+
+bool
+hwm_buffer_has_suffix(const hwm_buffer_t *hwm,
+                      const void *suffix, size_t size)
+{
+    if (size > hwm->current_size)
+        return false;
+
+    return (size == 0) ||
+        (memcmp(hwm_buffer_mem(hwm, uint8_t) + (hwm->current_size - size),
+                suffix, size) == 0);
+}
+
+
+size_t
+hwm_buffer_common_prefix_size(const hwm_buffer_t *a, const hwm_buffer_t *b)
+{
+    size_t  size = (a->current_size < b->current_size)?
+        a->current_size:
+        b->current_size;
+
+    if (size == 0 || a->data == b->data)
+        return size;
+
+    return mismatch(hwm_buffer_mem(a, uint8_t),
+                    hwm_buffer_mem(b, uint8_t), size);
+}
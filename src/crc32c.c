@@ -0,0 +1,351 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2009, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <hwm-buffer.h>
+
+#include "hwm-private.h"
+
+#if defined(HWM_X86_SIMD)
+#include <immintrin.h>
+#endif
+
+
+/*
+ * CRC-32C (Castagnoli), in its reflected form.  Without SSE4.2, we
+ * use slicing-by-8 tables.  With it, the crc32 instruction does eight
+ * bytes at a time, but each one has to wait for the last, so long
+ * inputs are split into three streams that run in parallel and are
+ * stitched back together afterwards.
+ */
+
+#define POLY  UINT32_C(0x82f63b78)
+
+/**
+ * The sizes of the blocks that are checksummed three at a time.  Long
+ * blocks amortize the cost of combining the three CRCs; short ones
+ * pick up what's left.
+ */
+
+#define LONG_BLOCK   8192
+#define SHORT_BLOCK  256
+
+
+/**
+ * The slicing-by-8 tables.  SLICE[0] is the classic byte-at-a-time
+ * table; SLICE[k] advances a byte through k more zero bytes.
+ */
+
+static uint32_t  SLICE[8][256];
+
+#if defined(HWM_X86_SIMD)
+
+/**
+ * Tables that advance a CRC through LONG_BLOCK and SHORT_BLOCK zero
+ * bytes, a byte of the CRC at a time.
+ */
+
+static uint32_t  LONG_ZEROS[4][256];
+static uint32_t  SHORT_ZEROS[4][256];
+
+#endif
+
+static pthread_once_t  tables_once = PTHREAD_ONCE_INIT;
+
+
+/*-----------------------------------------------------------------------
+ * Table construction
+ *
+ * Appending zero bytes to the input is a linear operation on the CRC,
+ * so it can be written as a 32x32 matrix over GF(2).  Squaring the
+ * matrix doubles the number of zeros.
+ */
+
+#if defined(HWM_X86_SIMD)
+
+static uint32_t
+gf2_matrix_times(const uint32_t *matrix, uint32_t vector)
+{
+    uint32_t  sum = 0;
+
+    for (; vector != 0; vector >>= 1, matrix++)
+    {
+        if ((vector & 1) != 0)
+            sum ^= *matrix;
+    }
+
+    return sum;
+}
+
+
+static void
+gf2_matrix_square(uint32_t *square, const uint32_t *matrix)
+{
+    unsigned int  n;
+
+    for (n = 0; n < 32; n++)
+        square[n] = gf2_matrix_times(matrix, matrix[n]);
+}
+
+
+/**
+ * Build the tables that advance a CRC through size zero bytes.  size
+ * must be a power of two.
+ */
+
+static void
+build_zeros(uint32_t zeros[4][256], size_t size)
+{
+    uint32_t  op[32];
+    uint32_t  square[32];
+    unsigned int  n;
+
+    /*
+     * Start with the operator for a single zero bit, and square it
+     * until it covers size bytes.
+     */
+
+    op[0] = POLY;
+    for (n = 1; n < 32; n++)
+        op[n] = UINT32_C(1) << (n - 1);
+
+    for (size *= 8; size > 1; size >>= 1)
+    {
+        gf2_matrix_square(square, op);
+        memcpy(op, square, sizeof(op));
+    }
+
+    for (n = 0; n < 256; n++)
+    {
+        zeros[0][n] = gf2_matrix_times(op, n);
+        zeros[1][n] = gf2_matrix_times(op, n << 8);
+        zeros[2][n] = gf2_matrix_times(op, n << 16);
+        zeros[3][n] = gf2_matrix_times(op, (uint32_t) n << 24);
+    }
+}
+
+
+static uint32_t
+shift_crc(const uint32_t zeros[4][256], uint32_t crc)
+{
+    return
+        zeros[0][crc & 0xff] ^
+        zeros[1][(crc >> 8) & 0xff] ^
+        zeros[2][(crc >> 16) & 0xff] ^
+        zeros[3][crc >> 24];
+}
+
+#endif
+
+
+static void
+build_tables(void)
+{
+    unsigned int  n;
+    unsigned int  k;
+
+    for (n = 0; n < 256; n++)
+    {
+        uint32_t  crc = n;
+
+        for (k = 0; k < 8; k++)
+            crc = (crc >> 1) ^ ((crc & 1)? POLY: 0);
+
+        SLICE[0][n] = crc;
+    }
+
+    for (n = 0; n < 256; n++)
+    {
+        for (k = 1; k < 8; k++)
+        {
+            uint32_t  crc = SLICE[k - 1][n];
+            SLICE[k][n] = (crc >> 8) ^ SLICE[0][crc & 0xff];
+        }
+    }
+
+#if defined(HWM_X86_SIMD)
+    build_zeros(LONG_ZEROS, LONG_BLOCK);
+    build_zeros(SHORT_ZEROS, SHORT_BLOCK);
+#endif
+}
+
+
+/*-----------------------------------------------------------------------
+ * Slicing-by-8
+ *
+ * The kernels work on the raw CRC register; the public functions do
+ * the pre- and post-inversion.
+ */
+
+static uint32_t
+crc32c_scalar(uint32_t crc, const uint8_t *data, size_t size)
+{
+    while (size > 0 && ((uintptr_t) data & 7) != 0)
+    {
+        crc = (crc >> 8) ^ SLICE[0][(crc ^ *data++) & 0xff];
+        size--;
+    }
+
+    for (; size >= 8; size -= 8, data += 8)
+    {
+        uint32_t  low = crc ^
+            ((uint32_t) data[0] |
+             ((uint32_t) data[1] << 8) |
+             ((uint32_t) data[2] << 16) |
+             ((uint32_t) data[3] << 24));
+
+        crc =
+            SLICE[7][low & 0xff] ^
+            SLICE[6][(low >> 8) & 0xff] ^
+            SLICE[5][(low >> 16) & 0xff] ^
+            SLICE[4][low >> 24] ^
+            SLICE[3][data[4]] ^
+            SLICE[2][data[5]] ^
+            SLICE[1][data[6]] ^
+            SLICE[0][data[7]];
+    }
+
+    for (; size > 0; size--)
+        crc = (crc >> 8) ^ SLICE[0][(crc ^ *data++) & 0xff];
+
+    return crc;
+}
+
+
+/*-----------------------------------------------------------------------
+ * SSE4.2 kernel
+ */
+
+#if defined(HWM_X86_SIMD)
+
+HWM_TARGET_SSE4
+static inline uint32_t
+crc32c_word(uint32_t crc, const uint8_t *data)
+{
+#if defined(__x86_64__)
+    uint64_t  word;
+    memcpy(&word, data, sizeof(word));
+    return (uint32_t) _mm_crc32_u64(crc, word);
+#else
+    uint32_t  words[2];
+    memcpy(words, data, sizeof(words));
+    return _mm_crc32_u32(_mm_crc32_u32(crc, words[0]), words[1]);
+#endif
+}
+
+
+/**
+ * Checksum as many runs of three blocks of block_size bytes as fit,
+ * running the three blocks in each run in parallel.  Return the
+ * number of bytes processed.
+ */
+
+HWM_TARGET_SSE4
+static size_t
+crc32c_interleaved(uint32_t *crc, const uint8_t *data, size_t size,
+                   size_t block_size, const uint32_t zeros[4][256])
+{
+    uint32_t  crc0 = *crc;
+    size_t  done;
+
+    for (done = 0; size - done >= 3 * block_size; done += 3 * block_size)
+    {
+        const uint8_t  *block = data + done;
+        uint32_t  crc1 = 0;
+        uint32_t  crc2 = 0;
+        size_t  i;
+
+        for (i = 0; i < block_size; i += 8)
+        {
+            crc0 = crc32c_word(crc0, block + i);
+            crc1 = crc32c_word(crc1, block + block_size + i);
+            crc2 = crc32c_word(crc2, block + 2 * block_size + i);
+        }
+
+        crc0 = shift_crc(zeros, crc0) ^ crc1;
+        crc0 = shift_crc(zeros, crc0) ^ crc2;
+    }
+
+    *crc = crc0;
+    return done;
+}
+
+
+HWM_TARGET_SSE4
+static uint32_t
+crc32c_sse4(uint32_t crc, const uint8_t *data, size_t size)
+{
+    size_t  done;
+
+    while (size > 0 && ((uintptr_t) data & 7) != 0)
+    {
+        crc = _mm_crc32_u8(crc, *data++);
+        size--;
+    }
+
+    done = crc32c_interleaved(&crc, data, size, LONG_BLOCK, LONG_ZEROS);
+    data += done;
+    size -= done;
+
+    done = crc32c_interleaved(&crc, data, size, SHORT_BLOCK, SHORT_ZEROS);
+    data += done;
+    size -= done;
+
+    for (; size >= 8; size -= 8, data += 8)
+        crc = crc32c_word(crc, data);
+
+    for (; size > 0; size--)
+        crc = _mm_crc32_u8(crc, *data++);
+
+    return crc;
+}
+
+#endif
+
+
+/*-----------------------------------------------------------------------
+ * Public interface
+ */
+
+uint32_t
+hwm_buffer_crc32c_mem(uint32_t crc, const void *src, size_t size)
+{
+    pthread_once(&tables_once, build_tables);
+    crc = ~crc;
+
+#if defined(HWM_X86_SIMD)
+    if (hwm_simd_level() >= HWM_SIMD_SSE4)
+        return ~crc32c_sse4(crc, src, size);
+#endif
+
+    return ~crc32c_scalar(crc, src, size);
+}
+
+
+uint32_t
+hwm_buffer_crc32c(const hwm_buffer_t *hwm)
+{
+    return hwm_buffer_crc32c_extend(hwm, 0, 0);
+}
+
+
+uint32_t
+hwm_buffer_crc32c_extend(const hwm_buffer_t *hwm, uint32_t crc,
+                         size_t start)
+{
+    if (start >= hwm->current_size)
+        return crc;
+
+    return hwm_buffer_crc32c_mem(crc, hwm_buffer_mem(hwm, uint8_t) + start,
+                                 hwm->current_size - start);
+}
@@ -0,0 +1,937 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2009, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <hwm-buffer.h>
+
+#include "hwm-private.h"
+
+#if defined(HWM_X86_SIMD)
+#include <immintrin.h>
+#endif
+
+
+/*
+ * Each codec has a scalar implementation, which can handle any amount
+ * of input, and SSE4 and AVX2 kernels, which handle as many whole
+ * blocks of input as they can and report how much that was.  The
+ * scalar code then finishes off whatever's left.
+ */
+
+
+/**
+ * Extra space that we reserve past the end of decoded base64 output,
+ * since the vector kernels store whole registers, even though the
+ * last few bytes of each register are garbage.
+ */
+
+#define BASE64_DECODE_SLACK  32
+
+
+static const char  HEX_DIGITS[16] = "0123456789abcdef";
+
+static const char  BASE64_DIGITS[64] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/**
+ * The value of each hex digit, in either case, or 0xff for characters
+ * that aren't hex digits.
+ */
+
+static const uint8_t  HEX_VALUES[256] =
+{
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x08, 0x09, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+};
+
+/**
+ * The value of each base64 digit, or 0xff for characters that aren't
+ * in the alphabet.
+ */
+
+static const uint8_t  BASE64_VALUES[256] =
+{
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b,
+    0x3c, 0x3d, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+    0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+    0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16,
+    0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20,
+    0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30,
+    0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+};
+
+
+/*-----------------------------------------------------------------------
+ * Hex encoding
+ */
+
+static void
+hex_encode_scalar(char *dest, const uint8_t *src, size_t size)
+{
+    size_t  i;
+
+    for (i = 0; i < size; i++)
+    {
+        dest[2 * i] = HEX_DIGITS[src[i] >> 4];
+        dest[2 * i + 1] = HEX_DIGITS[src[i] & 0x0f];
+    }
+}
+
+
+#if defined(HWM_X86_SIMD)
+
+HWM_TARGET_SSE4
+static size_t
+hex_encode_sse4(char *dest, const uint8_t *src, size_t size)
+{
+    const __m128i  digits = _mm_loadu_si128((const __m128i *) HEX_DIGITS);
+    const __m128i  mask = _mm_set1_epi8(0x0f);
+    size_t  i;
+
+    for (i = 0; i + 16 <= size; i += 16)
+    {
+        __m128i  bytes = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128i  high = _mm_shuffle_epi8
+            (digits, _mm_and_si128(_mm_srli_epi16(bytes, 4), mask));
+        __m128i  low = _mm_shuffle_epi8(digits, _mm_and_si128(bytes, mask));
+
+        _mm_storeu_si128((__m128i *) (dest + 2 * i),
+                         _mm_unpacklo_epi8(high, low));
+        _mm_storeu_si128((__m128i *) (dest + 2 * i + 16),
+                         _mm_unpackhi_epi8(high, low));
+    }
+
+    return i;
+}
+
+
+HWM_TARGET_AVX2
+static size_t
+hex_encode_avx2(char *dest, const uint8_t *src, size_t size)
+{
+    const __m256i  digits = _mm256_broadcastsi128_si256
+        (_mm_loadu_si128((const __m128i *) HEX_DIGITS));
+    const __m256i  mask = _mm256_set1_epi8(0x0f);
+    size_t  i;
+
+    for (i = 0; i + 32 <= size; i += 32)
+    {
+        __m256i  bytes = _mm256_loadu_si256((const __m256i *) (src + i));
+        __m256i  high = _mm256_shuffle_epi8
+            (digits, _mm256_and_si256(_mm256_srli_epi16(bytes, 4), mask));
+        __m256i  low = _mm256_shuffle_epi8
+            (digits, _mm256_and_si256(bytes, mask));
+
+        /*
+         * The unpacks work within each 128-bit lane, so the halves of
+         * their results need to be put back in order.
+         */
+
+        __m256i  first = _mm256_unpacklo_epi8(high, low);
+        __m256i  second = _mm256_unpackhi_epi8(high, low);
+
+        _mm256_storeu_si256((__m256i *) (dest + 2 * i),
+                            _mm256_permute2x128_si256(first, second, 0x20));
+        _mm256_storeu_si256((__m256i *) (dest + 2 * i + 32),
+                            _mm256_permute2x128_si256(first, second, 0x31));
+    }
+
+    return i;
+}
+
+#endif
+
+
+static void
+hex_encode(char *dest, const uint8_t *src, size_t size)
+{
+    size_t  done = 0;
+
+#if defined(HWM_X86_SIMD)
+    int  level = hwm_simd_level();
+
+    if (level >= HWM_SIMD_AVX2)
+        done = hex_encode_avx2(dest, src, size);
+    else if (level >= HWM_SIMD_SSE4)
+        done = hex_encode_sse4(dest, src, size);
+#endif
+
+    hex_encode_scalar(dest + 2 * done, src + done, size - done);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Hex decoding
+ */
+
+/**
+ * Decode count bytes from 2 * count hex digits.  Return false if any
+ * of them aren't hex digits.
+ */
+
+static bool
+hex_decode_scalar(uint8_t *dest, const uint8_t *src, size_t count)
+{
+    size_t  i;
+
+    for (i = 0; i < count; i++)
+    {
+        unsigned int  high = HEX_VALUES[src[2 * i]];
+        unsigned int  low = HEX_VALUES[src[2 * i + 1]];
+
+        if (((high | low) & 0x80) != 0)
+            return false;
+
+        dest[i] = (uint8_t) ((high << 4) | low);
+    }
+
+    return true;
+}
+
+
+#if defined(HWM_X86_SIMD)
+
+/**
+ * Convert sixteen hex digits into their values, and-ing a mask of
+ * which of them were valid into *valid.
+ */
+
+HWM_TARGET_SSE4
+static __m128i
+hex_values_sse4(__m128i chars, __m128i *valid)
+{
+    /*
+     * Digits and letters are each checked by subtracting the first
+     * character of their range, and then seeing whether the result is
+     * small enough (as an unsigned number).
+     */
+
+    __m128i  digits = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+    __m128i  letters = _mm_sub_epi8
+        (_mm_or_si128(chars, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    __m128i  is_digit = _mm_cmpeq_epi8
+        (_mm_min_epu8(digits, _mm_set1_epi8(9)), digits);
+    __m128i  is_letter = _mm_cmpeq_epi8
+        (_mm_min_epu8(letters, _mm_set1_epi8(5)), letters);
+
+    *valid = _mm_and_si128(*valid, _mm_or_si128(is_digit, is_letter));
+    return _mm_blendv_epi8
+        (_mm_add_epi8(letters, _mm_set1_epi8(10)), digits, is_digit);
+}
+
+
+/**
+ * Decode count bytes of hex, sixteen at a time.  Return false if any
+ * of the input isn't hex digits; otherwise fill in how many bytes we
+ * decoded.
+ */
+
+HWM_TARGET_SSE4
+static bool
+hex_decode_sse4(uint8_t *dest, const uint8_t *src, size_t count,
+                size_t *done)
+{
+    /*
+     * Each pair of values is combined into a byte by multiplying the
+     * first by 16 and adding the second.
+     */
+
+    const __m128i  weights = _mm_set1_epi16(0x0110);
+    __m128i  valid = _mm_set1_epi8(-1);
+    size_t  i;
+
+    for (i = 0; i + 16 <= count; i += 16)
+    {
+        __m128i  first = hex_values_sse4
+            (_mm_loadu_si128((const __m128i *) (src + 2 * i)), &valid);
+        __m128i  second = hex_values_sse4
+            (_mm_loadu_si128((const __m128i *) (src + 2 * i + 16)),
+             &valid);
+
+        _mm_storeu_si128((__m128i *) (dest + i),
+                         _mm_packus_epi16
+                         (_mm_maddubs_epi16(first, weights),
+                          _mm_maddubs_epi16(second, weights)));
+    }
+
+    *done = i;
+    return _mm_movemask_epi8(valid) == 0xffff;
+}
+
+
+HWM_TARGET_AVX2
+static __m256i
+hex_values_avx2(__m256i chars, __m256i *valid)
+{
+    __m256i  digits = _mm256_sub_epi8(chars, _mm256_set1_epi8('0'));
+    __m256i  letters = _mm256_sub_epi8
+        (_mm256_or_si256(chars, _mm256_set1_epi8(0x20)),
+         _mm256_set1_epi8('a'));
+    __m256i  is_digit = _mm256_cmpeq_epi8
+        (_mm256_min_epu8(digits, _mm256_set1_epi8(9)), digits);
+    __m256i  is_letter = _mm256_cmpeq_epi8
+        (_mm256_min_epu8(letters, _mm256_set1_epi8(5)), letters);
+
+    *valid = _mm256_and_si256(*valid, _mm256_or_si256(is_digit, is_letter));
+    return _mm256_blendv_epi8
+        (_mm256_add_epi8(letters, _mm256_set1_epi8(10)), digits, is_digit);
+}
+
+
+HWM_TARGET_AVX2
+static bool
+hex_decode_avx2(uint8_t *dest, const uint8_t *src, size_t count,
+                size_t *done)
+{
+    const __m256i  weights = _mm256_set1_epi16(0x0110);
+    __m256i  valid = _mm256_set1_epi8(-1);
+    size_t  i;
+
+    for (i = 0; i + 32 <= count; i += 32)
+    {
+        __m256i  first = hex_values_avx2
+            (_mm256_loadu_si256((const __m256i *) (src + 2 * i)), &valid);
+        __m256i  second = hex_values_avx2
+            (_mm256_loadu_si256((const __m256i *) (src + 2 * i + 32)),
+             &valid);
+
+        /*
+         * The pack works within each 128-bit lane, so its quarters
+         * need to be put back in order.
+         */
+
+        __m256i  packed = _mm256_packus_epi16
+            (_mm256_maddubs_epi16(first, weights),
+             _mm256_maddubs_epi16(second, weights));
+
+        _mm256_storeu_si256((__m256i *) (dest + i),
+                            _mm256_permute4x64_epi64(packed, 0xd8));
+    }
+
+    *done = i;
+    return _mm256_movemask_epi8(valid) == -1;
+}
+
+#endif
+
+
+static bool
+hex_decode(uint8_t *dest, const uint8_t *src, size_t count)
+{
+    size_t  done = 0;
+
+#if defined(HWM_X86_SIMD)
+    int  level = hwm_simd_level();
+
+    if (level >= HWM_SIMD_AVX2)
+    {
+        if (!hex_decode_avx2(dest, src, count, &done))
+            return false;
+    }
+    else if (level >= HWM_SIMD_SSE4)
+    {
+        if (!hex_decode_sse4(dest, src, count, &done))
+            return false;
+    }
+#endif
+
+    return hex_decode_scalar(dest + done, src + 2 * done, count - done);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Base64 encoding
+ *
+ * The vector kernels use Wojciech Muła's approach: each group of three
+ * bytes is shuffled into a 32-bit word, the four 6-bit indexes are
+ * moved into separate bytes with multiplies, and the indexes are
+ * turned into digits by adding an offset that's looked up from the
+ * index's range.
+ */
+
+static void
+base64_encode_scalar(char *dest, const uint8_t *src, size_t size)
+{
+    size_t  i;
+
+    for (i = 0; i + 3 <= size; i += 3)
+    {
+        uint32_t  group = ((uint32_t) src[i] << 16) |
+            ((uint32_t) src[i + 1] << 8) | src[i + 2];
+
+        *dest++ = BASE64_DIGITS[group >> 18];
+        *dest++ = BASE64_DIGITS[(group >> 12) & 0x3f];
+        *dest++ = BASE64_DIGITS[(group >> 6) & 0x3f];
+        *dest++ = BASE64_DIGITS[group & 0x3f];
+    }
+
+    if (i + 1 == size)
+    {
+        *dest++ = BASE64_DIGITS[src[i] >> 2];
+        *dest++ = BASE64_DIGITS[(src[i] & 0x03) << 4];
+        *dest++ = '=';
+        *dest++ = '=';
+    }
+    else if (i + 2 == size)
+    {
+        *dest++ = BASE64_DIGITS[src[i] >> 2];
+        *dest++ = BASE64_DIGITS[((src[i] & 0x03) << 4) | (src[i + 1] >> 4)];
+        *dest++ = BASE64_DIGITS[(src[i + 1] & 0x0f) << 2];
+        *dest++ = '=';
+    }
+}
+
+
+#if defined(HWM_X86_SIMD)
+
+/**
+ * Split twelve bytes, in the low three quarters of a register, into
+ * sixteen 6-bit indexes.
+ */
+
+HWM_TARGET_SSE4
+static __m128i
+base64_indexes_sse4(__m128i bytes)
+{
+    __m128i  in = _mm_shuffle_epi8
+        (bytes, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4,
+                              7, 6, 8, 7, 10, 9, 11, 10));
+    __m128i  high = _mm_mulhi_epu16
+        (_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)),
+         _mm_set1_epi32(0x04000040));
+    __m128i  low = _mm_mullo_epi16
+        (_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)),
+         _mm_set1_epi32(0x01000010));
+
+    return _mm_or_si128(high, low);
+}
+
+
+/**
+ * Turn sixteen 6-bit indexes into base64 digits.
+ */
+
+HWM_TARGET_SSE4
+static __m128i
+base64_digits_sse4(__m128i indexes)
+{
+    /*
+     * Map each index to a slot in the offset table: 0 for lowercase
+     * letters, 1–10 for digits, 11 for “+”, 12 for “/”, and 13 for
+     * uppercase letters.
+     */
+
+    const __m128i  offsets =
+        _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                      '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    __m128i  slots = _mm_subs_epu8(indexes, _mm_set1_epi8(51));
+    __m128i  upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), indexes);
+
+    slots = _mm_or_si128(slots, _mm_and_si128(upper, _mm_set1_epi8(13)));
+    return _mm_add_epi8(indexes, _mm_shuffle_epi8(offsets, slots));
+}
+
+
+HWM_TARGET_SSE4
+static size_t
+base64_encode_sse4(char *dest, const uint8_t *src, size_t size)
+{
+    size_t  i;
+
+    /*
+     * Each step reads sixteen bytes, but only encodes twelve of them.
+     */
+
+    for (i = 0; i + 16 <= size; i += 12)
+    {
+        __m128i  bytes = _mm_loadu_si128((const __m128i *) (src + i));
+        _mm_storeu_si128((__m128i *) dest,
+                         base64_digits_sse4(base64_indexes_sse4(bytes)));
+        dest += 16;
+    }
+
+    return i;
+}
+
+
+HWM_TARGET_AVX2
+static size_t
+base64_encode_avx2(char *dest, const uint8_t *src, size_t size)
+{
+    const __m256i  shuffle =
+        _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+                         1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+    const __m256i  offsets =
+        _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                         '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                         '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+                         'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                         '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                         '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    size_t  i;
+
+    /*
+     * Each step encodes 24 bytes, twelve in each 128-bit lane, which
+     * means reading 28.
+     */
+
+    for (i = 0; i + 28 <= size; i += 24)
+    {
+        __m256i  bytes = _mm256_inserti128_si256
+            (_mm256_castsi128_si256
+             (_mm_loadu_si128((const __m128i *) (src + i))),
+             _mm_loadu_si128((const __m128i *) (src + i + 12)), 1);
+        __m256i  in = _mm256_shuffle_epi8(bytes, shuffle);
+        __m256i  high = _mm256_mulhi_epu16
+            (_mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00)),
+             _mm256_set1_epi32(0x04000040));
+        __m256i  low = _mm256_mullo_epi16
+            (_mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0)),
+             _mm256_set1_epi32(0x01000010));
+        __m256i  indexes = _mm256_or_si256(high, low);
+        __m256i  slots = _mm256_subs_epu8(indexes, _mm256_set1_epi8(51));
+        __m256i  upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indexes);
+
+        slots = _mm256_or_si256
+            (slots, _mm256_and_si256(upper, _mm256_set1_epi8(13)));
+        _mm256_storeu_si256((__m256i *) dest,
+                            _mm256_add_epi8
+                            (indexes, _mm256_shuffle_epi8(offsets, slots)));
+        dest += 32;
+    }
+
+    return i;
+}
+
+#endif
+
+
+static void
+base64_encode(char *dest, const uint8_t *src, size_t size)
+{
+    size_t  done = 0;
+
+#if defined(HWM_X86_SIMD)
+    int  level = hwm_simd_level();
+
+    if (level >= HWM_SIMD_AVX2)
+        done = base64_encode_avx2(dest, src, size);
+    else if (level >= HWM_SIMD_SSE4)
+        done = base64_encode_sse4(dest, src, size);
+#endif
+
+    base64_encode_scalar(dest + done / 3 * 4, src + done, size - done);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Base64 decoding
+ *
+ * The vector kernels use the approach from Muła and Lemire's “Faster
+ * Base64 Encoding and Decoding Using AVX2 Instructions”: each
+ * character is validated by looking up bitmasks from its high and low
+ * nibbles, which only overlap for characters outside the alphabet,
+ * and then converted by adding an offset looked up from its high
+ * nibble.  Multiply-adds then pack the 6-bit values together.
+ */
+
+/**
+ * Decode groups of four base64 digits, none of which can be padding,
+ * into dest.  Return false if any of them aren't in the alphabet.
+ */
+
+static bool
+base64_decode_scalar(uint8_t *dest, const uint8_t *src, size_t size)
+{
+    size_t  i;
+
+    for (i = 0; i < size; i += 4)
+    {
+        uint32_t  a = BASE64_VALUES[src[i]];
+        uint32_t  b = BASE64_VALUES[src[i + 1]];
+        uint32_t  c = BASE64_VALUES[src[i + 2]];
+        uint32_t  d = BASE64_VALUES[src[i + 3]];
+        uint32_t  group = (a << 18) | (b << 12) | (c << 6) | d;
+
+        if (((a | b | c | d) & 0x80) != 0)
+            return false;
+
+        *dest++ = (uint8_t) (group >> 16);
+        *dest++ = (uint8_t) (group >> 8);
+        *dest++ = (uint8_t) group;
+    }
+
+    return true;
+}
+
+
+#if defined(HWM_X86_SIMD)
+
+HWM_TARGET_SSE4
+static bool
+base64_decode_sse4(uint8_t *dest, const uint8_t *src, size_t size,
+                   size_t *done)
+{
+    const __m128i  low_masks =
+        _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                      0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m128i  high_masks =
+        _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i  offsets =
+        _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                      0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i  slash = _mm_set1_epi8('/');
+    const __m128i  pack_shuffle =
+        _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+                      -1, -1, -1, -1);
+    size_t  i;
+
+    for (i = 0; i + 16 <= size; i += 16)
+    {
+        __m128i  chars = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128i  high = _mm_and_si128(_mm_srli_epi32(chars, 4), slash);
+        __m128i  low = _mm_and_si128(chars, slash);
+        __m128i  values;
+
+        if (!_mm_testz_si128(_mm_shuffle_epi8(low_masks, low),
+                             _mm_shuffle_epi8(high_masks, high)))
+        {
+            return false;
+        }
+
+        /*
+         * “/” has the same high nibble as “+”, but needs a different
+         * offset, so it gets the slot just before it.
+         */
+
+        values = _mm_add_epi8
+            (chars, _mm_shuffle_epi8
+             (offsets, _mm_add_epi8(_mm_cmpeq_epi8(chars, slash), high)));
+
+        /*
+         * Merge pairs of 6-bit values into 12-bit ones, then pairs of
+         * those into 24-bit ones, and then drop the unused bytes.
+         */
+
+        values = _mm_madd_epi16
+            (_mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140)),
+             _mm_set1_epi32(0x00011000));
+        _mm_storeu_si128((__m128i *) (dest + i / 4 * 3),
+                         _mm_shuffle_epi8(values, pack_shuffle));
+    }
+
+    *done = i;
+    return true;
+}
+
+
+HWM_TARGET_AVX2
+static bool
+base64_decode_avx2(uint8_t *dest, const uint8_t *src, size_t size,
+                   size_t *done)
+{
+    const __m256i  low_masks = _mm256_broadcastsi128_si256
+        (_mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                       0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a));
+    const __m256i  high_masks = _mm256_broadcastsi128_si256
+        (_mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                       0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10));
+    const __m256i  offsets = _mm256_broadcastsi128_si256
+        (_mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                       0, 0, 0, 0, 0, 0, 0, 0));
+    const __m256i  slash = _mm256_set1_epi8('/');
+    const __m256i  pack_shuffle = _mm256_broadcastsi128_si256
+        (_mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+                       -1, -1, -1, -1));
+    const __m256i  pack_lanes = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+    size_t  i;
+
+    for (i = 0; i + 32 <= size; i += 32)
+    {
+        __m256i  chars = _mm256_loadu_si256((const __m256i *) (src + i));
+        __m256i  high = _mm256_and_si256(_mm256_srli_epi32(chars, 4), slash);
+        __m256i  low = _mm256_and_si256(chars, slash);
+        __m256i  values;
+
+        if (!_mm256_testz_si256(_mm256_shuffle_epi8(low_masks, low),
+                                _mm256_shuffle_epi8(high_masks, high)))
+        {
+            return false;
+        }
+
+        values = _mm256_add_epi8
+            (chars, _mm256_shuffle_epi8
+             (offsets,
+              _mm256_add_epi8(_mm256_cmpeq_epi8(chars, slash), high)));
+
+        /*
+         * Each lane ends up with twelve bytes of output, which are then
+         * moved next to each other.
+         */
+
+        values = _mm256_madd_epi16
+            (_mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140)),
+             _mm256_set1_epi32(0x00011000));
+        values = _mm256_shuffle_epi8(values, pack_shuffle);
+        _mm256_storeu_si256((__m256i *) (dest + i / 4 * 3),
+                            _mm256_permutevar8x32_epi32(values, pack_lanes));
+    }
+
+    *done = i;
+    return true;
+}
+
+#endif
+
+
+/**
+ * Decode size characters of unpadded base64, which must be a multiple
+ * of four, into dest.  dest must have BASE64_DECODE_SLACK bytes of
+ * extra room.
+ */
+
+static bool
+base64_decode(uint8_t *dest, const uint8_t *src, size_t size)
+{
+    size_t  done = 0;
+
+#if defined(HWM_X86_SIMD)
+    int  level = hwm_simd_level();
+
+    if (level >= HWM_SIMD_AVX2)
+    {
+        if (!base64_decode_avx2(dest, src, size, &done))
+            return false;
+    }
+    else if (level >= HWM_SIMD_SSE4)
+    {
+        if (!base64_decode_sse4(dest, src, size, &done))
+            return false;
+    }
+#endif
+
+    return base64_decode_scalar(dest + done / 4 * 3, src + done,
+                                size - done);
+}
+
+
+/**
+ * Decode the last group of four base64 digits, which might end with
+ * padding.  Return the number of bytes decoded, or -1 if the group is
+ * invalid.
+ */
+
+static int
+base64_decode_last(uint8_t *dest, const uint8_t *src)
+{
+    uint32_t  a;
+    uint32_t  b;
+    uint32_t  c;
+
+    if (src[3] != '=')
+        return base64_decode_scalar(dest, src, 4)? 3: -1;
+
+    a = BASE64_VALUES[src[0]];
+    b = BASE64_VALUES[src[1]];
+
+    if (src[2] == '=')
+    {
+        if (((a | b) & 0x80) != 0)
+            return -1;
+
+        dest[0] = (uint8_t) ((a << 2) | (b >> 4));
+        return 1;
+    }
+
+    c = BASE64_VALUES[src[2]];
+    if (((a | b | c) & 0x80) != 0)
+        return -1;
+
+    dest[0] = (uint8_t) ((a << 2) | (b >> 4));
+    dest[1] = (uint8_t) ((b << 4) | (c >> 2));
+    return 2;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Public interface
+ */
+
+bool
+hwm_buffer_append_hex(hwm_buffer_t *hwm, const void *src, size_t size)
+{
+    char  *dest;
+
+    if (size > SIZE_MAX / 2)
+    {
+        errno = ENOMEM;
+        return false;
+    }
+
+    dest = hwm_buffer_reserve(hwm, 2 * size);
+    if (dest == NULL)
+        return false;
+
+    hex_encode(dest, src, size);
+    hwm_buffer_commit(hwm, 2 * size);
+    return true;
+}
+
+
+bool
+hwm_buffer_append_from_hex(hwm_buffer_t *hwm,
+                           const char *src, size_t size)
+{
+    uint8_t  *dest;
+
+    if (size % 2 != 0)
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    dest = hwm_buffer_reserve(hwm, size / 2);
+    if (dest == NULL)
+        return false;
+
+    if (!hex_decode(dest, (const uint8_t *) src, size / 2))
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    hwm_buffer_commit(hwm, size / 2);
+    return true;
+}
+
+
+bool
+hwm_buffer_append_base64(hwm_buffer_t *hwm, const void *src, size_t size)
+{
+    size_t  encoded_size = (size / 3 + (size % 3 != 0)) * 4;
+    char  *dest;
+
+    if (size / 3 > SIZE_MAX / 4 - 1)
+    {
+        errno = ENOMEM;
+        return false;
+    }
+
+    dest = hwm_buffer_reserve(hwm, encoded_size);
+    if (dest == NULL)
+        return false;
+
+    base64_encode(dest, src, size);
+    hwm_buffer_commit(hwm, encoded_size);
+    return true;
+}
+
+
+bool
+hwm_buffer_append_from_base64(hwm_buffer_t *hwm,
+                              const char *src, size_t size)
+{
+    const uint8_t  *chars = (const uint8_t *) src;
+    size_t  body_size;
+    uint8_t  *dest;
+    int  last_size;
+
+    if (size % 4 != 0)
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    if (size == 0)
+        return true;
+
+    /*
+     * Everything but the last group is decoded in bulk.  Only the last
+     * group can contain padding, and there's always room for three
+     * bytes, even if it only decodes to one or two.
+     */
+
+    body_size = size - 4;
+    dest = hwm_buffer_reserve(hwm, size / 4 * 3 + BASE64_DECODE_SLACK);
+    if (dest == NULL)
+        return false;
+
+    if (!base64_decode(dest, chars, body_size) ||
+        (last_size = base64_decode_last(dest + body_size / 4 * 3,
+                                        chars + body_size)) < 0)
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    hwm_buffer_commit(hwm, body_size / 4 * 3 + last_size);
+    return true;
+}
@@ -0,0 +1,215 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2009, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <hwm-buffer.h>
+
+#include "hwm-private.h"
+
+
+/**
+ * The maximum number of buffers that we pass to a single writev()
+ * call.  POSIX guarantees that IOV_MAX is at least 16.
+ */
+
+#if defined(IOV_MAX) && IOV_MAX < 64
+#define WRITE_IOV_COUNT  IOV_MAX
+#else
+#define WRITE_IOV_COUNT  64
+#endif
+
+
+/**
+ * Read into the unused space at the end of the buffer, retrying if
+ * we're interrupted by a signal.  The caller must make sure that the
+ * buffer is using its own storage, and that there are at least max
+ * bytes of unused space.
+ */
+
+static ssize_t
+read_into_tail(hwm_buffer_t *hwm, int fd, size_t max)
+{
+    ssize_t  bytes_read;
+
+    do
+    {
+        bytes_read = read(fd, hwm_buffer_owned_mem(hwm) + hwm->current_size,
+                          max);
+    } while (bytes_read < 0 && errno == EINTR);
+
+    if (bytes_read > 0)
+        hwm->current_size += bytes_read;
+
+    return bytes_read;
+}
+
+
+ssize_t
+hwm_buffer_append_from_fd(hwm_buffer_t *hwm, int fd, size_t max)
+{
+    if (max == 0)
+        max = HWM_BUFFER_READ_CHUNK_SIZE;
+
+    /*
+     * read() can't report more than SSIZE_MAX bytes.
+     */
+
+    if (max > SSIZE_MAX)
+        max = SSIZE_MAX;
+
+    if (hwm_buffer_reserve(hwm, max) == NULL)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    return read_into_tail(hwm, fd, max);
+}
+
+
+bool
+hwm_buffer_append_from_fd_until_eof(hwm_buffer_t *hwm, int fd,
+                                    size_t *bytes_read)
+{
+    if (bytes_read != NULL)
+        *bytes_read = 0;
+
+    /*
+     * Make sure that we're appending to our own storage, even if
+     * there's already enough room in it.
+     */
+
+    if (!_hwm_buffer_grow_and_copy(hwm, hwm->current_size))
+    {
+        errno = ENOMEM;
+        return false;
+    }
+
+    while (true)
+    {
+        size_t  unused =
+            hwm->allocated_size - hwm->consumed - hwm->current_size;
+        ssize_t  chunk;
+
+        if (hwm->buf == NULL || unused == 0)
+        {
+            if ((HWM_BUFFER_READ_CHUNK_SIZE >
+                 SIZE_MAX - hwm->current_size) ||
+                !_hwm_buffer_grow_and_copy
+                (hwm, hwm->current_size + HWM_BUFFER_READ_CHUNK_SIZE))
+            {
+                errno = ENOMEM;
+                return false;
+            }
+
+            unused =
+                hwm->allocated_size - hwm->consumed - hwm->current_size;
+        }
+
+        if (unused > SSIZE_MAX)
+            unused = SSIZE_MAX;
+
+        chunk = read_into_tail(hwm, fd, unused);
+
+        if (chunk < 0)
+            return false;
+
+        if (chunk == 0)
+            return true;
+
+        if (bytes_read != NULL)
+            *bytes_read += chunk;
+    }
+}
+
+
+/**
+ * Skip over any buffers whose contents have been completely written.
+ * On input, *index and *offset point at a position in the
+ * concatenation of the buffers; on output, *offset is strictly less
+ * than the size of the *index'th buffer, or *index is count.
+ */
+
+static void
+skip_written(const hwm_buffer_t *const *bufs, size_t count,
+             size_t *index, size_t *offset)
+{
+    while (*index < count && *offset >= bufs[*index]->current_size)
+    {
+        *offset -= bufs[*index]->current_size;
+        (*index)++;
+    }
+}
+
+
+bool
+hwm_buffer_write_fd(int fd, const hwm_buffer_t *const *bufs, size_t count,
+                    size_t *written)
+{
+    size_t  index = 0;
+    size_t  offset = (written == NULL)? 0: *written;
+
+    skip_written(bufs, count, &index, &offset);
+
+    while (index < count)
+    {
+        struct iovec  iov[WRITE_IOV_COUNT];
+        int  iov_count = 0;
+        size_t  i;
+        size_t  skip = offset;
+        ssize_t  bytes_written;
+
+        /*
+         * Fill in as many iovecs as we can, starting with the part of
+         * the current buffer that hasn't been written yet.  Empty
+         * buffers don't need an iovec.
+         */
+
+        for (i = index; i < count && iov_count < WRITE_IOV_COUNT; i++)
+        {
+            const hwm_buffer_t  *buf = bufs[i];
+
+            if (buf->current_size > skip)
+            {
+                iov[iov_count].iov_base = (void *) (buf->data + skip);
+                iov[iov_count].iov_len = buf->current_size - skip;
+                iov_count++;
+            }
+
+            skip = 0;
+        }
+
+        if (iov_count == 0)
+            break;
+
+        do
+        {
+            bytes_written = writev(fd, iov, iov_count);
+        } while (bytes_written < 0 && errno == EINTR);
+
+        if (bytes_written < 0)
+            return false;
+
+        if (written != NULL)
+            *written += bytes_written;
+
+        offset += bytes_written;
+        skip_written(bufs, count, &index, &offset);
+    }
+
+    return true;
+}
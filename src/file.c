@@ -0,0 +1,145 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2009, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <hwm-buffer.h>
+
+#include "hwm-private.h"
+
+
+/**
+ * Try to map a regular file into memory, and point the buffer at the
+ * mapping.  Return false if the file can't be mapped, in which case
+ * the buffer is left untouched.
+ */
+
+static bool
+map_file(hwm_buffer_t *hwm, int fd, const struct stat *st,
+         unsigned int flags)
+{
+    void  *mapping;
+    size_t  size;
+    int  mmap_flags = MAP_PRIVATE;
+
+    if (!S_ISREG(st->st_mode) || st->st_size <= 0 ||
+        (uintmax_t) st->st_size > SIZE_MAX)
+    {
+        return false;
+    }
+
+    size = (size_t) st->st_size;
+
+#if defined(MAP_POPULATE)
+    if (flags & HWM_BUFFER_LOAD_FILE_POPULATE)
+        mmap_flags |= MAP_POPULATE;
+#endif
+
+    mapping = mmap(NULL, size, PROT_READ, mmap_flags, fd, 0);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    if (flags & HWM_BUFFER_LOAD_FILE_SEQUENTIAL)
+        madvise(mapping, size, MADV_SEQUENTIAL);
+
+    /*
+     * Point the buffer at the mapping, exactly like
+     * hwm_buffer_point_at_mem() would, but remember that we're
+     * responsible for unmapping it.
+     */
+
+    _hwm_buffer_release_data(hwm);
+    hwm->mapping = mapping;
+    hwm->mapping_size = size;
+    hwm->data = mapping;
+    hwm->current_size = size;
+    return true;
+}
+
+
+/**
+ * Read everything from fd into the buffer's own storage.  If the file
+ * is a regular file, we use its size as a hint for how much to read.
+ */
+
+static bool
+read_file(hwm_buffer_t *hwm, int fd, const struct stat *st)
+{
+    _hwm_buffer_release_data(hwm);
+    hwm->data = hwm->buf;
+    hwm->current_size = 0;
+
+    /*
+     * If we know how big the file is, ask for one more byte than
+     * that, so that the end-of-file is usually noticed without having
+     * to grow the buffer again.
+     */
+
+    if (S_ISREG(st->st_mode) && st->st_size > 0 &&
+        (uintmax_t) st->st_size < SIZE_MAX)
+    {
+        if (!hwm_buffer_ensure_size(hwm, (size_t) st->st_size + 1))
+            return false;
+
+        hwm->data = hwm->buf;
+    }
+
+    return hwm_buffer_append_from_fd_until_eof(hwm, fd, NULL);
+}
+
+
+bool
+hwm_buffer_load_fd(hwm_buffer_t *hwm, int fd, unsigned int flags)
+{
+    struct stat  st;
+
+    if (fstat(fd, &st) != 0)
+        return false;
+
+    if (!(flags & HWM_BUFFER_LOAD_FILE_NO_MMAP) &&
+        map_file(hwm, fd, &st, flags))
+    {
+        return true;
+    }
+
+    return read_file(hwm, fd, &st);
+}
+
+
+bool
+hwm_buffer_load_file(hwm_buffer_t *hwm, const char *path,
+                     unsigned int flags)
+{
+    int  fd;
+    bool  result;
+    int  saved_errno;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    /*
+     * The mapping (if any) stays valid after we close the file.  Make
+     * sure that closing the file doesn't clobber the errno from a
+     * failed load.
+     */
+
+    result = hwm_buffer_load_fd(hwm, fd, flags);
+    saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return result;
+}
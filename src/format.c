@@ -0,0 +1,159 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2009, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <hwm-buffer.h>
+
+#include "hwm-private.h"
+
+
+/**
+ * Format a string into the buffer's own storage, starting offset bytes
+ * into its contents, using whatever room is left there.  Return the
+ * number of characters that the complete output needs (not counting
+ * the NUL terminator), or -1 if there's an output error.
+ */
+
+static int
+format_at(hwm_buffer_t *hwm, size_t offset, const char *fmt, va_list args)
+{
+    char  *dest = hwm_buffer_owned_mem(hwm) + offset;
+    size_t  room = hwm->allocated_size - hwm->consumed - offset;
+    va_list  args_copy;
+    int  length;
+
+    va_copy(args_copy, args);
+    length = vsnprintf(dest, room, fmt, args_copy);
+    va_end(args_copy);
+    return length;
+}
+
+
+bool
+hwm_buffer_vappendf(hwm_buffer_t *hwm, const char *fmt, va_list args)
+{
+    size_t  modified_current_size;
+    int  length;
+
+    /*
+     * Just like hwm_buffer_append_str(), we overwrite any existing NUL
+     * terminator.
+     */
+
+    modified_current_size =
+        (hwm->current_size == 0)?
+        0:
+        hwm->current_size - 1;
+
+    /*
+     * Make sure that we're pointing at the internal buffer, and that
+     * there's room for at least a NUL terminator.  Then try to format
+     * straight into whatever space is left after the current
+     * contents.
+     */
+
+    if (!_hwm_buffer_grow_and_copy(hwm, modified_current_size + 1))
+    {
+        return false;
+    }
+
+    length = format_at(hwm, modified_current_size, fmt, args);
+
+    /*
+     * If the output didn't fit, vsnprintf tells us how much room it
+     * needs, so we only have to grow and try again once.
+     */
+
+    if (length >= 0 &&
+        modified_current_size + length + 1 >
+        hwm->allocated_size - hwm->consumed)
+    {
+        if ((size_t) length < SIZE_MAX - 1 - modified_current_size &&
+            _hwm_buffer_grow_and_copy
+            (hwm, modified_current_size + length + 1))
+        {
+            length = format_at(hwm, modified_current_size, fmt, args);
+        }
+        else
+        {
+            length = -1;
+        }
+    }
+
+    if (length < 0)
+    {
+        /*
+         * A failed attempt might have overwritten the old NUL
+         * terminator, so put it back.
+         */
+
+        if (hwm->current_size > 0)
+        {
+            char  *mem = hwm_buffer_owned_mem(hwm);
+            mem[modified_current_size] = '\0';
+        }
+
+        return false;
+    }
+
+    /*
+     * Note that current_size includes the byte used to store the NUL
+     * terminator.
+     */
+
+    hwm->current_size = modified_current_size + length + 1;
+    return true;
+}
+
+
+bool
+hwm_buffer_appendf(hwm_buffer_t *hwm, const char *fmt, ...)
+{
+    va_list  args;
+    bool  result;
+
+    va_start(args, fmt);
+    result = hwm_buffer_vappendf(hwm, fmt, args);
+    va_end(args);
+    return result;
+}
+
+
+bool
+hwm_buffer_vloadf(hwm_buffer_t *hwm, const char *fmt, va_list args)
+{
+    /*
+     * Throw away the current contents, and then append to the empty
+     * buffer.
+     */
+
+    _hwm_buffer_release_data(hwm);
+    hwm->data = hwm->buf;
+    hwm->current_size = 0;
+
+    return hwm_buffer_vappendf(hwm, fmt, args);
+}
+
+
+bool
+hwm_buffer_loadf(hwm_buffer_t *hwm, const char *fmt, ...)
+{
+    va_list  args;
+    bool  result;
+
+    va_start(args, fmt);
+    result = hwm_buffer_vloadf(hwm, fmt, args);
+    va_end(args);
+    return result;
+}
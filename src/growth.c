@@ -0,0 +1,165 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2009, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <hwm-buffer.h>
+
+
+/**
+ * The page size to use if we can't ask the operating system for it.
+ */
+
+#define DEFAULT_PAGE_SIZE  4096
+
+/**
+ * The smallest size class used by the size-class policy.
+ */
+
+#define MIN_SIZE_CLASS  16
+
+
+/**
+ * Add two sizes, saturating at SIZE_MAX instead of overflowing.
+ */
+
+static size_t
+saturating_add(size_t a, size_t b)
+{
+    return (a > SIZE_MAX - b)? SIZE_MAX: a + b;
+}
+
+
+/**
+ * Round value up to a multiple of align, which must be a power of
+ * two.  If that would overflow, return value unchanged; the caller
+ * will then allocate exactly what was requested.
+ */
+
+static size_t
+round_up(size_t value, size_t align)
+{
+    size_t  mask = align - 1;
+
+    if (value > SIZE_MAX - mask)
+        return value;
+
+    return (value + mask) & ~mask;
+}
+
+
+static size_t
+exact_grow(const hwm_growth_policy_t *policy,
+           size_t allocated_size, size_t requested_size)
+{
+    return requested_size;
+}
+
+
+static size_t
+double_grow(const hwm_growth_policy_t *policy,
+            size_t allocated_size, size_t requested_size)
+{
+    size_t  new_size = saturating_add(allocated_size, allocated_size);
+    return (new_size > requested_size)? new_size: requested_size;
+}
+
+
+static size_t
+one_and_half_grow(const hwm_growth_policy_t *policy,
+                  size_t allocated_size, size_t requested_size)
+{
+    size_t  new_size = saturating_add(allocated_size, allocated_size / 2);
+    return (new_size > requested_size)? new_size: requested_size;
+}
+
+
+static size_t
+page_grow(const hwm_growth_policy_t *policy,
+          size_t allocated_size, size_t requested_size)
+{
+    static size_t  page_size = 0;
+
+    /*
+     * The page size can't change while we're running, so we only ask
+     * for it once.
+     */
+
+    if (page_size == 0)
+    {
+        long  result = sysconf(_SC_PAGESIZE);
+        page_size = (result > 0)? (size_t) result: DEFAULT_PAGE_SIZE;
+    }
+
+    return round_up(requested_size, page_size);
+}
+
+
+static size_t
+size_class_grow(const hwm_growth_policy_t *policy,
+                size_t allocated_size, size_t requested_size)
+{
+    size_t  power;
+
+    if (requested_size <= MIN_SIZE_CLASS)
+        return MIN_SIZE_CLASS;
+
+    /*
+     * Find the largest power of two that's strictly less than the
+     * requested size.  The size classes between that power of two
+     * and the next one are a quarter of it apart.
+     */
+
+    power = MIN_SIZE_CLASS;
+    while (power * 2 < requested_size && power <= SIZE_MAX / 4)
+        power *= 2;
+
+    return round_up(requested_size, power / 4);
+}
+
+
+size_t
+hwm_growth_capped_linear_grow(const hwm_growth_policy_t *policy,
+                              size_t allocated_size,
+                              size_t requested_size)
+{
+    size_t  threshold = policy->param;
+
+    /*
+     * Below the threshold, we double.  Above it, we grow by whole
+     * multiples of the threshold, so that very large buffers don't
+     * overshoot by up to 100%.
+     */
+
+    if (threshold == 0)
+        return double_grow(policy, allocated_size, requested_size);
+
+    if (requested_size < threshold)
+    {
+        size_t  new_size =
+            double_grow(policy, allocated_size, requested_size);
+        return (new_size > threshold)? threshold: new_size;
+    }
+
+    if (requested_size > SIZE_MAX - threshold)
+        return requested_size;
+
+    return ((requested_size + threshold - 1) / threshold) * threshold;
+}
+
+
+const hwm_growth_policy_t  hwm_growth_exact = { exact_grow, 0 };
+const hwm_growth_policy_t  hwm_growth_double = { double_grow, 0 };
+const hwm_growth_policy_t  hwm_growth_one_and_half =
+    { one_and_half_grow, 0 };
+const hwm_growth_policy_t  hwm_growth_page = { page_grow, 0 };
+const hwm_growth_policy_t  hwm_growth_size_class = { size_class_grow, 0 };
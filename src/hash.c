@@ -0,0 +1,360 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2009, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <hwm-buffer.h>
+
+#include "hwm-private.h"
+
+
+/*-----------------------------------------------------------------------
+ * XXH64
+ *
+ * The input is consumed in 32-byte stripes, each of which feeds four
+ * independent 64-bit lanes.  The lanes don't depend on each other, so
+ * the CPU can keep all four multiplies in flight at once.
+ */
+
+#define PRIME1  UINT64_C(0x9e3779b185ebca87)
+#define PRIME2  UINT64_C(0xc2b2ae3d27d4eb4f)
+#define PRIME3  UINT64_C(0x165667b19e3779f9)
+#define PRIME4  UINT64_C(0x85ebca77c2b2ae63)
+#define PRIME5  UINT64_C(0x27d4eb2f165667c5)
+
+#define STRIPE_SIZE  32
+
+
+static inline uint64_t
+rotl64(uint64_t value, unsigned int count)
+{
+    return (value << count) | (value >> (64 - count));
+}
+
+
+/**
+ * Read little-endian integers.  The compiler turns these into single
+ * loads on little-endian machines.
+ */
+
+static inline uint64_t
+read64(const uint8_t *src)
+{
+    return
+        ((uint64_t) src[0]) |
+        ((uint64_t) src[1] << 8) |
+        ((uint64_t) src[2] << 16) |
+        ((uint64_t) src[3] << 24) |
+        ((uint64_t) src[4] << 32) |
+        ((uint64_t) src[5] << 40) |
+        ((uint64_t) src[6] << 48) |
+        ((uint64_t) src[7] << 56);
+}
+
+
+static inline uint64_t
+read32(const uint8_t *src)
+{
+    return
+        ((uint64_t) src[0]) |
+        ((uint64_t) src[1] << 8) |
+        ((uint64_t) src[2] << 16) |
+        ((uint64_t) src[3] << 24);
+}
+
+
+static inline uint64_t
+round64(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME1;
+}
+
+
+static inline uint64_t
+merge_lane(uint64_t acc, uint64_t lane)
+{
+    acc ^= round64(0, lane);
+    return acc * PRIME1 + PRIME4;
+}
+
+
+static void
+reset_lanes(uint64_t *lanes)
+{
+    lanes[0] = PRIME1 + PRIME2;
+    lanes[1] = PRIME2;
+    lanes[2] = 0;
+    lanes[3] = -PRIME1;
+}
+
+
+/**
+ * Feed count whole stripes into the lanes.
+ */
+
+static void
+hash_stripes(uint64_t *lanes, const uint8_t *src, size_t count)
+{
+    uint64_t  v1 = lanes[0];
+    uint64_t  v2 = lanes[1];
+    uint64_t  v3 = lanes[2];
+    uint64_t  v4 = lanes[3];
+
+    for (; count > 0; count--, src += STRIPE_SIZE)
+    {
+        v1 = round64(v1, read64(src));
+        v2 = round64(v2, read64(src + 8));
+        v3 = round64(v3, read64(src + 16));
+        v4 = round64(v4, read64(src + 24));
+    }
+
+    lanes[0] = v1;
+    lanes[1] = v2;
+    lanes[2] = v3;
+    lanes[3] = v4;
+}
+
+
+/**
+ * Combine the lanes with the fewer-than-32 bytes that are left over,
+ * producing the final hash.
+ */
+
+static uint64_t
+finish(const uint64_t *lanes, uint64_t total_size,
+       const uint8_t *tail, size_t tail_size)
+{
+    uint64_t  result;
+
+    if (total_size >= STRIPE_SIZE)
+    {
+        result = rotl64(lanes[0], 1) + rotl64(lanes[1], 7) +
+            rotl64(lanes[2], 12) + rotl64(lanes[3], 18);
+        result = merge_lane(result, lanes[0]);
+        result = merge_lane(result, lanes[1]);
+        result = merge_lane(result, lanes[2]);
+        result = merge_lane(result, lanes[3]);
+    } else {
+        result = lanes[2] + PRIME5;
+    }
+
+    result += total_size;
+
+    for (; tail_size >= 8; tail_size -= 8, tail += 8)
+    {
+        result ^= round64(0, read64(tail));
+        result = rotl64(result, 27) * PRIME1 + PRIME4;
+    }
+
+    if (tail_size >= 4)
+    {
+        result ^= read32(tail) * PRIME1;
+        result = rotl64(result, 23) * PRIME2 + PRIME3;
+        tail_size -= 4;
+        tail += 4;
+    }
+
+    for (; tail_size > 0; tail_size--, tail++)
+    {
+        result ^= *tail * PRIME5;
+        result = rotl64(result, 11) * PRIME1;
+    }
+
+    result ^= result >> 33;
+    result *= PRIME2;
+    result ^= result >> 29;
+    result *= PRIME3;
+    result ^= result >> 32;
+    return result;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Streaming state
+ */
+
+static void
+reset_state(struct hwm_buffer_hash *state)
+{
+    reset_lanes(state->lanes);
+    state->total_size = 0;
+    state->pending_size = 0;
+    state->valid = true;
+}
+
+
+static void
+update_state(struct hwm_buffer_hash *state, const uint8_t *src, size_t size)
+{
+    state->total_size += size;
+
+    /*
+     * Top up any partial stripe left over from last time first.
+     */
+
+    if (state->pending_size > 0)
+    {
+        size_t  needed = STRIPE_SIZE - state->pending_size;
+
+        if (size < needed)
+        {
+            memcpy(state->pending + state->pending_size, src, size);
+            state->pending_size += size;
+            return;
+        }
+
+        memcpy(state->pending + state->pending_size, src, needed);
+        hash_stripes(state->lanes, state->pending, 1);
+        state->pending_size = 0;
+        src += needed;
+        size -= needed;
+    }
+
+    hash_stripes(state->lanes, src, size / STRIPE_SIZE);
+    src += size - size % STRIPE_SIZE;
+    size %= STRIPE_SIZE;
+
+    memcpy(state->pending, src, size);
+    state->pending_size = size;
+}
+
+
+static uint64_t
+digest_state(const struct hwm_buffer_hash *state)
+{
+    return finish(state->lanes, state->total_size,
+                  state->pending, state->pending_size);
+}
+
+
+void
+_hwm_buffer_update_hash(hwm_buffer_t *hwm)
+{
+    struct hwm_buffer_hash  *state = hwm->hash;
+    size_t  target = (hwm->current_size == 0)? 0: hwm->current_size - 1;
+
+    /*
+     * If the state covers more than the buffer has, the buffer must
+     * have shrunk since we last looked, so we can't trust any of it.
+     */
+
+    if (!state->valid || state->total_size > target)
+        reset_state(state);
+
+    if (target > state->total_size)
+    {
+        update_state(state, hwm_buffer_mem(hwm, uint8_t) + state->total_size,
+                     target - state->total_size);
+    }
+}
+
+
+bool
+_hwm_buffer_cached_hash(const hwm_buffer_t *hwm, uint64_t *result)
+{
+    struct hwm_buffer_hash  last;
+
+    if (hwm->hash == NULL || !hwm->hash->valid)
+        return false;
+
+    if (hwm->current_size == 0)
+    {
+        if (hwm->hash->total_size != 0)
+            return false;
+
+        *result = digest_state(hwm->hash);
+        return true;
+    }
+
+    if (hwm->hash->total_size != hwm->current_size - 1)
+        return false;
+
+    /*
+     * The state never includes the buffer's last byte, so we add it to
+     * a copy before finishing.
+     */
+
+    last = *hwm->hash;
+    update_state(&last, hwm_buffer_mem(hwm, uint8_t) +
+                 (hwm->current_size - 1), 1);
+    *result = digest_state(&last);
+    return true;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Public interface
+ */
+
+bool
+hwm_buffer_enable_hash(hwm_buffer_t *hwm)
+{
+    if (hwm->hash != NULL)
+        return true;
+
+    hwm->hash = hwm_buffer_allocate(hwm, sizeof(struct hwm_buffer_hash));
+    if (hwm->hash == NULL)
+        return false;
+
+    /*
+     * Don't hash the current contents until someone asks for them.
+     */
+
+    hwm->hash->valid = false;
+    return true;
+}
+
+
+void
+hwm_buffer_disable_hash(hwm_buffer_t *hwm)
+{
+    if (hwm->hash == NULL)
+        return;
+
+    hwm_buffer_deallocate(hwm, hwm->hash, sizeof(struct hwm_buffer_hash));
+    hwm->hash = NULL;
+}
+
+
+uint64_t
+hwm_buffer_hash(hwm_buffer_t *hwm)
+{
+    uint64_t  result;
+
+    if (hwm->hash == NULL)
+        return hwm_buffer_hash_mem(hwm->data, hwm->current_size);
+
+    /*
+     * Once the state has caught up, the cached hash is always
+     * available.
+     */
+
+    _hwm_buffer_update_hash(hwm);
+    _hwm_buffer_cached_hash(hwm, &result);
+    return result;
+}
+
+
+uint64_t
+hwm_buffer_hash_mem(const void *src, size_t size)
+{
+    const uint8_t  *bytes = src;
+    uint64_t  lanes[4];
+    size_t  stripes = size / STRIPE_SIZE;
+
+    reset_lanes(lanes);
+    hash_stripes(lanes, bytes, stripes);
+    return finish(lanes, size, bytes + stripes * STRIPE_SIZE,
+                  size % STRIPE_SIZE);
+}
@@ -0,0 +1,374 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2009, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <hwm-buffer.h>
+
+
+/**
+ * The number of bytes shown on each line of a hex dump.
+ */
+
+#define BYTES_PER_LINE  16
+
+/**
+ * The width of the hex part of a full line: a leading space, three
+ * characters per byte, and an extra two spaces in the middle.
+ */
+
+#define HEX_WIDTH  (1 + 3 * BYTES_PER_LINE + 2)
+
+
+static const char  HEX_DIGITS[16] = "0123456789abcdef";
+
+
+/**
+ * The shape of a hex dump's lines.
+ */
+
+typedef struct layout
+{
+    /**
+     * The number of hex digits in the offset column, or 0 if there
+     * isn't one.
+     */
+
+    size_t  offset_width;
+
+    /**
+     * Whether there's an ASCII gutter.
+     */
+
+    bool  ascii;
+} layout_t;
+
+
+static void
+init_layout(layout_t *layout, size_t size, size_t start_offset,
+            unsigned int flags)
+{
+    layout->offset_width = 0;
+    layout->ascii = ((flags & HWM_BUFFER_HEXDUMP_ASCII) != 0);
+
+    if ((flags & HWM_BUFFER_HEXDUMP_OFFSET) != 0)
+    {
+        /*
+         * Use eight digits, unless some offset doesn't fit in them.
+         */
+
+        size_t  last_offset = start_offset + (size - 1);
+        bool  wide = (size > 0) &&
+            (last_offset < start_offset || last_offset > 0xffffffffu);
+        layout->offset_width = wide? 16: 8;
+    }
+}
+
+
+/**
+ * Return the width of the hex part of a line with count bytes on it.
+ * Lines with an ASCII gutter are always padded to the full width, so
+ * that the gutters line up.
+ */
+
+static size_t
+hex_width(const layout_t *layout, size_t count)
+{
+    if (layout->ascii)
+        return HEX_WIDTH;
+
+    return 1 + 3 * count + ((count > BYTES_PER_LINE / 2)? 2: 0);
+}
+
+
+/**
+ * Return the width of a line with count bytes on it, including its
+ * newline.
+ */
+
+static size_t
+line_width(const layout_t *layout, size_t count)
+{
+    return layout->offset_width + hex_width(layout, count) +
+        (layout->ascii? 4 + count: 0) + 1;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Block kernels
+ *
+ * These convert a full line's worth of bytes at a time.
+ */
+
+#if defined(__SSE2__)
+
+/**
+ * Convert sixteen nibbles into hex digits.
+ */
+
+static __m128i
+nibbles_to_hex(__m128i nibbles)
+{
+    __m128i  letters =
+        _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)),
+                      _mm_set1_epi8('a' - '0' - 10));
+    return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')),
+                        letters);
+}
+
+#endif
+
+
+/**
+ * Convert sixteen bytes into 32 hex digits, two per byte.
+ */
+
+static void
+block_to_hex(char *dest, const uint8_t *src)
+{
+#if defined(__SSE2__)
+    __m128i  bytes = _mm_loadu_si128((const __m128i *) src);
+    __m128i  mask = _mm_set1_epi8(0x0f);
+    __m128i  high = nibbles_to_hex
+        (_mm_and_si128(_mm_srli_epi16(bytes, 4), mask));
+    __m128i  low = nibbles_to_hex(_mm_and_si128(bytes, mask));
+
+    _mm_storeu_si128((__m128i *) dest, _mm_unpacklo_epi8(high, low));
+    _mm_storeu_si128((__m128i *) (dest + 16),
+                     _mm_unpackhi_epi8(high, low));
+#else
+    size_t  i;
+
+    for (i = 0; i < BYTES_PER_LINE; i++)
+    {
+        dest[2 * i] = HEX_DIGITS[src[i] >> 4];
+        dest[2 * i + 1] = HEX_DIGITS[src[i] & 0x0f];
+    }
+#endif
+}
+
+
+/**
+ * Convert sixteen bytes into their ASCII gutter characters.
+ */
+
+static void
+block_to_ascii(char *dest, const uint8_t *src)
+{
+#if defined(__SSE2__)
+    /*
+     * The comparisons are signed, so bytes 0x80 and above count as
+     * less than 0x20, and are replaced too.
+     */
+
+    __m128i  bytes = _mm_loadu_si128((const __m128i *) src);
+    __m128i  printable =
+        _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(0x1f)),
+                      _mm_cmplt_epi8(bytes, _mm_set1_epi8(0x7f)));
+    __m128i  result =
+        _mm_or_si128(_mm_and_si128(printable, bytes),
+                     _mm_andnot_si128(printable, _mm_set1_epi8('.')));
+
+    _mm_storeu_si128((__m128i *) dest, result);
+#else
+    size_t  i;
+
+    for (i = 0; i < BYTES_PER_LINE; i++)
+        dest[i] = (src[i] >= 0x20 && src[i] < 0x7f)? src[i]: '.';
+#endif
+}
+
+
+/*-----------------------------------------------------------------------
+ * Lines
+ */
+
+/**
+ * Render one line of a hex dump, with count bytes on it, into dest.
+ * Return a pointer just past the end of the line.
+ */
+
+static char *
+format_line(char *dest, const uint8_t *src, size_t count, size_t offset,
+            const layout_t *layout)
+{
+    uint8_t  partial[BYTES_PER_LINE];
+    char  hex[2 * BYTES_PER_LINE];
+    size_t  width = hex_width(layout, count);
+    size_t  i;
+
+    /*
+     * The kernels always read a full line, so a short last line is
+     * copied somewhere that they can safely over-read.
+     */
+
+    if (count < BYTES_PER_LINE)
+    {
+        memset(partial, 0, sizeof(partial));
+        memcpy(partial, src, count);
+        src = partial;
+    }
+
+    for (i = layout->offset_width; i > 0; i--)
+    {
+        dest[i - 1] = HEX_DIGITS[offset & 0x0f];
+        offset >>= 4;
+    }
+
+    dest += layout->offset_width;
+
+    /*
+     * The beginning of each line begins with a space, and each byte
+     * is preceded by a space.  In between the eighth and ninth bytes
+     * of each line, there are two additional spaces.
+     */
+
+    block_to_hex(hex, src);
+    memset(dest, ' ', width);
+
+    for (i = 0; i < count; i++)
+    {
+        size_t  column = 2 + 3 * i + ((i >= BYTES_PER_LINE / 2)? 2: 0);
+        memcpy(dest + column, hex + 2 * i, 2);
+    }
+
+    dest += width;
+
+    if (layout->ascii)
+    {
+        char  ascii[BYTES_PER_LINE];
+
+        block_to_ascii(ascii, src);
+        memcpy(dest, "  |", 3);
+        memcpy(dest + 3, ascii, count);
+        dest[3 + count] = '|';
+        dest += 4 + count;
+    }
+
+    *dest++ = '\n';
+    return dest;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Public interface
+ */
+
+size_t
+hwm_buffer_hexdump_size(size_t size, size_t start_offset,
+                        unsigned int flags)
+{
+    layout_t  layout;
+    size_t  full_lines = size / BYTES_PER_LINE;
+    size_t  remainder = size % BYTES_PER_LINE;
+    size_t  full_width;
+    size_t  result;
+
+    init_layout(&layout, size, start_offset, flags);
+    full_width = line_width(&layout, BYTES_PER_LINE);
+
+    /*
+     * Report an impossibly large size if the dump can't fit in memory,
+     * so that any attempt to allocate room for it fails.
+     */
+
+    if (full_lines > SIZE_MAX / full_width)
+        return SIZE_MAX;
+
+    result = full_lines * full_width;
+
+    if (remainder > 0)
+    {
+        size_t  last_width = line_width(&layout, remainder);
+
+        if (result > SIZE_MAX - last_width)
+            return SIZE_MAX;
+
+        result += last_width;
+    }
+
+    return result;
+}
+
+
+size_t
+hwm_buffer_format_hexdump(char *dest, const void *src, size_t size,
+                          size_t start_offset, unsigned int flags)
+{
+    const uint8_t  *bytes = src;
+    char  *end = dest;
+    layout_t  layout;
+    size_t  i;
+
+    init_layout(&layout, size, start_offset, flags);
+
+    for (i = 0; i < size; i += BYTES_PER_LINE)
+    {
+        size_t  count = size - i;
+
+        if (count > BYTES_PER_LINE)
+            count = BYTES_PER_LINE;
+
+        end = format_line(end, bytes + i, count, start_offset + i,
+                          &layout);
+    }
+
+    return end - dest;
+}
+
+
+bool
+hwm_buffer_append_hexdump(hwm_buffer_t *hwm, const void *src, size_t size,
+                          size_t start_offset, unsigned int flags)
+{
+    size_t  dump_size = hwm_buffer_hexdump_size(size, start_offset, flags);
+    char  *dest = hwm_buffer_reserve(hwm, dump_size);
+
+    if (dest == NULL)
+        return false;
+
+    hwm_buffer_commit
+        (hwm, hwm_buffer_format_hexdump(dest, src, size,
+                                        start_offset, flags));
+    return true;
+}
+
+
+bool
+hwm_buffer_fprint_hexdump(FILE *stream, const hwm_buffer_t *hwm,
+                          size_t offset, size_t size, unsigned int flags)
+{
+    hwm_buffer_t  dump;
+    bool  result;
+
+    if (hwm->data == NULL || offset >= hwm->current_size)
+        return true;
+
+    if (size > hwm->current_size - offset)
+        size = hwm->current_size - offset;
+
+    hwm_buffer_init(&dump);
+
+    result =
+        hwm_buffer_append_hexdump(&dump, hwm_buffer_mem(hwm, uint8_t) +
+                                  offset, size, offset, flags) &&
+        fwrite(dump.data, 1, dump.current_size, stream) ==
+        dump.current_size;
+
+    hwm_buffer_done(&dump);
+    return result;
+}
@@ -0,0 +1,320 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2009, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef HWM_PRIVATE_H
+#define HWM_PRIVATE_H
+
+/**
+ * @file
+ *
+ * Helpers that are shared between the library's source files, but
+ * which aren't part of the public API.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <hwm-buffer.h>
+
+
+/**
+ * Return the allocator that the buffer uses for its storage.
+ */
+
+static inline const hwm_allocator_t *
+hwm_buffer_allocator(const hwm_buffer_t *hwm)
+{
+    return (hwm->allocator == NULL)? &hwm_allocator_default: hwm->allocator;
+}
+
+
+/**
+ * Allocate size bytes using the buffer's allocator.
+ */
+
+static inline void *
+hwm_buffer_allocate(const hwm_buffer_t *hwm, size_t size)
+{
+    return hwm_buffer_allocator(hwm)->allocate(hwm->allocator_ctx, size);
+}
+
+
+/**
+ * Resize an allocation using the buffer's allocator.
+ */
+
+static inline void *
+hwm_buffer_reallocate(const hwm_buffer_t *hwm, void *ptr,
+                      size_t old_size, size_t new_size)
+{
+    return hwm_buffer_allocator(hwm)->reallocate
+        (hwm->allocator_ctx, ptr, old_size, new_size);
+}
+
+
+/**
+ * Free an allocation using the buffer's allocator.
+ */
+
+static inline void
+hwm_buffer_deallocate(const hwm_buffer_t *hwm, void *ptr, size_t size)
+{
+    hwm_buffer_allocator(hwm)->deallocate(hwm->allocator_ctx, ptr, size);
+}
+
+
+/**
+ * Return how much of a new allocation of size bytes can actually be
+ * used, according to the buffer's allocator.
+ */
+
+static inline size_t
+hwm_buffer_usable_size(const hwm_buffer_t *hwm, void *ptr, size_t size)
+{
+    const hwm_allocator_t  *allocator = hwm_buffer_allocator(hwm);
+    size_t  usable;
+
+    if (allocator->usable_size == NULL)
+        return size;
+
+    usable = allocator->usable_size(hwm->allocator_ctx, ptr, size);
+    return (usable < size)? size: usable;
+}
+
+
+/**
+ * Pass along whichever of the buffer's advice flags are in mask to
+ * its allocator.
+ */
+
+static inline void
+hwm_buffer_advise(const hwm_buffer_t *hwm, unsigned int mask)
+{
+    const hwm_allocator_t  *allocator = hwm_buffer_allocator(hwm);
+    unsigned int  flags = hwm->advice & mask;
+
+    if (flags != 0 && allocator->advise != NULL && hwm->buf != NULL)
+    {
+        allocator->advise(hwm->allocator_ctx, hwm->buf,
+                          hwm->allocated_size, flags);
+    }
+}
+
+
+/**
+ * Return whether the buffer's data is in its own storage.  This is
+ * also true if the buffer is empty and hasn't allocated any storage.
+ */
+
+static inline bool
+hwm_buffer_owns_data(const hwm_buffer_t *hwm)
+{
+    return hwm->data == hwm->buf + hwm->consumed;
+}
+
+
+/**
+ * Return a writable pointer to the start of the buffer's contents.
+ * This is only valid if the buffer owns its data.
+ */
+
+static inline void *
+hwm_buffer_owned_mem(hwm_buffer_t *hwm)
+{
+    return hwm->buf + hwm->consumed;
+}
+
+
+/**
+ * A helper method for the append family of functions.  Ensures that
+ * the buffer is at least as large as new_size.  In addition, if the
+ * buffer currently points at some other piece of memory, rather than
+ * at its own internal buffer, we copy that data into the internal
+ * buffer.  The caller is responsible for ensuring that <code>new_size
+ * >= hwm->current_size</code>.
+ */
+
+bool
+_hwm_buffer_grow_and_copy(hwm_buffer_t *hwm, size_t new_size);
+
+
+/**
+ * Release anything that the buffer's data points at, other than its
+ * own storage, that the buffer is responsible for (such as a file
+ * mapping).  This must be called before the buffer's data pointer is
+ * changed to point anywhere else, but only after we're done reading
+ * from the old data.  Any consumed space at the start of the
+ * buffer's own storage is forgotten, too, since the old contents are
+ * being thrown away.
+ */
+
+void
+_hwm_buffer_release_data(hwm_buffer_t *hwm);
+
+
+/**
+ * Storage that's shared between several buffers by hwm_buffer_share().
+ */
+
+struct hwm_buffer_shared
+{
+    /**
+     * The number of buffers using the storage.  This is updated
+     * atomically, so that buffers in different threads can share it.
+     */
+
+    size_t  ref_count;
+
+    /**
+     * The storage itself.
+     */
+
+    void  *mem;
+
+    /**
+     * The size of the storage, as it was allocated or mapped.
+     */
+
+    size_t  size;
+
+    /**
+     * Whether mem is a file mapping, rather than memory from the
+     * allocator.
+     */
+
+    bool  mapped;
+
+    /**
+     * The allocator that the storage, and this struct, came from.
+     */
+
+    const hwm_allocator_t  *allocator;
+    void  *allocator_ctx;
+};
+
+
+/**
+ * Release the buffer's reference to its shared storage, freeing the
+ * storage if this was the last reference.  The buffer must have one.
+ */
+
+void
+_hwm_buffer_release_shared(hwm_buffer_t *hwm);
+
+
+/**
+ * The state of a buffer's incremental content hash.  This is XXH64's
+ * streaming state, plus how much of the buffer it covers.
+ */
+
+struct hwm_buffer_hash
+{
+    /**
+     * The four accumulators.
+     */
+
+    uint64_t  lanes[4];
+
+    /**
+     * The total number of bytes hashed.
+     */
+
+    uint64_t  total_size;
+
+    /**
+     * Bytes that haven't filled a 32-byte stripe yet.
+     */
+
+    uint8_t  pending[32];
+
+    /**
+     * The number of bytes in pending.
+     */
+
+    size_t  pending_size;
+
+    /**
+     * Whether the state describes the start of the buffer's current
+     * contents.  If not, we need to start over.
+     */
+
+    bool  valid;
+};
+
+
+/**
+ * Throw away the buffer's incremental hash, if it has one, because
+ * bytes that it covers might have changed.
+ */
+
+static inline void
+hwm_buffer_invalidate_hash(hwm_buffer_t *hwm)
+{
+    if (hwm->hash != NULL)
+        hwm->hash->valid = false;
+}
+
+
+/**
+ * Feed any new data in the buffer into its incremental hash.  The
+ * last byte of the buffer is never hashed until the hash is
+ * requested, since string appends overwrite it.
+ */
+
+void
+_hwm_buffer_update_hash(hwm_buffer_t *hwm);
+
+
+static inline void
+hwm_buffer_update_hash(hwm_buffer_t *hwm)
+{
+    if (hwm->hash != NULL)
+        _hwm_buffer_update_hash(hwm);
+}
+
+
+/**
+ * If the buffer's incremental hash is already up to date, store it in
+ * result and return true.  If computing it would mean hashing any
+ * more of the buffer, return false instead.
+ */
+
+bool
+_hwm_buffer_cached_hash(const hwm_buffer_t *hwm, uint64_t *result);
+
+
+/**
+ * Defined if we can compile x86 SIMD kernels.  The kernels are
+ * compiled with GCC's target attribute, so they don't need any special
+ * compiler flags, and are only called if hwm_simd_level() says that
+ * the CPU supports them.
+ */
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+
+#define HWM_X86_SIMD  1
+
+/**
+ * Marks a function as an SSE4.2 kernel.
+ */
+
+#define HWM_TARGET_SSE4  __attribute__((target("sse4.2")))
+
+/**
+ * Marks a function as an AVX2 kernel.
+ */
+
+#define HWM_TARGET_AVX2  __attribute__((target("avx2")))
+
+#endif
+
+
+#endif /* HWM_PRIVATE_H */
@@ -9,73 +9,310 @@
  */
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <hwm-buffer.h>
 
+#include "hwm-private.h"
+
+
+/**
+ * Determine how much memory to allocate so that the buffer can hold
+ * size bytes, according to the buffer's growth policy.
+ */
+
+static size_t
+grown_size(hwm_buffer_t *hwm, size_t size)
+{
+    size_t  allocated_size;
+    size_t  new_size;
+
+    if (hwm->growth == NULL)
+        return size;
+
+    allocated_size = (hwm->buf == NULL)? 0: hwm->allocated_size;
+    new_size = hwm->growth->grow(hwm->growth, allocated_size, size);
+    return (new_size < size)? size: new_size;
+}
+
+
+/**
+ * Move the buffer's contents back to the start of its storage,
+ * reclaiming any space that's been consumed.  The buffer must own its
+ * data.
+ */
+
+static void
+compact(hwm_buffer_t *hwm)
+{
+    if (hwm->consumed == 0)
+        return;
+
+    if (hwm->current_size > 0)
+        memmove(hwm->buf, hwm->data, hwm->current_size);
+
+    hwm->data = hwm->buf;
+    hwm->consumed = 0;
+}
+
 
 bool
 hwm_buffer_ensure_size(hwm_buffer_t *hwm, size_t size)
 {
+    /*
+     * If some of the buffer's contents have been consumed, the space
+     * that we need starts after the consumed bytes.  If that means
+     * that we'd have to grow, check whether it's worth reclaiming the
+     * consumed bytes instead: either because that makes enough room
+     * on its own, or because there are fewer bytes to move than
+     * there are to reclaim.
+     */
+
+    if (hwm->consumed > 0)
+    {
+        if (size > hwm->allocated_size - hwm->consumed &&
+            (size <= hwm->allocated_size ||
+             hwm->consumed >= hwm->current_size))
+        {
+            compact(hwm);
+        }
+
+        if (size > SIZE_MAX - hwm->consumed)
+            return false;
+
+        size += hwm->consumed;
+    }
+
     if (hwm->buf == NULL)
     {
         /*
-         * If we haven't allocated any buffer yet, we need to use
-         * malloc.
+         * If we haven't allocated any buffer yet, we need to ask the
+         * allocator for a fresh region.
          */
 
-        hwm->buf = malloc(size);
-        hwm->allocated_size = size;
+        size_t  new_size = grown_size(hwm, size);
+
+        hwm->buf = hwm_buffer_allocate(hwm, new_size);
+        if (hwm->buf == NULL)
+            return false;
+
+        hwm->allocated_size = hwm_buffer_usable_size(hwm, hwm->buf, new_size);
         hwm->allocation_count++;
+        hwm_buffer_advise(hwm, HWM_BUFFER_ADVISE_ALLOCATE_FLAGS);
 
     } else {
         /*
-         * Otherwise, we need to use realloc — but only if the
+         * Otherwise, we need to reallocate — but only if the
          * allocated_size isn't already big enough.
          */
 
         if (hwm->allocated_size < size)
         {
             /*
-             * realloc might change the hwm->buf pointer.  The current
-             * data lives in our memory region, then hwm->data will
-             * equal hwm->buf, and we'll have to update it as well.
+             * Reallocating might change the hwm->buf pointer.  If the
+             * current data lives in our memory region, then hwm->data
+             * will point into hwm->buf, and we'll have to update it as
+             * well.
              * If the current data is outside our memory region, we
-             * should *not* update hwm->data.
+             * should *not* update hwm->data.  If that fails, the
+             * old memory region is still valid, so we leave the
+             * buffer untouched.
              */
 
-            void  *old_buf = hwm->buf;
+            size_t  new_size = grown_size(hwm, size);
+            void  *new_buf = hwm_buffer_reallocate
+                (hwm, hwm->buf, hwm->allocated_size, new_size);
 
-            hwm->buf = realloc(hwm->buf, size);
-            hwm->allocated_size = size;
-            hwm->allocation_count++;
+            if (new_buf == NULL)
+                return false;
+
+            if (hwm_buffer_owns_data(hwm))
+                hwm->data = new_buf + hwm->consumed;
 
-            if (hwm->data == old_buf)
-                hwm->data = hwm->buf;
+            hwm->buf = new_buf;
+            hwm->allocated_size =
+                hwm_buffer_usable_size(hwm, new_buf, new_size);
+            hwm->allocation_count++;
+            hwm_buffer_advise(hwm, HWM_BUFFER_ADVISE_ALLOCATE_FLAGS);
         }
     }
 
     /*
-     * Return whether or not the allocation was successful.  (If we
-     * already had enough space, that counts as successful.)
+     * If we get here, the allocation was successful.  (If we already
+     * had enough space, that counts as successful.)
      */
 
-    return (hwm->buf != NULL);
+    return true;
+}
+
+
+bool
+hwm_buffer_trim(hwm_buffer_t *hwm, size_t keep)
+{
+    void  *new_buf;
+
+    if (hwm->buf == NULL)
+        return true;
+
+    /*
+     * Don't throw away the buffer's current contents.  Any space that
+     * they've consumed can go, though.
+     */
+
+    if (hwm_buffer_owns_data(hwm))
+    {
+        compact(hwm);
+
+        if (keep < hwm->current_size)
+            keep = hwm->current_size;
+    }
+
+    if (keep >= hwm->allocated_size)
+        return true;
+
+    /*
+     * If we don't need to keep anything, we can free the storage
+     * outright.
+     */
+
+    if (keep == 0)
+    {
+        hwm_buffer_deallocate(hwm, hwm->buf, hwm->allocated_size);
+
+        if (hwm->data == hwm->buf)
+            hwm->data = NULL;
+
+        hwm->buf = NULL;
+        hwm->allocated_size = 0;
+        return true;
+    }
+
+    new_buf = hwm_buffer_reallocate
+        (hwm, hwm->buf, hwm->allocated_size, keep);
+    if (new_buf == NULL)
+        return false;
+
+    if (hwm->data == hwm->buf)
+        hwm->data = new_buf;
+
+    hwm->buf = new_buf;
+    hwm->allocated_size = hwm_buffer_usable_size(hwm, new_buf, keep);
+    hwm->allocation_count++;
+    hwm_buffer_advise(hwm, HWM_BUFFER_ADVISE_ALLOCATE_FLAGS);
+    return true;
+}
+
+
+/**
+ * Update the buffer's decay state at the end of a clear cycle.
+ * Return the size that the storage should be trimmed to, or
+ * (size_t) -1 if it shouldn't be trimmed.
+ */
+
+static size_t
+decay_trim_size(hwm_buffer_t *hwm)
+{
+    size_t  used;
+    size_t  peak;
+
+    if (hwm->decay_cycles == 0 || hwm->buf == NULL)
+        return (size_t) -1;
+
+    /*
+     * If the buffer's contents weren't in its own storage, then this
+     * cycle didn't use any of it.
+     */
+
+    used = hwm_buffer_owns_data(hwm)?
+        hwm->consumed + hwm->current_size:
+        0;
+
+    if (used > hwm->allocated_size / HWM_BUFFER_DECAY_RATIO)
+    {
+        hwm->decay_count = 0;
+        hwm->decay_peak = 0;
+        return (size_t) -1;
+    }
+
+    if (used > hwm->decay_peak)
+        hwm->decay_peak = used;
+
+    if (++hwm->decay_count < hwm->decay_cycles)
+        return (size_t) -1;
+
+    peak = hwm->decay_peak;
+    hwm->decay_count = 0;
+    hwm->decay_peak = 0;
+    return peak;
 }
 
 
 bool
 hwm_buffer_clear(hwm_buffer_t *hwm)
 {
+    size_t  trim_size = decay_trim_size(hwm);
+
     /*
      * Reset the size counter to 0, and make sure that our data
      * pointer is pointing at the local buffer.
      */
 
+    _hwm_buffer_release_data(hwm);
     hwm->data = hwm->buf;
     hwm->current_size = 0;
 
+    /*
+     * If the buffer has been underused for long enough, give back the
+     * excess.  It's not an error if this fails; the buffer just keeps
+     * its larger allocation.
+     */
+
+    if (trim_size != (size_t) -1)
+        hwm_buffer_trim(hwm, trim_size);
+
+    /*
+     * The buffer's old contents are dead, so the allocator can
+     * reclaim the pages behind them, if we've been asked to.
+     */
+
+    hwm_buffer_advise(hwm, HWM_BUFFER_ADVISE_CLEAR_FLAGS);
+    return true;
+}
+
+
+/**
+ * Make sure the buffer has room for size bytes of new contents.  The
+ * current contents are about to be replaced, so any space that's been
+ * consumed can be reused straight away, without counting it against
+ * the new size or moving anything into it.  If we can't get the space,
+ * the buffer is left unchanged.
+ */
+
+static bool
+ensure_load_size(hwm_buffer_t *hwm, size_t size)
+{
+    size_t  consumed = hwm->consumed;
+
+    if (consumed == 0 || !hwm_buffer_owns_data(hwm))
+        return hwm_buffer_ensure_size(hwm, size);
+
+    hwm->consumed = 0;
+    hwm->data = hwm->buf;
+
+    if (!hwm_buffer_ensure_size(hwm, size))
+    {
+        /*
+         * A failed reallocation leaves the old storage in place, so
+         * the old contents are still where they were.
+         */
+
+        hwm->consumed = consumed;
+        hwm->data = hwm->buf + consumed;
+        return false;
+    }
+
     return true;
 }
 
@@ -88,7 +325,7 @@ hwm_buffer_load_mem(hwm_buffer_t *hwm, const void *src, size_t size)
      * error code if we can't.
      */
 
-    if (!hwm_buffer_ensure_size(hwm, size))
+    if (!ensure_load_size(hwm, size))
     {
         return false;
     }
@@ -98,8 +335,10 @@ hwm_buffer_load_mem(hwm_buffer_t *hwm, const void *src, size_t size)
      */
 
     memcpy(hwm->buf, src, size);
+    _hwm_buffer_release_data(hwm);
     hwm->data = hwm->buf;
     hwm->current_size = size;
+    hwm_buffer_update_hash(hwm);
     return true;
 }
 
@@ -107,6 +346,7 @@ hwm_buffer_load_mem(hwm_buffer_t *hwm, const void *src, size_t size)
 void
 hwm_buffer_point_at_mem(hwm_buffer_t *hwm, const void *src, size_t size)
 {
+    _hwm_buffer_release_data(hwm);
     hwm->data = src;
     hwm->current_size = size;
 }
@@ -129,7 +369,7 @@ hwm_buffer_load_str(hwm_buffer_t *hwm, const char *src)
      * if we can't.
      */
 
-    if (!hwm_buffer_ensure_size(hwm, size))
+    if (!ensure_load_size(hwm, size))
     {
         return false;
     }
@@ -141,8 +381,10 @@ hwm_buffer_load_str(hwm_buffer_t *hwm, const char *src)
      */
 
     memcpy(hwm->buf, src, size);
+    _hwm_buffer_release_data(hwm);
     hwm->data = hwm->buf;
     hwm->current_size = size;
+    hwm_buffer_update_hash(hwm);
     return true;
 }
 
@@ -150,6 +392,7 @@ hwm_buffer_load_str(hwm_buffer_t *hwm, const char *src)
 void
 hwm_buffer_point_at_str(hwm_buffer_t *hwm, const char *src)
 {
+    _hwm_buffer_release_data(hwm);
     hwm->data = src;
     hwm->current_size = strlen(src) + 1;
 }
@@ -158,5 +401,11 @@ hwm_buffer_point_at_str(hwm_buffer_t *hwm, const char *src)
 bool
 hwm_buffer_load_buf(hwm_buffer_t *hwm, const hwm_buffer_t *src)
 {
-    return hwm_buffer_load_mem(hwm, src->buf, src->current_size);
+    /*
+     * The source's contents might not be in its own storage (if it's
+     * pointing at some other memory region), so we have to copy from
+     * its data pointer.
+     */
+
+    return hwm_buffer_load_mem(hwm, src->data, src->current_size);
 }
@@ -0,0 +1,342 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2009, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * We need _GNU_SOURCE for mremap.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <hwm-buffer.h>
+#include <hwm-mmap.h>
+
+
+/**
+ * The size of a transparent huge page.  Mappings of at least this size
+ * are aligned to this boundary, so that the kernel can back them with
+ * huge pages.
+ */
+
+#define HUGE_PAGE_SIZE  ((size_t) 2 * 1024 * 1024)
+
+
+static const hwm_mmap_config_t  default_config =
+    HWM_MMAP_CONFIG_INIT(HWM_MMAP_DEFAULT_THRESHOLD, 0);
+
+
+static const hwm_mmap_config_t *
+get_config(void *ctx)
+{
+    return (ctx == NULL)? &default_config: (const hwm_mmap_config_t *) ctx;
+}
+
+
+static size_t
+page_size(void)
+{
+    static size_t  result = 0;
+
+    if (result == 0)
+    {
+        long  size = sysconf(_SC_PAGESIZE);
+        result = (size > 0)? (size_t) size: 4096;
+    }
+
+    return result;
+}
+
+
+/**
+ * Return whether an allocation of the given size lives in a memory
+ * mapping.  Since we don't record this anywhere, it's important that
+ * this depend only on the size, so that we come to the same
+ * conclusion when the allocation is later resized or freed.
+ */
+
+static bool
+is_mapped(const hwm_mmap_config_t *config, size_t size)
+{
+    return (size >= config->threshold);
+}
+
+
+/**
+ * Return the length of the memory mapping that holds an allocation of
+ * the given size.  This is also the allocation's usable size, so it
+ * must be the case that map_length(map_length(size)) ==
+ * map_length(size).
+ */
+
+static size_t
+map_length(const hwm_mmap_config_t *config, size_t size)
+{
+    size_t  mask = page_size() - 1;
+    size_t  length = (size < config->reserve)? config->reserve: size;
+
+    if (length > SIZE_MAX - mask)
+        return length;
+
+    return (length + mask) & ~mask;
+}
+
+
+static void *
+map_anonymous(size_t length)
+{
+    void  *result = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                         -1, 0);
+
+    return (result == MAP_FAILED)? NULL: result;
+}
+
+
+static bool
+is_huge_aligned(void *ptr)
+{
+    return ((uintptr_t) ptr % HUGE_PAGE_SIZE) == 0;
+}
+
+
+/**
+ * Map a new region of the given length.  Regions that are at least a
+ * huge page long are aligned to a huge page boundary; to do that, we
+ * map an extra huge page's worth of address space, and then unmap
+ * whatever's left over on either side of the aligned region.
+ */
+
+static void *
+map_region(size_t length)
+{
+    uint8_t  *raw;
+    uint8_t  *aligned;
+    size_t  raw_length;
+
+    if (length < HUGE_PAGE_SIZE || length > SIZE_MAX - HUGE_PAGE_SIZE)
+        return map_anonymous(length);
+
+    raw_length = length + HUGE_PAGE_SIZE;
+    raw = (uint8_t *) map_anonymous(raw_length);
+    if (raw == NULL)
+        return NULL;
+
+    aligned = (uint8_t *)
+        (((uintptr_t) raw + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+
+    if (aligned > raw)
+        munmap(raw, aligned - raw);
+
+    if (raw + raw_length > aligned + length)
+        munmap(aligned + length, (raw + raw_length) - (aligned + length));
+
+    return aligned;
+}
+
+
+static void *
+remap_region(void *ptr, size_t old_length, size_t new_length)
+{
+    void  *result;
+
+    if (old_length == new_length)
+        return ptr;
+
+#if defined(MREMAP_MAYMOVE)
+    result = mremap(ptr, old_length, new_length, MREMAP_MAYMOVE);
+    if (result == MAP_FAILED)
+        return NULL;
+
+#if defined(MREMAP_FIXED)
+    /*
+     * If the kernel moved a large region to an address that isn't
+     * aligned to a huge page, move it again to an aligned address.
+     * This only moves page table entries; nothing is copied.  If it
+     * fails, the misaligned region is still perfectly usable.
+     */
+
+    if (new_length >= HUGE_PAGE_SIZE && !is_huge_aligned(result))
+    {
+        void  *aligned = map_region(new_length);
+
+        if (aligned != NULL)
+        {
+            void  *moved = mremap(result, new_length, new_length,
+                                  MREMAP_MAYMOVE | MREMAP_FIXED, aligned);
+
+            if (moved == MAP_FAILED)
+                munmap(aligned, new_length);
+            else
+                result = moved;
+        }
+    }
+#endif
+
+    return result;
+#else
+    result = map_region(new_length);
+    if (result == NULL)
+        return NULL;
+
+    memcpy(result, ptr,
+           (old_length < new_length)? old_length: new_length);
+    munmap(ptr, old_length);
+    return result;
+#endif
+}
+
+
+static void *
+mmap_allocate(void *ctx, size_t size)
+{
+    const hwm_mmap_config_t  *config = get_config(ctx);
+
+    if (is_mapped(config, size))
+        return map_region(map_length(config, size));
+    else
+        return malloc(size);
+}
+
+
+static void *
+mmap_reallocate(void *ctx, void *ptr, size_t old_size, size_t new_size)
+{
+    const hwm_mmap_config_t  *config = get_config(ctx);
+    bool  old_mapped = is_mapped(config, old_size);
+    bool  new_mapped = is_mapped(config, new_size);
+    void  *result;
+
+    if (old_mapped && new_mapped)
+    {
+        return remap_region(ptr, map_length(config, old_size),
+                            map_length(config, new_size));
+    }
+
+    if (!old_mapped && !new_mapped)
+        return realloc(ptr, new_size);
+
+    /*
+     * If we get here, the allocation is crossing the threshold in one
+     * direction or the other, so we have to copy it.
+     */
+
+    result = mmap_allocate(ctx, new_size);
+    if (result == NULL)
+        return NULL;
+
+    memcpy(result, ptr, (old_size < new_size)? old_size: new_size);
+
+    if (old_mapped)
+        munmap(ptr, map_length(config, old_size));
+    else
+        free(ptr);
+
+    return result;
+}
+
+
+static void
+mmap_deallocate(void *ctx, void *ptr, size_t size)
+{
+    const hwm_mmap_config_t  *config = get_config(ctx);
+
+    if (is_mapped(config, size))
+        munmap(ptr, map_length(config, size));
+    else
+        free(ptr);
+}
+
+
+static size_t
+mmap_usable_size(void *ctx, void *ptr, size_t size)
+{
+    const hwm_mmap_config_t  *config = get_config(ctx);
+
+    /*
+     * The rest of a mapping's last page is ours to use.
+     */
+
+    if (is_mapped(config, size))
+        return map_length(config, size);
+    else
+        return size;
+}
+
+
+static void
+mmap_advise(void *ctx, void *ptr, size_t size, unsigned int flags)
+{
+    const hwm_mmap_config_t  *config = get_config(ctx);
+    size_t  length;
+
+    /*
+     * We can only give advice about memory mappings; malloc'ed memory
+     * isn't page-aligned, and might be shared with other allocations.
+     */
+
+    if (!is_mapped(config, size))
+        return;
+
+    length = map_length(config, size);
+
+#if defined(MADV_HUGEPAGE)
+    if (flags & HWM_BUFFER_ADVISE_HUGEPAGE)
+        madvise(ptr, length, MADV_HUGEPAGE);
+#endif
+
+    if (flags & HWM_BUFFER_ADVISE_SEQUENTIAL)
+        madvise(ptr, length, MADV_SEQUENTIAL);
+
+    if (flags & HWM_BUFFER_ADVISE_WILLNEED)
+        madvise(ptr, length, MADV_WILLNEED);
+
+    if (flags & HWM_BUFFER_ADVISE_DONTNEED_ON_CLEAR)
+    {
+        madvise(ptr, length, MADV_DONTNEED);
+    }
+    else if (flags & HWM_BUFFER_ADVISE_FREE_ON_CLEAR)
+    {
+        /*
+         * MADV_FREE is fairly new; if the kernel doesn't support it,
+         * we fall back on MADV_DONTNEED, which has the same effect,
+         * only sooner.
+         */
+
+#if defined(MADV_FREE)
+        if (madvise(ptr, length, MADV_FREE) != 0)
+            madvise(ptr, length, MADV_DONTNEED);
+#else
+        madvise(ptr, length, MADV_DONTNEED);
+#endif
+    }
+}
+
+
+const hwm_allocator_t  hwm_mmap_allocator =
+{
+    mmap_allocate,
+    mmap_reallocate,
+    mmap_deallocate,
+    mmap_usable_size,
+    mmap_advise
+};
+
+
+void
+hwm_buffer_init_with_mmap(hwm_buffer_t *hwm, hwm_mmap_config_t *config)
+{
+    hwm_buffer_init_with_allocator(hwm, &hwm_mmap_allocator, config);
+}
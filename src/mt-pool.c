@@ -0,0 +1,551 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2009, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <hwm-buffer.h>
+#include <hwm-pool.h>
+
+
+/**
+ * The size of a cache line.  Each per-thread cache gets its own cache
+ * lines, so that threads don't slow each other down by writing to
+ * nearby memory.
+ */
+
+#define CACHE_LINE_SIZE  64
+
+/**
+ * An index that doesn't refer to any slot.
+ */
+
+#define NO_SLOT  UINT32_MAX
+
+
+struct hwm_mt_pool_slot
+{
+    /**
+     * The buffer itself.  This must be the first field, so that we
+     * can get from the hwm_buffer_t that we hand out back to its
+     * slot.
+     */
+
+    hwm_buffer_t  buf;
+
+    /**
+     * One more than the index of the next slot on the shared free
+     * list, or 0 if this is the last one.
+     */
+
+    uint32_t  next;
+};
+
+
+struct hwm_mt_pool_cache
+{
+    /**
+     * The next cache in the pool's list of caches.
+     */
+
+    hwm_mt_pool_cache_t  *next;
+
+    /**
+     * The pool that this cache belongs to.
+     */
+
+    hwm_mt_pool_t  *pool;
+
+    /**
+     * Whether a thread currently owns this cache.
+     */
+
+    int  owned;
+
+    /**
+     * The number of slots in the cache.
+     */
+
+    uint32_t  count;
+
+    /**
+     * The hits and misses seen by the thread that owns this cache.
+     * Only the owning thread writes to these.
+     */
+
+    size_t  hits;
+    size_t  misses;
+
+    /**
+     * The indexes of the cached slots.
+     */
+
+    uint32_t  items[HWM_MT_POOL_CACHE_SIZE];
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+
+/*-----------------------------------------------------------------------
+ * Shared free list
+ */
+
+/**
+ * Push a chain of slots onto the shared free list.  The slots from
+ * first to last must already be linked together via their next
+ * fields.
+ */
+
+static void
+push_chain(hwm_mt_pool_t *pool, uint32_t first, uint32_t last)
+{
+    uint64_t  old_head;
+    uint64_t  new_head;
+
+    old_head = __atomic_load_n(&pool->free_head, __ATOMIC_RELAXED);
+    do
+    {
+        __atomic_store_n(&pool->slots[last].next,
+                         (uint32_t) old_head, __ATOMIC_RELAXED);
+        new_head = ((old_head >> 32) + 1) << 32 | (uint64_t) (first + 1);
+    } while (!__atomic_compare_exchange_n(&pool->free_head,
+                                          &old_head, new_head, true,
+                                          __ATOMIC_RELEASE,
+                                          __ATOMIC_RELAXED));
+}
+
+
+/**
+ * Pop a slot off of the shared free list, returning its index, or
+ * NO_SLOT if the list is empty.  The tag in the upper half of the
+ * list head is what makes this safe: if another thread pops our slot
+ * and pushes it back between our load and our compare-and-swap, the
+ * tag will have changed, and the compare-and-swap will fail.
+ */
+
+static uint32_t
+pop(hwm_mt_pool_t *pool)
+{
+    uint64_t  old_head;
+    uint64_t  new_head;
+    uint32_t  index;
+
+    old_head = __atomic_load_n(&pool->free_head, __ATOMIC_ACQUIRE);
+    do
+    {
+        if ((uint32_t) old_head == 0)
+            return NO_SLOT;
+
+        index = (uint32_t) old_head - 1;
+        new_head = ((old_head >> 32) + 1) << 32 |
+            __atomic_load_n(&pool->slots[index].next, __ATOMIC_RELAXED);
+    } while (!__atomic_compare_exchange_n(&pool->free_head,
+                                          &old_head, new_head, true,
+                                          __ATOMIC_ACQUIRE,
+                                          __ATOMIC_ACQUIRE));
+
+    return index;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Per-thread caches
+ */
+
+/**
+ * Move the last count slots in a cache onto the shared free list,
+ * using a single compare-and-swap.
+ */
+
+static void
+flush_cache(hwm_mt_pool_t *pool, hwm_mt_pool_cache_t *cache,
+            uint32_t count)
+{
+    uint32_t  first;
+    uint32_t  last;
+
+    if (count == 0)
+        return;
+
+    last = cache->items[cache->count - count];
+    first = cache->items[cache->count - 1];
+
+    /*
+     * Link the slots together, from the end of the cache backwards.
+     */
+
+    while (--count > 0)
+    {
+        uint32_t  index = cache->items[--cache->count];
+        __atomic_store_n(&pool->slots[index].next,
+                         cache->items[cache->count - 1] + 1,
+                         __ATOMIC_RELAXED);
+    }
+
+    cache->count--;
+    push_chain(pool, first, last);
+}
+
+
+/**
+ * Called when a thread exits, to give its cached slots back to the
+ * pool and make the cache available to another thread.
+ */
+
+static void
+release_cache(void *vcache)
+{
+    hwm_mt_pool_cache_t  *cache = (hwm_mt_pool_cache_t *) vcache;
+
+    flush_cache(cache->pool, cache, cache->count);
+    __atomic_store_n(&cache->owned, 0, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * Return the current thread's cache, claiming or creating one if
+ * needed.  Return NULL if we can't.
+ */
+
+static hwm_mt_pool_cache_t *
+get_cache(hwm_mt_pool_t *pool)
+{
+    hwm_mt_pool_cache_t  *cache;
+    void  *mem;
+
+    cache = (hwm_mt_pool_cache_t *) pthread_getspecific(pool->cache_key);
+    if (cache != NULL)
+        return cache;
+
+    /*
+     * First try to claim a cache that was left behind by a thread
+     * that has exited.  Caches are never removed from the list while
+     * the pool is alive, so it's safe to walk it without any locking.
+     */
+
+    for (cache = __atomic_load_n(&pool->caches, __ATOMIC_ACQUIRE);
+         cache != NULL; cache = cache->next)
+    {
+        int  expected = 0;
+
+        if (__atomic_load_n(&cache->owned, __ATOMIC_RELAXED) == 0 &&
+            __atomic_compare_exchange_n(&cache->owned, &expected, 1, false,
+                                        __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED))
+        {
+            break;
+        }
+    }
+
+    /*
+     * If there isn't one, create a new cache and add it to the list.
+     */
+
+    if (cache == NULL)
+    {
+        if (posix_memalign(&mem, CACHE_LINE_SIZE,
+                           sizeof(hwm_mt_pool_cache_t)) != 0)
+        {
+            return NULL;
+        }
+
+        cache = (hwm_mt_pool_cache_t *) mem;
+        cache->pool = pool;
+        cache->owned = 1;
+        cache->count = 0;
+        cache->hits = 0;
+        cache->misses = 0;
+
+        cache->next = __atomic_load_n(&pool->caches, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&pool->caches,
+                                            &cache->next, cache, true,
+                                            __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED))
+        {
+        }
+    }
+
+    if (pthread_setspecific(pool->cache_key, cache) != 0)
+    {
+        __atomic_store_n(&cache->owned, 0, __ATOMIC_RELEASE);
+        return NULL;
+    }
+
+    return cache;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Public interface
+ */
+
+bool
+hwm_mt_pool_init(hwm_mt_pool_t *pool, uint32_t capacity,
+                 size_t max_retained_size)
+{
+    uint32_t  i;
+
+    if (capacity == NO_SLOT)
+        capacity--;
+
+    pool->slots = NULL;
+    if (capacity > 0)
+    {
+        pool->slots = (hwm_mt_pool_slot_t *)
+            malloc(sizeof(hwm_mt_pool_slot_t) * capacity);
+        if (pool->slots == NULL)
+            return false;
+    }
+
+    if (pthread_key_create(&pool->cache_key, release_cache) != 0)
+    {
+        free(pool->slots);
+        return false;
+    }
+
+    /*
+     * Every slot starts out on the shared free list, in order.
+     */
+
+    for (i = 0; i < capacity; i++)
+    {
+        hwm_buffer_init(&pool->slots[i].buf);
+        pool->slots[i].next = (i + 1 < capacity)? i + 2: 0;
+    }
+
+    pool->capacity = capacity;
+    pool->free_head = (capacity > 0)? 1: 0;
+    pool->caches = NULL;
+    pool->max_retained_size = max_retained_size;
+    pool->hits = 0;
+    pool->misses = 0;
+    pool->growth = NULL;
+    return true;
+}
+
+
+void
+hwm_mt_pool_done(hwm_mt_pool_t *pool)
+{
+    hwm_mt_pool_cache_t  *cache;
+    uint32_t  i;
+
+    /*
+     * Deleting the key first ensures that release_cache won't be
+     * called for any of our caches after we free them.
+     */
+
+    pthread_key_delete(pool->cache_key);
+
+    cache = pool->caches;
+    while (cache != NULL)
+    {
+        hwm_mt_pool_cache_t  *next = cache->next;
+        free(cache);
+        cache = next;
+    }
+
+    for (i = 0; i < pool->capacity; i++)
+        hwm_buffer_done(&pool->slots[i].buf);
+
+    free(pool->slots);
+    pool->slots = NULL;
+    pool->capacity = 0;
+    pool->free_head = 0;
+    pool->caches = NULL;
+}
+
+
+void
+hwm_mt_pool_set_growth(hwm_mt_pool_t *pool,
+                       const hwm_growth_policy_t *policy)
+{
+    uint32_t  i;
+
+    pool->growth = policy;
+    for (i = 0; i < pool->capacity; i++)
+        hwm_buffer_set_growth(&pool->slots[i].buf, policy);
+}
+
+
+/**
+ * Record a hit or miss, in the thread's cache if it has one.
+ */
+
+static void
+count_result(hwm_mt_pool_t *pool, hwm_mt_pool_cache_t *cache, bool hit)
+{
+    if (cache != NULL)
+    {
+        size_t  *counter = hit? &cache->hits: &cache->misses;
+        __atomic_store_n(counter, *counter + 1, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_add(hit? &pool->hits: &pool->misses,
+                           1, __ATOMIC_RELAXED);
+    }
+}
+
+
+hwm_buffer_t *
+hwm_mt_pool_acquire(hwm_mt_pool_t *pool, size_t min_size)
+{
+    hwm_mt_pool_cache_t  *cache = get_cache(pool);
+    uint32_t  index;
+    hwm_buffer_t  *hwm;
+
+    /*
+     * The fast path takes a slot from this thread's cache without
+     * touching any shared state.  If the cache is empty, we fall back
+     * on the shared free list.
+     */
+
+    if (cache != NULL && cache->count > 0)
+        index = cache->items[--cache->count];
+    else
+        index = pop(pool);
+
+    if (index == NO_SLOT)
+    {
+        /*
+         * The pool is exhausted, so hand out a buffer of our own.
+         */
+
+        hwm = hwm_buffer_new();
+        if (hwm == NULL)
+            return NULL;
+
+        hwm_buffer_set_growth(hwm, pool->growth);
+        count_result(pool, cache, false);
+
+        if (min_size > 0 && !hwm_buffer_ensure_size(hwm, min_size))
+        {
+            hwm_buffer_free(hwm);
+            return NULL;
+        }
+
+        return hwm;
+    }
+
+    hwm = &pool->slots[index].buf;
+
+    if (hwm->buf != NULL && hwm->allocated_size >= min_size)
+    {
+        count_result(pool, cache, true);
+        return hwm;
+    }
+
+    count_result(pool, cache, false);
+
+    if (min_size > 0 && !hwm_buffer_ensure_size(hwm, min_size))
+    {
+        hwm_mt_pool_release(pool, hwm);
+        return NULL;
+    }
+
+    return hwm;
+}
+
+
+void
+hwm_mt_pool_release(hwm_mt_pool_t *pool, hwm_buffer_t *hwm)
+{
+    uintptr_t  addr = (uintptr_t) hwm;
+    uintptr_t  start = (uintptr_t) pool->slots;
+    hwm_mt_pool_cache_t  *cache;
+    uint32_t  index;
+
+    /*
+     * Undo any settings that the last user made before clearing, so
+     * that their decay and advice don't affect the allocation that
+     * we're about to retain.
+     */
+
+    hwm_buffer_set_growth(hwm, pool->growth);
+    hwm_buffer_disable_hash(hwm);
+    hwm_buffer_set_advice(hwm, 0);
+    hwm_buffer_set_decay(hwm, 0);
+    hwm_buffer_clear(hwm);
+
+    /*
+     * Buffers that we handed out because the pool was exhausted
+     * aren't in the slot array; we just free them.
+     */
+
+    if (pool->capacity == 0 || addr < start ||
+        addr >= start + sizeof(hwm_mt_pool_slot_t) * pool->capacity)
+    {
+        hwm_buffer_free(hwm);
+        return;
+    }
+
+    index = (addr - start) / sizeof(hwm_mt_pool_slot_t);
+
+    if (pool->max_retained_size > 0 && hwm->buf != NULL &&
+        hwm->allocated_size > pool->max_retained_size)
+    {
+        hwm_buffer_done(hwm);
+    }
+
+    /*
+     * The fast path puts the slot into this thread's cache.  If the
+     * cache is full, we move half of it to the shared free list
+     * first, so that the next few releases are fast, too.
+     */
+
+    cache = get_cache(pool);
+    if (cache == NULL)
+    {
+        push_chain(pool, index, index);
+        return;
+    }
+
+    if (cache->count == HWM_MT_POOL_CACHE_SIZE)
+        flush_cache(pool, cache, HWM_MT_POOL_CACHE_SIZE / 2);
+
+    cache->items[cache->count++] = index;
+}
+
+
+/**
+ * Add up one of the counters across all of a pool's caches.
+ */
+
+static size_t
+sum_counters(hwm_mt_pool_t *pool, bool hits)
+{
+    hwm_mt_pool_cache_t  *cache;
+    size_t  result;
+
+    result = __atomic_load_n(hits? &pool->hits: &pool->misses,
+                             __ATOMIC_RELAXED);
+
+    for (cache = __atomic_load_n(&pool->caches, __ATOMIC_ACQUIRE);
+         cache != NULL; cache = cache->next)
+    {
+        result += __atomic_load_n(hits? &cache->hits: &cache->misses,
+                                  __ATOMIC_RELAXED);
+    }
+
+    return result;
+}
+
+
+size_t
+hwm_mt_pool_hits(hwm_mt_pool_t *pool)
+{
+    return sum_counters(pool, true);
+}
+
+
+size_t
+hwm_mt_pool_misses(hwm_mt_pool_t *pool)
+{
+    return sum_counters(pool, false);
+}
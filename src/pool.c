@@ -0,0 +1,230 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2009, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdlib.h>
+
+#include <hwm-buffer.h>
+#include <hwm-pool.h>
+
+
+struct hwm_pool_entry
+{
+    /**
+     * The buffer itself.  This must be the first field, so that we
+     * can get from the hwm_buffer_t that we hand out back to its
+     * entry.
+     */
+
+    hwm_buffer_t  buf;
+
+    /**
+     * The next entry in the same bin.
+     */
+
+    hwm_pool_entry_t  *next;
+};
+
+
+/**
+ * Return the index of the highest set bit in size, which must be
+ * nonzero.
+ */
+
+static unsigned int
+floor_log2(size_t size)
+{
+    unsigned int  result = 0;
+
+    while (size >>= 1)
+        result++;
+
+    return result;
+}
+
+
+void
+hwm_pool_init(hwm_pool_t *pool, size_t max_buffers, size_t max_bytes)
+{
+    unsigned int  i;
+
+    for (i = 0; i < HWM_POOL_BIN_COUNT; i++)
+        pool->bins[i] = NULL;
+
+    pool->max_buffers = max_buffers;
+    pool->max_bytes = max_bytes;
+    pool->retained_buffers = 0;
+    pool->retained_bytes = 0;
+    pool->hits = 0;
+    pool->misses = 0;
+    pool->growth = NULL;
+}
+
+
+static void
+free_entry(hwm_pool_entry_t *entry)
+{
+    hwm_buffer_done(&entry->buf);
+    free(entry);
+}
+
+
+void
+hwm_pool_done(hwm_pool_t *pool)
+{
+    unsigned int  i;
+
+    for (i = 0; i < HWM_POOL_BIN_COUNT; i++)
+    {
+        hwm_pool_entry_t  *entry = pool->bins[i];
+
+        while (entry != NULL)
+        {
+            hwm_pool_entry_t  *next = entry->next;
+            free_entry(entry);
+            entry = next;
+        }
+
+        pool->bins[i] = NULL;
+    }
+
+    pool->retained_buffers = 0;
+    pool->retained_bytes = 0;
+}
+
+
+void
+hwm_pool_set_growth(hwm_pool_t *pool, const hwm_growth_policy_t *policy)
+{
+    pool->growth = policy;
+}
+
+
+/**
+ * Remove and return the entry that link points at.  link is either a
+ * bin's head pointer, or the next pointer of the previous entry in
+ * the bin.
+ */
+
+static hwm_pool_entry_t *
+take_entry(hwm_pool_t *pool, hwm_pool_entry_t **link)
+{
+    hwm_pool_entry_t  *entry = *link;
+
+    *link = entry->next;
+    pool->retained_buffers--;
+    pool->retained_bytes -= entry->buf.allocated_size;
+    return entry;
+}
+
+
+hwm_buffer_t *
+hwm_pool_acquire(hwm_pool_t *pool, size_t min_size)
+{
+    hwm_pool_entry_t  *entry = NULL;
+    hwm_pool_entry_t  **link;
+    unsigned int  bin;
+
+    /*
+     * The bin containing min_size might have buffers that are large
+     * enough, but isn't guaranteed to, so we have to look through it
+     * for one.  Every bin after that one only contains buffers that
+     * are large enough, so we take the first buffer from the smallest
+     * nonempty one.
+     */
+
+    bin = (min_size == 0)? 0: floor_log2(min_size);
+
+    for (link = &pool->bins[bin]; *link != NULL; link = &(*link)->next)
+    {
+        if ((*link)->buf.allocated_size >= min_size)
+        {
+            entry = take_entry(pool, link);
+            break;
+        }
+    }
+
+    for (bin++; entry == NULL && bin < HWM_POOL_BIN_COUNT; bin++)
+    {
+        if (pool->bins[bin] != NULL)
+            entry = take_entry(pool, &pool->bins[bin]);
+    }
+
+    if (entry != NULL)
+    {
+        pool->hits++;
+        return &entry->buf;
+    }
+
+    /*
+     * If we get here, there's no retained buffer that's large enough,
+     * so we have to create a new one.
+     */
+
+    pool->misses++;
+
+    entry = (hwm_pool_entry_t *) malloc(sizeof(hwm_pool_entry_t));
+    if (entry == NULL)
+        return NULL;
+
+    hwm_buffer_init_with_growth(&entry->buf, pool->growth);
+    entry->next = NULL;
+
+    if (min_size > 0 && !hwm_buffer_ensure_size(&entry->buf, min_size))
+    {
+        free_entry(entry);
+        return NULL;
+    }
+
+    return &entry->buf;
+}
+
+
+void
+hwm_pool_release(hwm_pool_t *pool, hwm_buffer_t *hwm)
+{
+    hwm_pool_entry_t  *entry = (hwm_pool_entry_t *) hwm;
+    size_t  allocated_size;
+    unsigned int  bin;
+
+    /*
+     * Undo any settings that the last user made before clearing, so
+     * that their decay and advice don't affect the allocation that
+     * we're about to retain.
+     */
+
+    hwm_buffer_set_growth(hwm, pool->growth);
+    hwm_buffer_disable_hash(hwm);
+    hwm_buffer_set_advice(hwm, 0);
+    hwm_buffer_set_decay(hwm, 0);
+    hwm_buffer_clear(hwm);
+
+    /*
+     * There's no point in retaining a buffer that doesn't have any
+     * storage, or one that would put us over our limits.
+     */
+
+    allocated_size = (hwm->buf == NULL)? 0: hwm->allocated_size;
+
+    if (allocated_size == 0 ||
+        (pool->max_buffers > 0 &&
+         pool->retained_buffers >= pool->max_buffers) ||
+        (pool->max_bytes > 0 &&
+         allocated_size > pool->max_bytes - pool->retained_bytes))
+    {
+        free_entry(entry);
+        return;
+    }
+
+    bin = floor_log2(allocated_size);
+    entry->next = pool->bins[bin];
+    pool->bins[bin] = entry;
+    pool->retained_buffers++;
+    pool->retained_bytes += allocated_size;
+}
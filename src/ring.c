@@ -0,0 +1,282 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2009, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * We need _GNU_SOURCE for memfd_create.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <hwm-buffer.h>
+#include <hwm-ring.h>
+
+
+static size_t
+page_size(void)
+{
+    static size_t  result = 0;
+
+    if (result == 0)
+    {
+        long  size = sysconf(_SC_PAGESIZE);
+        result = (size > 0)? (size_t) size: 4096;
+    }
+
+    return result;
+}
+
+
+#if defined(MFD_CLOEXEC)
+
+/**
+ * Map the first capacity bytes of a shared memory object twice, back
+ * to back.  Return NULL, with errno set, if we can't.
+ */
+
+static void *
+map_halves(int fd, size_t capacity)
+{
+    void  *base;
+
+    /*
+     * Reserve enough address space for both copies first, so that
+     * nothing else can end up between them, and then map the object
+     * over each half.
+     */
+
+    base = mmap(NULL, 2 * capacity, PROT_NONE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    if (mmap(base, capacity, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+        mmap(base + capacity, capacity, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        int  saved_errno = errno;
+        munmap(base, 2 * capacity);
+        errno = saved_errno;
+        return NULL;
+    }
+
+    return base;
+}
+
+#endif
+
+
+/**
+ * Create a double mapping of a new shared memory object that's
+ * capacity bytes long, which must be a multiple of the page size.
+ * Return NULL, with errno set, if we can't.
+ */
+
+static void *
+map_ring(size_t capacity)
+{
+#if defined(MFD_CLOEXEC)
+    int  fd;
+    void  *base;
+    int  saved_errno;
+
+    if (capacity > SIZE_MAX / 2)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    fd = memfd_create("hwm-ring", MFD_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    base = (ftruncate(fd, capacity) == 0)? map_halves(fd, capacity): NULL;
+
+    /*
+     * The mappings keep the memory object alive, so we don't need the
+     * descriptor anymore.
+     */
+
+    saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return base;
+#else
+    errno = ENOSYS;
+    return NULL;
+#endif
+}
+
+
+bool
+hwm_ring_init(hwm_ring_t *ring, size_t capacity)
+{
+    ring->base = NULL;
+    ring->capacity = 0;
+    ring->head = 0;
+    ring->current_size = 0;
+
+    if (capacity == 0)
+        return true;
+
+    return hwm_ring_resize(ring, capacity);
+}
+
+
+void
+hwm_ring_done(hwm_ring_t *ring)
+{
+    if (ring->base != NULL)
+        munmap(ring->base, 2 * ring->capacity);
+
+    ring->base = NULL;
+    ring->capacity = 0;
+    ring->head = 0;
+    ring->current_size = 0;
+}
+
+
+void
+hwm_ring_clear(hwm_ring_t *ring)
+{
+    ring->head = 0;
+    ring->current_size = 0;
+}
+
+
+bool
+hwm_ring_resize(hwm_ring_t *ring, size_t capacity)
+{
+    size_t  page = page_size();
+    void  *new_base;
+
+    if (capacity <= ring->capacity)
+        return true;
+
+    if (capacity > SIZE_MAX - (page - 1))
+    {
+        errno = ENOMEM;
+        return false;
+    }
+
+    capacity = (capacity + page - 1) & ~(page - 1);
+
+    new_base = map_ring(capacity);
+    if (new_base == NULL)
+        return false;
+
+    /*
+     * The old contents are contiguous, even if they wrap around, so
+     * they can be copied over in one go.
+     */
+
+    if (ring->current_size > 0)
+        memcpy(new_base, ring->base + ring->head, ring->current_size);
+
+    if (ring->base != NULL)
+        munmap(ring->base, 2 * ring->capacity);
+
+    ring->base = new_base;
+    ring->capacity = capacity;
+    ring->head = 0;
+    return true;
+}
+
+
+void *
+hwm_ring_reserve(hwm_ring_t *ring, size_t size)
+{
+    if (ring->base == NULL || size > hwm_ring_available(ring))
+    {
+        size_t  needed = ring->current_size + size;
+        size_t  doubled = (ring->capacity > SIZE_MAX / 2)?
+            SIZE_MAX:
+            2 * ring->capacity;
+
+        if (size > SIZE_MAX - ring->current_size)
+        {
+            errno = ENOMEM;
+            return NULL;
+        }
+
+        /*
+         * Even an empty reservation needs some storage to point into.
+         */
+
+        if (doubled > needed)
+            needed = doubled;
+        if (needed == 0)
+            needed = 1;
+
+        if (!hwm_ring_resize(ring, needed))
+            return NULL;
+    }
+
+    return ring->base + ring->head + ring->current_size;
+}
+
+
+void
+hwm_ring_commit(hwm_ring_t *ring, size_t size)
+{
+    ring->current_size += size;
+}
+
+
+void
+hwm_ring_consume(hwm_ring_t *ring, size_t size)
+{
+    if (size >= ring->current_size)
+    {
+        /*
+         * Starting over from the beginning of the storage keeps the
+         * ring's accesses on the same pages where possible.
+         */
+
+        hwm_ring_clear(ring);
+        return;
+    }
+
+    ring->head += size;
+    if (ring->head >= ring->capacity)
+        ring->head -= ring->capacity;
+
+    ring->current_size -= size;
+}
+
+
+bool
+hwm_ring_append_mem(hwm_ring_t *ring, const void *src, size_t size)
+{
+    void  *dest = hwm_ring_reserve(ring, size);
+
+    if (dest == NULL)
+        return false;
+
+    memcpy(dest, src, size);
+    hwm_ring_commit(ring, size);
+    return true;
+}
+
+
+void
+hwm_ring_view(const hwm_ring_t *ring, hwm_buffer_t *view)
+{
+    hwm_buffer_point_at_mem(view, hwm_ring_mem(ring, void),
+                            ring->current_size);
+}
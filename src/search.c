@@ -0,0 +1,674 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2009, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <hwm-buffer.h>
+
+#include "hwm-private.h"
+
+#if defined(HWM_X86_SIMD)
+#include <immintrin.h>
+#endif
+
+
+/*
+ * Each search has a scalar implementation, and SSE2 and AVX2 kernels.
+ * The kernels scan whole registers' worth of data, and hand whatever's
+ * left at the end to the scalar code.  SSE2 is part of SSE4, so the
+ * SSE2 kernels are used at the HWM_SIMD_SSE4 level.
+ */
+
+
+/**
+ * The most bytes that hwm_buffer_find_any() searches for with vector
+ * instructions.  Larger sets use a bitmap instead.
+ */
+
+#define MAX_VECTOR_SET_SIZE  16
+
+
+/**
+ * Add an offset to a search result, unless it's HWM_BUFFER_NOT_FOUND.
+ */
+
+static size_t
+offset_result(size_t offset, size_t result)
+{
+    return (result == HWM_BUFFER_NOT_FOUND)?
+        HWM_BUFFER_NOT_FOUND:
+        offset + result;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Scalar searches
+ */
+
+static size_t
+find_byte_scalar(const uint8_t *data, size_t size, uint8_t byte)
+{
+    const uint8_t  *found = memchr(data, byte, size);
+    return (found == NULL)? HWM_BUFFER_NOT_FOUND: (size_t) (found - data);
+}
+
+
+static size_t
+find_any_scalar(const uint8_t *data, size_t size,
+                const uint8_t *set, size_t set_size)
+{
+    uint32_t  bitmap[256 / 32];
+    size_t  i;
+
+    memset(bitmap, 0, sizeof(bitmap));
+    for (i = 0; i < set_size; i++)
+        bitmap[set[i] / 32] |= UINT32_C(1) << (set[i] % 32);
+
+    for (i = 0; i < size; i++)
+    {
+        if ((bitmap[data[i] / 32] & (UINT32_C(1) << (data[i] % 32))) != 0)
+            return i;
+    }
+
+    return HWM_BUFFER_NOT_FOUND;
+}
+
+
+/**
+ * Find a needle of at least one byte by looking for its first byte,
+ * and then checking the rest.
+ */
+
+static size_t
+find_mem_scalar(const uint8_t *data, size_t size,
+                const uint8_t *needle, size_t needle_size)
+{
+    size_t  i = 0;
+
+    while (size - i >= needle_size)
+    {
+        size_t  found = find_byte_scalar
+            (data + i, size - i - needle_size + 1, needle[0]);
+
+        if (found == HWM_BUFFER_NOT_FOUND)
+            return HWM_BUFFER_NOT_FOUND;
+
+        i += found;
+        if (memcmp(data + i + 1, needle + 1, needle_size - 1) == 0)
+            return i;
+
+        i++;
+    }
+
+    return HWM_BUFFER_NOT_FOUND;
+}
+
+
+static size_t
+count_byte_scalar(const uint8_t *data, size_t size, uint8_t byte)
+{
+    size_t  count = 0;
+    size_t  i;
+
+    for (i = 0; i < size; i++)
+        count += (data[i] == byte);
+
+    return count;
+}
+
+
+/**
+ * Return a bitmask of the positions of byte in up to 64 bytes of
+ * data.
+ */
+
+static uint64_t
+byte_mask_scalar(const uint8_t *data, size_t size, uint8_t byte)
+{
+    uint64_t  mask = 0;
+    size_t  i;
+
+    for (i = 0; i < size; i++)
+        mask |= (uint64_t) (data[i] == byte) << i;
+
+    return mask;
+}
+
+
+/*-----------------------------------------------------------------------
+ * SSE2 kernels
+ */
+
+#if defined(HWM_X86_SIMD)
+
+HWM_TARGET_SSE4
+static size_t
+find_byte_sse2(const uint8_t *data, size_t size, uint8_t byte)
+{
+    const __m128i  needle = _mm_set1_epi8((char) byte);
+    size_t  i;
+
+    for (i = 0; i + 16 <= size; i += 16)
+    {
+        __m128i  chunk = _mm_loadu_si128((const __m128i *) (data + i));
+        int  mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+
+    return offset_result(i, find_byte_scalar(data + i, size - i, byte));
+}
+
+
+HWM_TARGET_SSE4
+static size_t
+find_any_sse2(const uint8_t *data, size_t size,
+              const uint8_t *set, size_t set_size)
+{
+    __m128i  needles[MAX_VECTOR_SET_SIZE];
+    size_t  i;
+    size_t  j;
+
+    for (j = 0; j < set_size; j++)
+        needles[j] = _mm_set1_epi8((char) set[j]);
+
+    for (i = 0; i + 16 <= size; i += 16)
+    {
+        __m128i  chunk = _mm_loadu_si128((const __m128i *) (data + i));
+        __m128i  matches = _mm_setzero_si128();
+        int  mask;
+
+        for (j = 0; j < set_size; j++)
+        {
+            matches = _mm_or_si128
+                (matches, _mm_cmpeq_epi8(chunk, needles[j]));
+        }
+
+        mask = _mm_movemask_epi8(matches);
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+
+    return offset_result
+        (i, find_any_scalar(data + i, size - i, set, set_size));
+}
+
+
+/**
+ * Look for positions where both the first and the last byte of the
+ * needle match, and only compare the rest of the needle at those.
+ * This is Wojciech Muła's “generic SIMD” substring search.
+ */
+
+HWM_TARGET_SSE4
+static size_t
+find_mem_sse2(const uint8_t *data, size_t size,
+              const uint8_t *needle, size_t needle_size)
+{
+    const __m128i  first = _mm_set1_epi8((char) needle[0]);
+    const __m128i  last = _mm_set1_epi8((char) needle[needle_size - 1]);
+    size_t  i;
+
+    for (i = 0; size - i >= needle_size - 1 + 16; i += 16)
+    {
+        __m128i  starts = _mm_loadu_si128((const __m128i *) (data + i));
+        __m128i  ends = _mm_loadu_si128
+            ((const __m128i *) (data + i + needle_size - 1));
+        int  mask = _mm_movemask_epi8
+            (_mm_and_si128(_mm_cmpeq_epi8(starts, first),
+                           _mm_cmpeq_epi8(ends, last)));
+
+        while (mask != 0)
+        {
+            size_t  candidate = i + __builtin_ctz(mask);
+
+            if (memcmp(data + candidate + 1, needle + 1,
+                       needle_size - 1) == 0)
+            {
+                return candidate;
+            }
+
+            mask &= mask - 1;
+        }
+    }
+
+    return offset_result
+        (i, find_mem_scalar(data + i, size - i, needle, needle_size));
+}
+
+
+HWM_TARGET_SSE4
+static size_t
+count_byte_sse2(const uint8_t *data, size_t size, uint8_t byte)
+{
+    const __m128i  needle = _mm_set1_epi8((char) byte);
+    size_t  count = 0;
+    size_t  i = 0;
+
+    while (size - i >= 16)
+    {
+        /*
+         * Each match subtracts -1 from its byte of the counter, which
+         * can take at most 255 matches before it overflows.  Then the
+         * bytes are summed up and added to the total.
+         */
+
+        __m128i  counts = _mm_setzero_si128();
+        size_t  rounds = 0;
+
+        for (; size - i >= 16 && rounds < 255; i += 16, rounds++)
+        {
+            __m128i  chunk = _mm_loadu_si128((const __m128i *) (data + i));
+            counts = _mm_sub_epi8(counts, _mm_cmpeq_epi8(chunk, needle));
+        }
+
+        counts = _mm_sad_epu8(counts, _mm_setzero_si128());
+        count += _mm_cvtsi128_si32(counts) +
+            _mm_cvtsi128_si32(_mm_srli_si128(counts, 8));
+    }
+
+    return count + count_byte_scalar(data + i, size - i, byte);
+}
+
+
+/**
+ * Return a bitmask of the positions of byte in exactly 64 bytes of
+ * data.
+ */
+
+HWM_TARGET_SSE4
+static uint64_t
+byte_mask_sse2(const uint8_t *data, uint8_t byte)
+{
+    const __m128i  needle = _mm_set1_epi8((char) byte);
+    uint64_t  mask = 0;
+    size_t  i;
+
+    for (i = 0; i < 64; i += 16)
+    {
+        __m128i  chunk = _mm_loadu_si128((const __m128i *) (data + i));
+        mask |= (uint64_t) (unsigned int) _mm_movemask_epi8
+            (_mm_cmpeq_epi8(chunk, needle)) << i;
+    }
+
+    return mask;
+}
+
+
+/*-----------------------------------------------------------------------
+ * AVX2 kernels
+ */
+
+HWM_TARGET_AVX2
+static size_t
+find_byte_avx2(const uint8_t *data, size_t size, uint8_t byte)
+{
+    const __m256i  needle = _mm256_set1_epi8((char) byte);
+    size_t  i;
+
+    for (i = 0; i + 32 <= size; i += 32)
+    {
+        __m256i  chunk = _mm256_loadu_si256((const __m256i *) (data + i));
+        unsigned int  mask = (unsigned int) _mm256_movemask_epi8
+            (_mm256_cmpeq_epi8(chunk, needle));
+
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+
+    return offset_result(i, find_byte_sse2(data + i, size - i, byte));
+}
+
+
+HWM_TARGET_AVX2
+static size_t
+find_any_avx2(const uint8_t *data, size_t size,
+              const uint8_t *set, size_t set_size)
+{
+    __m256i  needles[MAX_VECTOR_SET_SIZE];
+    size_t  i;
+    size_t  j;
+
+    for (j = 0; j < set_size; j++)
+        needles[j] = _mm256_set1_epi8((char) set[j]);
+
+    for (i = 0; i + 32 <= size; i += 32)
+    {
+        __m256i  chunk = _mm256_loadu_si256((const __m256i *) (data + i));
+        __m256i  matches = _mm256_setzero_si256();
+        unsigned int  mask;
+
+        for (j = 0; j < set_size; j++)
+        {
+            matches = _mm256_or_si256
+                (matches, _mm256_cmpeq_epi8(chunk, needles[j]));
+        }
+
+        mask = (unsigned int) _mm256_movemask_epi8(matches);
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+
+    return offset_result
+        (i, find_any_scalar(data + i, size - i, set, set_size));
+}
+
+
+HWM_TARGET_AVX2
+static size_t
+find_mem_avx2(const uint8_t *data, size_t size,
+              const uint8_t *needle, size_t needle_size)
+{
+    const __m256i  first = _mm256_set1_epi8((char) needle[0]);
+    const __m256i  last = _mm256_set1_epi8((char) needle[needle_size - 1]);
+    size_t  i;
+
+    for (i = 0; size - i >= needle_size - 1 + 32; i += 32)
+    {
+        __m256i  starts = _mm256_loadu_si256((const __m256i *) (data + i));
+        __m256i  ends = _mm256_loadu_si256
+            ((const __m256i *) (data + i + needle_size - 1));
+        unsigned int  mask = (unsigned int) _mm256_movemask_epi8
+            (_mm256_and_si256(_mm256_cmpeq_epi8(starts, first),
+                              _mm256_cmpeq_epi8(ends, last)));
+
+        while (mask != 0)
+        {
+            size_t  candidate = i + __builtin_ctz(mask);
+
+            if (memcmp(data + candidate + 1, needle + 1,
+                       needle_size - 1) == 0)
+            {
+                return candidate;
+            }
+
+            mask &= mask - 1;
+        }
+    }
+
+    return offset_result
+        (i, find_mem_scalar(data + i, size - i, needle, needle_size));
+}
+
+
+HWM_TARGET_AVX2
+static size_t
+count_byte_avx2(const uint8_t *data, size_t size, uint8_t byte)
+{
+    const __m256i  needle = _mm256_set1_epi8((char) byte);
+    size_t  count = 0;
+    size_t  i = 0;
+
+    while (size - i >= 32)
+    {
+        __m256i  counts = _mm256_setzero_si256();
+        size_t  rounds = 0;
+
+        for (; size - i >= 32 && rounds < 255; i += 32, rounds++)
+        {
+            __m256i  chunk =
+                _mm256_loadu_si256((const __m256i *) (data + i));
+            counts = _mm256_sub_epi8
+                (counts, _mm256_cmpeq_epi8(chunk, needle));
+        }
+
+        counts = _mm256_sad_epu8(counts, _mm256_setzero_si256());
+        count += _mm256_extract_epi64(counts, 0) +
+            _mm256_extract_epi64(counts, 1) +
+            _mm256_extract_epi64(counts, 2) +
+            _mm256_extract_epi64(counts, 3);
+    }
+
+    return count + count_byte_scalar(data + i, size - i, byte);
+}
+
+
+HWM_TARGET_AVX2
+static uint64_t
+byte_mask_avx2(const uint8_t *data, uint8_t byte)
+{
+    const __m256i  needle = _mm256_set1_epi8((char) byte);
+    __m256i  low = _mm256_loadu_si256((const __m256i *) data);
+    __m256i  high = _mm256_loadu_si256((const __m256i *) (data + 32));
+
+    return (uint64_t) (unsigned int) _mm256_movemask_epi8
+        (_mm256_cmpeq_epi8(low, needle)) |
+        (uint64_t) (unsigned int) _mm256_movemask_epi8
+        (_mm256_cmpeq_epi8(high, needle)) << 32;
+}
+
+#endif
+
+
+/*-----------------------------------------------------------------------
+ * Dispatch
+ */
+
+static size_t
+find_byte(const uint8_t *data, size_t size, uint8_t byte)
+{
+#if defined(HWM_X86_SIMD)
+    int  level = hwm_simd_level();
+
+    if (level >= HWM_SIMD_AVX2)
+        return find_byte_avx2(data, size, byte);
+    if (level >= HWM_SIMD_SSE4)
+        return find_byte_sse2(data, size, byte);
+#endif
+
+    return find_byte_scalar(data, size, byte);
+}
+
+
+static size_t
+find_any(const uint8_t *data, size_t size,
+         const uint8_t *set, size_t set_size)
+{
+#if defined(HWM_X86_SIMD)
+    int  level = hwm_simd_level();
+
+    if (set_size <= MAX_VECTOR_SET_SIZE)
+    {
+        if (level >= HWM_SIMD_AVX2)
+            return find_any_avx2(data, size, set, set_size);
+        if (level >= HWM_SIMD_SSE4)
+            return find_any_sse2(data, size, set, set_size);
+    }
+#endif
+
+    return find_any_scalar(data, size, set, set_size);
+}
+
+
+static size_t
+find_mem(const uint8_t *data, size_t size,
+         const uint8_t *needle, size_t needle_size)
+{
+#if defined(HWM_X86_SIMD)
+    int  level = hwm_simd_level();
+
+    if (level >= HWM_SIMD_AVX2)
+        return find_mem_avx2(data, size, needle, needle_size);
+    if (level >= HWM_SIMD_SSE4)
+        return find_mem_sse2(data, size, needle, needle_size);
+#endif
+
+    return find_mem_scalar(data, size, needle, needle_size);
+}
+
+
+static uint64_t
+byte_mask(const uint8_t *data, size_t size, uint8_t byte)
+{
+#if defined(HWM_X86_SIMD)
+    if (size == 64)
+    {
+        int  level = hwm_simd_level();
+
+        if (level >= HWM_SIMD_AVX2)
+            return byte_mask_avx2(data, byte);
+        if (level >= HWM_SIMD_SSE4)
+            return byte_mask_sse2(data, byte);
+    }
+#endif
+
+    return byte_mask_scalar(data, size, byte);
+}
+
+
+static size_t
+count_byte(const uint8_t *data, size_t size, uint8_t byte)
+{
+#if defined(HWM_X86_SIMD)
+    int  level = hwm_simd_level();
+
+    if (level >= HWM_SIMD_AVX2)
+        return count_byte_avx2(data, size, byte);
+    if (level >= HWM_SIMD_SSE4)
+        return count_byte_sse2(data, size, byte);
+#endif
+
+    return count_byte_scalar(data, size, byte);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Public interface
+ */
+
+size_t
+hwm_buffer_find_byte(const hwm_buffer_t *hwm, size_t start, uint8_t byte)
+{
+    if (start >= hwm->current_size)
+        return HWM_BUFFER_NOT_FOUND;
+
+    return offset_result
+        (start, find_byte(hwm_buffer_mem(hwm, uint8_t) + start,
+                          hwm->current_size - start, byte));
+}
+
+
+size_t
+hwm_buffer_find_any(const hwm_buffer_t *hwm, size_t start,
+                    const void *set, size_t set_size)
+{
+    if (start >= hwm->current_size || set_size == 0)
+        return HWM_BUFFER_NOT_FOUND;
+
+    return offset_result
+        (start, find_any(hwm_buffer_mem(hwm, uint8_t) + start,
+                         hwm->current_size - start, set, set_size));
+}
+
+
+size_t
+hwm_buffer_find_mem(const hwm_buffer_t *hwm, size_t start,
+                    const void *needle, size_t needle_size)
+{
+    if (start > hwm->current_size ||
+        needle_size > hwm->current_size - start)
+    {
+        return HWM_BUFFER_NOT_FOUND;
+    }
+
+    if (needle_size == 0)
+        return start;
+
+    return offset_result
+        (start, find_mem(hwm_buffer_mem(hwm, uint8_t) + start,
+                         hwm->current_size - start, needle, needle_size));
+}
+
+
+size_t
+hwm_buffer_count_byte(const hwm_buffer_t *hwm, uint8_t byte)
+{
+    if (hwm->current_size == 0)
+        return 0;
+
+    return count_byte(hwm_buffer_mem(hwm, uint8_t), hwm->current_size,
+                      byte);
+}
+
+
+void
+hwm_buffer_split_init(hwm_buffer_split_t *split, const hwm_buffer_t *hwm,
+                      uint8_t delimiter)
+{
+    hwm_buffer_split_init_mem(split, hwm->data, hwm->current_size,
+                              delimiter);
+}
+
+
+void
+hwm_buffer_split_init_mem(hwm_buffer_split_t *split, const void *src,
+                          size_t size, uint8_t delimiter)
+{
+    split->next = src;
+    split->end = split->next + size;
+    split->block = split->next;
+    split->block_end = split->next;
+    split->mask = 0;
+    split->delimiter = delimiter;
+    split->done = (size == 0);
+}
+
+
+bool
+hwm_buffer_split_next(hwm_buffer_split_t *split,
+                      const void **field, size_t *size)
+{
+    const uint8_t  *delimiter;
+
+    if (split->done)
+        return false;
+
+    /*
+     * Fields tend to be short, so rather than searching for each
+     * delimiter separately, we find all of the delimiters in a 64-byte
+     * block at once, and then hand out fields from the bitmask.
+     */
+
+    while (split->mask == 0)
+    {
+        size_t  block_size;
+
+        if (split->block_end == split->end)
+        {
+            /*
+             * The last field runs to the end of the memory.
+             */
+
+            *field = split->next;
+            *size = split->end - split->next;
+            split->done = true;
+            return true;
+        }
+
+        block_size = split->end - split->block_end;
+        if (block_size > 64)
+            block_size = 64;
+
+        split->block = split->block_end;
+        split->block_end += block_size;
+        split->mask = byte_mask(split->block, block_size, split->delimiter);
+    }
+
+    delimiter = split->block + __builtin_ctzll(split->mask);
+    split->mask &= split->mask - 1;
+
+    *field = split->next;
+    *size = delimiter - split->next;
+    split->next = delimiter + 1;
+    return true;
+}
@@ -0,0 +1,137 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2009, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdbool.h>
+#include <sys/mman.h>
+
+#include <hwm-buffer.h>
+
+#include "hwm-private.h"
+
+
+/*
+ * A buffer that's using shared storage looks just like one that's
+ * pointing at some outside memory: its data doesn't live in its own
+ * buf.  That means that all of the existing write paths already copy
+ * the data into the buffer's own storage before changing it, and then
+ * call _hwm_buffer_release_data(), which drops the reference.
+ */
+
+
+/**
+ * Move the buffer's own storage, or its file mapping, into a new
+ * shared storage struct.
+ */
+
+static bool
+make_shared(hwm_buffer_t *hwm)
+{
+    struct hwm_buffer_shared  *shared =
+        hwm_buffer_allocate(hwm, sizeof(struct hwm_buffer_shared));
+
+    if (shared == NULL)
+        return false;
+
+    shared->ref_count = 1;
+    shared->allocator = hwm_buffer_allocator(hwm);
+    shared->allocator_ctx = hwm->allocator_ctx;
+
+    if (hwm->mapping != NULL)
+    {
+        shared->mem = hwm->mapping;
+        shared->size = hwm->mapping_size;
+        shared->mapped = true;
+
+        hwm->mapping = NULL;
+        hwm->mapping_size = 0;
+    } else {
+        shared->mem = hwm->buf;
+        shared->size = hwm->allocated_size;
+        shared->mapped = false;
+
+        /*
+         * The data pointer stays where it is, but now it points
+         * outside of the buffer's (nonexistent) storage.
+         */
+
+        hwm->buf = NULL;
+        hwm->allocated_size = 0;
+        hwm->consumed = 0;
+    }
+
+    hwm->shared = shared;
+    return true;
+}
+
+
+void
+_hwm_buffer_release_shared(hwm_buffer_t *hwm)
+{
+    struct hwm_buffer_shared  *shared = hwm->shared;
+
+    hwm->shared = NULL;
+
+    if (__atomic_sub_fetch(&shared->ref_count, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+
+    if (shared->mapped)
+        munmap(shared->mem, shared->size);
+    else
+        shared->allocator->deallocate(shared->allocator_ctx,
+                                      shared->mem, shared->size);
+
+    shared->allocator->deallocate(shared->allocator_ctx, shared,
+                                  sizeof(struct hwm_buffer_shared));
+}
+
+
+bool
+hwm_buffer_share(hwm_buffer_t *dest, hwm_buffer_t *src)
+{
+    struct hwm_buffer_shared  *shared;
+
+    if (dest == src)
+        return true;
+
+    /*
+     * There's nothing to share in an empty buffer, and its data
+     * pointer might be its own storage.
+     */
+
+    if (src->current_size == 0)
+    {
+        _hwm_buffer_release_data(dest);
+        dest->data = dest->buf;
+        dest->current_size = 0;
+        return true;
+    }
+
+    if (src->shared == NULL &&
+        (src->mapping != NULL || hwm_buffer_owns_data(src)))
+    {
+        if (!make_shared(src))
+            return false;
+    }
+
+    /*
+     * Take the new reference before releasing dest's old one, in case
+     * they're the same storage.
+     */
+
+    shared = src->shared;
+    if (shared != NULL)
+        __atomic_add_fetch(&shared->ref_count, 1, __ATOMIC_RELAXED);
+
+    _hwm_buffer_release_data(dest);
+    dest->shared = shared;
+    dest->data = src->data;
+    dest->current_size = src->current_size;
+    return true;
+}
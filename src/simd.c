@@ -0,0 +1,68 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2009, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <hwm-buffer.h>
+
+#include "hwm-private.h"
+
+
+/**
+ * The highest SIMD level that we're allowed to use.
+ */
+
+static int  level_limit = HWM_SIMD_AVX2;
+
+/**
+ * The highest SIMD level that the CPU supports, or -1 if we haven't
+ * checked yet.  Every thread that checks gets the same answer, so it
+ * doesn't matter if more than one of them does.
+ */
+
+static int  cpu_level = -1;
+
+
+static int
+detect_cpu_level(void)
+{
+#if defined(HWM_X86_SIMD)
+    /*
+     * GCC's CPU checks take into account whether the OS saves the AVX
+     * registers, not just whether the CPU has them.
+     */
+
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+        return HWM_SIMD_AVX2;
+
+    if (__builtin_cpu_supports("sse4.2"))
+        return HWM_SIMD_SSE4;
+#endif
+
+    return HWM_SIMD_SCALAR;
+}
+
+
+int
+hwm_simd_level(void)
+{
+    if (cpu_level < 0)
+        cpu_level = detect_cpu_level();
+
+    return (cpu_level < level_limit)? cpu_level: level_limit;
+}
+
+
+int
+hwm_simd_limit(int max_level)
+{
+    level_limit = (max_level < HWM_SIMD_SCALAR)? HWM_SIMD_SCALAR: max_level;
+    return hwm_simd_level();
+}
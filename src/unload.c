@@ -12,6 +12,8 @@
 
 #include <hwm-buffer.h>
 
+#include "hwm-private.h"
+
 
 void
 hwm_buffer_unload_mem(hwm_buffer_t *hwm, void *dest, size_t max_size)
@@ -27,3 +29,40 @@ hwm_buffer_unload_mem(hwm_buffer_t *hwm, void *dest, size_t max_size)
 
     memcpy(dest, hwm->data, size);
 }
+
+
+void
+hwm_buffer_consume(hwm_buffer_t *hwm, size_t size)
+{
+    if (size > hwm->current_size)
+        size = hwm->current_size;
+
+    /*
+     * The hash covers the consumed bytes, which aren't part of the
+     * contents anymore.
+     */
+
+    if (size > 0)
+        hwm_buffer_invalidate_hash(hwm);
+
+    if (hwm_buffer_owns_data(hwm))
+    {
+        /*
+         * If everything is being consumed, we can reclaim the
+         * consumed space right away, without moving anything.
+         */
+
+        if (size == hwm->current_size)
+        {
+            hwm->data = hwm->buf;
+            hwm->consumed = 0;
+            hwm->current_size = 0;
+            return;
+        }
+
+        hwm->consumed += size;
+    }
+
+    hwm->data += size;
+    hwm->current_size -= size;
+}
@@ -0,0 +1,168 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2009, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Measures the throughput of hwm_buffer_crc32c() at each SIMD level
+ * that the CPU supports, along with a byte-at-a-time table loop for
+ * comparison.  Each workload is run over one large buffer and over
+ * many small frames, since the interleaved kernel only helps with
+ * long inputs.
+ *
+ * Usage: bench-hwm-crc32c [megabytes] [rounds]
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <hwm-buffer.h>
+
+
+#define FRAME_SIZE  512
+
+static size_t  total_size = 64 * 1024 * 1024;
+static size_t  rounds = 10;
+
+static hwm_buffer_t  input;
+static uint32_t  table[256];
+
+/*
+ * The results are accumulated here, so that the compiler can't skip
+ * the checksums.
+ */
+
+static uint32_t  checksum;
+
+
+/*-----------------------------------------------------------------------
+ * Workloads
+ */
+
+static void
+run_loop(void)
+{
+    const uint8_t  *data = hwm_buffer_mem(&input, uint8_t);
+    uint32_t  crc = 0xffffffff;
+    size_t  i;
+
+    for (i = 0; i < input.current_size; i++)
+        crc = (crc >> 8) ^ table[(crc ^ data[i]) & 0xff];
+
+    checksum += ~crc;
+}
+
+
+static void
+run_crc32c(void)
+{
+    checksum += hwm_buffer_crc32c(&input);
+}
+
+
+static void
+run_frames(void)
+{
+    const uint8_t  *data = hwm_buffer_mem(&input, uint8_t);
+    size_t  i;
+
+    for (i = 0; i + FRAME_SIZE <= input.current_size; i += FRAME_SIZE)
+        checksum += hwm_buffer_crc32c_mem(0, data + i, FRAME_SIZE);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Harness
+ */
+
+static double
+now(void)
+{
+    struct timespec  ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/**
+ * Run one of the workloads, returning its throughput in megabytes per
+ * second.
+ */
+
+static double
+run(void (*workload)(void))
+{
+    double  start = now();
+    size_t  i;
+
+    for (i = 0; i < rounds; i++)
+        workload();
+
+    return total_size * rounds / (now() - start) / (1024 * 1024);
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    static const char  *level_names[] = { "scalar", "sse", "avx2" };
+    uint8_t  *data;
+    uint32_t  state = 1;
+    int  best_level;
+    int  level;
+    size_t  i;
+
+    if (argc > 1)
+        total_size = (size_t) atol(argv[1]) * 1024 * 1024;
+    if (argc > 2)
+        rounds = (size_t) atol(argv[2]);
+
+    for (i = 0; i < 256; i++)
+    {
+        uint32_t  crc = i;
+        int  k;
+
+        for (k = 0; k < 8; k++)
+            crc = (crc >> 1) ^ ((crc & 1)? 0x82f63b78: 0);
+
+        table[i] = crc;
+    }
+
+    hwm_buffer_init(&input);
+    data = hwm_buffer_reserve(&input, total_size);
+    if (data == NULL)
+    {
+        fprintf(stderr, "Cannot allocate input\n");
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < total_size; i++)
+    {
+        state = state * 1103515245 + 12345;
+        data[i] = (uint8_t) (state >> 16);
+    }
+
+    hwm_buffer_commit(&input, total_size);
+
+    printf("%-8s %10s %10s %10s\n", "MB/s", "loop", "crc32c", "frames");
+
+    best_level = hwm_simd_level();
+    for (level = HWM_SIMD_SCALAR; level <= best_level; level++)
+    {
+        hwm_simd_limit(level);
+        printf("%-8s %10.0f %10.0f %10.0f\n", level_names[level],
+               run(run_loop), run(run_crc32c), run(run_frames));
+    }
+
+    hwm_buffer_done(&input);
+    return (checksum == 0)? EXIT_FAILURE: EXIT_SUCCESS;
+}
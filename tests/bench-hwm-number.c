@@ -0,0 +1,222 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2009, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Compares the dedicated number appenders against formatting each
+ * number with snprintf() and appending the result with
+ * hwm_buffer_append_str().  Each round appends a batch of numbers,
+ * separated by spaces, to a buffer that's cleared between rounds, so
+ * the buffer never needs to grow once it reaches its high-water mark.
+ *
+ * Usage: bench-hwm-number [millions of numbers]
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <hwm-buffer.h>
+
+
+#define BATCH_SIZE  1024
+
+static size_t  total_count = 4 * 1000 * 1000;
+
+static uint64_t  INTEGERS[BATCH_SIZE];
+static double  DOUBLES[BATCH_SIZE];
+
+/*
+ * The buffers' sizes are accumulated here, so that the compiler can't
+ * skip the formatting.
+ */
+
+static size_t  checksum;
+
+
+/*-----------------------------------------------------------------------
+ * Formatters under test
+ */
+
+static void
+run_u64(void)
+{
+    hwm_buffer_t  buf;
+    size_t  done;
+    size_t  i;
+
+    hwm_buffer_init(&buf);
+
+    for (done = 0; done < total_count; done += BATCH_SIZE)
+    {
+        hwm_buffer_clear(&buf);
+
+        for (i = 0; i < BATCH_SIZE; i++)
+        {
+            hwm_buffer_append_u64(&buf, INTEGERS[i]);
+            hwm_buffer_append_mem(&buf, " ", 1);
+        }
+
+        checksum += buf.current_size;
+    }
+
+    hwm_buffer_done(&buf);
+}
+
+
+static void
+run_u64_snprintf(void)
+{
+    hwm_buffer_t  buf;
+    char  scratch[32];
+    size_t  done;
+    size_t  i;
+
+    hwm_buffer_init(&buf);
+
+    for (done = 0; done < total_count; done += BATCH_SIZE)
+    {
+        hwm_buffer_clear(&buf);
+
+        for (i = 0; i < BATCH_SIZE; i++)
+        {
+            snprintf(scratch, sizeof(scratch), "%" PRIu64 " ",
+                     INTEGERS[i]);
+            hwm_buffer_append_str(&buf, scratch);
+        }
+
+        checksum += buf.current_size;
+    }
+
+    hwm_buffer_done(&buf);
+}
+
+
+static void
+run_double(void)
+{
+    hwm_buffer_t  buf;
+    size_t  done;
+    size_t  i;
+
+    hwm_buffer_init(&buf);
+
+    for (done = 0; done < total_count; done += BATCH_SIZE)
+    {
+        hwm_buffer_clear(&buf);
+
+        for (i = 0; i < BATCH_SIZE; i++)
+        {
+            hwm_buffer_append_double(&buf, DOUBLES[i]);
+            hwm_buffer_append_mem(&buf, " ", 1);
+        }
+
+        checksum += buf.current_size;
+    }
+
+    hwm_buffer_done(&buf);
+}
+
+
+static void
+run_double_snprintf(void)
+{
+    hwm_buffer_t  buf;
+    char  scratch[32];
+    size_t  done;
+    size_t  i;
+
+    hwm_buffer_init(&buf);
+
+    /*
+     * %.17g is the shortest printf format that always round-trips.
+     */
+
+    for (done = 0; done < total_count; done += BATCH_SIZE)
+    {
+        hwm_buffer_clear(&buf);
+
+        for (i = 0; i < BATCH_SIZE; i++)
+        {
+            snprintf(scratch, sizeof(scratch), "%.17g ", DOUBLES[i]);
+            hwm_buffer_append_str(&buf, scratch);
+        }
+
+        checksum += buf.current_size;
+    }
+
+    hwm_buffer_done(&buf);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Harness
+ */
+
+static double
+now(void)
+{
+    struct timespec  ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/**
+ * Run one of the workloads, returning its throughput in millions of
+ * numbers per second.
+ */
+
+static double
+run(void (*workload)(void))
+{
+    double  start = now();
+    workload();
+    return total_count / (now() - start) / 1e6;
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    uint64_t  state = 0x9e3779b97f4a7c15;
+    size_t  i;
+
+    if (argc > 1)
+        total_count = (size_t) atol(argv[1]) * 1000 * 1000;
+
+    /*
+     * Spread the integers over every magnitude, and give the doubles a
+     * realistic mix of short and long representations.
+     */
+
+    for (i = 0; i < BATCH_SIZE; i++)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+
+        INTEGERS[i] = state >> (state % 64);
+        DOUBLES[i] = (i % 2 == 0)?
+            (double) (state % 100000) / 100:
+            (double) state / (double) UINT64_MAX * 1e6;
+    }
+
+    printf("%10s %10s %10s %10s\n",
+           "u64 M/s", "snprintf", "double M/s", "snprintf");
+    printf("%10.1f %10.1f %10.1f %10.1f\n",
+           run(run_u64), run(run_u64_snprintf),
+           run(run_double), run(run_double_snprintf));
+
+    return (checksum == 0)? EXIT_FAILURE: EXIT_SUCCESS;
+}
@@ -0,0 +1,367 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2009, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Compares the throughput of hwm_mt_pool_t against an hwm_pool_t
+ * protected by a mutex, as the number of threads grows.  There are two
+ * workloads.  In the first, each thread repeatedly acquires a buffer,
+ * fills it, and releases it.  In the second, threads work in pairs: a
+ * producer acquires and fills buffers and hands them to a consumer,
+ * which releases them, the way an I/O thread releases a buffer once
+ * it's been sent.  That keeps the producer's per-thread cache empty,
+ * so every acquire and release goes through the shared free list.
+ *
+ * Usage: bench-hwm-pool [max threads] [rounds per thread]
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <hwm-buffer.h>
+#include <hwm-pool.h>
+
+
+#define BUFFER_SIZE  256
+#define FILL_SIZE  64
+#define HELD_BUFFERS  4
+#define QUEUE_SIZE  64
+
+static size_t  rounds = 1000000;
+
+static const char  FILL[FILL_SIZE] = { 0 };
+
+
+/*-----------------------------------------------------------------------
+ * Pools under test
+ */
+
+static hwm_mt_pool_t  mt_pool;
+
+static hwm_pool_t  locked_pool;
+static pthread_mutex_t  locked_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+static hwm_buffer_t *
+mt_acquire(void)
+{
+    return hwm_mt_pool_acquire(&mt_pool, BUFFER_SIZE);
+}
+
+static void
+mt_release(hwm_buffer_t *buf)
+{
+    hwm_mt_pool_release(&mt_pool, buf);
+}
+
+
+static hwm_buffer_t *
+locked_acquire(void)
+{
+    hwm_buffer_t  *result;
+
+    pthread_mutex_lock(&locked_pool_mutex);
+    result = hwm_pool_acquire(&locked_pool, BUFFER_SIZE);
+    pthread_mutex_unlock(&locked_pool_mutex);
+    return result;
+}
+
+static void
+locked_release(hwm_buffer_t *buf)
+{
+    pthread_mutex_lock(&locked_pool_mutex);
+    hwm_pool_release(&locked_pool, buf);
+    pthread_mutex_unlock(&locked_pool_mutex);
+}
+
+
+typedef struct pool_ops
+{
+    const char  *name;
+    hwm_buffer_t *(*acquire)(void);
+    void (*release)(hwm_buffer_t *buf);
+} pool_ops_t;
+
+static const pool_ops_t  MT_OPS = { "lock-free", mt_acquire, mt_release };
+static const pool_ops_t  LOCKED_OPS =
+    { "mutex", locked_acquire, locked_release };
+
+
+/*-----------------------------------------------------------------------
+ * Handoff queue
+ *
+ * A single-producer, single-consumer ring, so that the cost of handing
+ * buffers from one thread to another is the same for both pools.
+ */
+
+typedef struct handoff
+{
+    const pool_ops_t  *ops;
+    hwm_buffer_t  *slots[QUEUE_SIZE];
+    size_t  head;
+    size_t  tail;
+} handoff_t;
+
+
+static void
+handoff_push(handoff_t *queue, hwm_buffer_t *buf)
+{
+    size_t  tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+
+    while (tail - __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) ==
+           QUEUE_SIZE)
+    {
+        sched_yield();
+    }
+
+    queue->slots[tail % QUEUE_SIZE] = buf;
+    __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+
+static hwm_buffer_t *
+handoff_pop(handoff_t *queue)
+{
+    size_t  head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+    hwm_buffer_t  *buf;
+
+    while (__atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE) == head)
+        sched_yield();
+
+    buf = queue->slots[head % QUEUE_SIZE];
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+    return buf;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Harness
+ */
+
+/**
+ * Acquire, fill, and release buffers, all on the same thread.
+ */
+
+static void *
+worker(void *varg)
+{
+    const pool_ops_t  *ops = (const pool_ops_t *) varg;
+    hwm_buffer_t  *held[HELD_BUFFERS];
+    size_t  round;
+    size_t  i;
+
+    for (round = 0; round < rounds; round += HELD_BUFFERS)
+    {
+        for (i = 0; i < HELD_BUFFERS; i++)
+        {
+            held[i] = ops->acquire();
+            hwm_buffer_append_mem(held[i], FILL, FILL_SIZE);
+        }
+
+        for (i = 0; i < HELD_BUFFERS; i++)
+            ops->release(held[i]);
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Acquire and fill buffers, and hand them to the consumer.  A NULL
+ * tells the consumer that we're done.
+ */
+
+static void *
+producer(void *varg)
+{
+    handoff_t  *queue = (handoff_t *) varg;
+    size_t  round;
+
+    for (round = 0; round < rounds; round++)
+    {
+        hwm_buffer_t  *buf = queue->ops->acquire();
+        hwm_buffer_append_mem(buf, FILL, FILL_SIZE);
+        handoff_push(queue, buf);
+    }
+
+    handoff_push(queue, NULL);
+    return NULL;
+}
+
+
+/**
+ * Release the buffers that the producer hands us.
+ */
+
+static void *
+consumer(void *varg)
+{
+    handoff_t  *queue = (handoff_t *) varg;
+    hwm_buffer_t  *buf;
+
+    while ((buf = handoff_pop(queue)) != NULL)
+        queue->ops->release(buf);
+
+    return NULL;
+}
+
+
+static double
+now(void)
+{
+    struct timespec  ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/**
+ * Run the workload on the given number of threads, returning the
+ * total throughput in millions of acquire/release pairs per second.
+ */
+
+static double
+run(const pool_ops_t *ops, size_t thread_count)
+{
+    pthread_t  threads[thread_count];
+    double  start;
+    double  elapsed;
+    size_t  i;
+
+    start = now();
+
+    for (i = 0; i < thread_count; i++)
+        pthread_create(&threads[i], NULL, worker, (void *) ops);
+
+    for (i = 0; i < thread_count; i++)
+        pthread_join(threads[i], NULL);
+
+    elapsed = now() - start;
+    return (rounds * thread_count) / elapsed / 1e6;
+}
+
+
+/**
+ * Run the handoff workload with the given number of producer/consumer
+ * pairs, returning the total throughput in millions of buffers per
+ * second.
+ */
+
+static double
+run_handoff(const pool_ops_t *ops, size_t pair_count)
+{
+    pthread_t  producers[pair_count];
+    pthread_t  consumers[pair_count];
+    handoff_t  *queues;
+    double  start;
+    double  elapsed;
+    size_t  i;
+
+    queues = (handoff_t *) calloc(pair_count, sizeof(handoff_t));
+    if (queues == NULL)
+        return 0;
+
+    start = now();
+
+    for (i = 0; i < pair_count; i++)
+    {
+        queues[i].ops = ops;
+        pthread_create(&consumers[i], NULL, consumer, &queues[i]);
+        pthread_create(&producers[i], NULL, producer, &queues[i]);
+    }
+
+    for (i = 0; i < pair_count; i++)
+    {
+        pthread_join(producers[i], NULL);
+        pthread_join(consumers[i], NULL);
+    }
+
+    elapsed = now() - start;
+    free(queues);
+    return (rounds * pair_count) / elapsed / 1e6;
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    long  max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t  thread_count;
+
+    if (argc > 1)
+        max_threads = atol(argv[1]);
+    if (argc > 2)
+        rounds = atol(argv[2]);
+    if (max_threads < 1)
+        max_threads = 1;
+
+    printf("Same thread: each thread acquires and releases\n");
+    printf("%8s %14s %14s\n", "threads",
+           "lock-free M/s", "mutex M/s");
+
+    for (thread_count = 1; thread_count <= (size_t) max_threads;
+         thread_count++)
+    {
+        double  mt_rate;
+        double  locked_rate;
+
+        hwm_mt_pool_init(&mt_pool, HELD_BUFFERS * thread_count * 2, 0);
+        mt_rate = run(&MT_OPS, thread_count);
+        hwm_mt_pool_done(&mt_pool);
+
+        hwm_pool_init(&locked_pool, 0, 0);
+        locked_rate = run(&LOCKED_OPS, thread_count);
+        hwm_pool_done(&locked_pool);
+
+        printf("%8zu %14.2f %14.2f\n",
+               thread_count, mt_rate, locked_rate);
+    }
+
+    printf("\nHandoff: producers acquire, consumers release\n");
+    printf("%8s %14s %14s %10s\n", "pairs",
+           "lock-free M/s", "mutex M/s", "hit rate");
+
+    for (thread_count = 1; thread_count <= (size_t) max_threads;
+         thread_count++)
+    {
+        double  mt_rate;
+        double  locked_rate;
+        double  hit_rate;
+
+        /*
+         * Leave room for every buffer that can be in flight: a full
+         * queue, one on each side of it, and a full cache on each
+         * side.
+         */
+
+        hwm_mt_pool_init(&mt_pool, (QUEUE_SIZE + 2 +
+                                    2 * HWM_MT_POOL_CACHE_SIZE) *
+                         thread_count, 0);
+        mt_rate = run_handoff(&MT_OPS, thread_count);
+        hit_rate = (double) hwm_mt_pool_hits(&mt_pool) /
+            (hwm_mt_pool_hits(&mt_pool) + hwm_mt_pool_misses(&mt_pool));
+        hwm_mt_pool_done(&mt_pool);
+
+        hwm_pool_init(&locked_pool, 0, 0);
+        locked_rate = run_handoff(&LOCKED_OPS, thread_count);
+        hwm_pool_done(&locked_pool);
+
+        printf("%8zu %14.2f %14.2f %9.1f%%\n",
+               thread_count, mt_rate, locked_rate, hit_rate * 100);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,187 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2009, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Compares the throughput of a streaming receive buffer implemented
+ * three ways: an hwm_ring_t, an HWM buffer that's compacted with
+ * memmove after every batch of frames, and an HWM buffer that uses
+ * hwm_buffer_consume().  Each round appends one chunk of input, and
+ * then parses fixed-size frames off the front until the backlog is
+ * down to its target size, so there's always a sizable amount of
+ * unparsed data that a compacting buffer has to move.
+ *
+ * Usage: bench-hwm-ring [megabytes] [backlog bytes]
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <hwm-buffer.h>
+#include <hwm-ring.h>
+
+
+#define CHUNK_SIZE  4096
+#define FRAME_SIZE  100
+
+static size_t  total_size = 256 * 1024 * 1024;
+static size_t  backlog = 32 * 1024;
+
+static uint8_t  CHUNK[CHUNK_SIZE];
+
+/*
+ * The frames' checksums are accumulated here, so that the compiler
+ * can't skip the parsing.
+ */
+
+static uint64_t  checksum;
+
+
+static void
+parse_frame(const uint8_t *frame)
+{
+    size_t  i;
+
+    for (i = 0; i < FRAME_SIZE; i += 8)
+        checksum += frame[i];
+}
+
+
+/*-----------------------------------------------------------------------
+ * Receive buffers under test
+ */
+
+static void
+run_ring(void)
+{
+    hwm_ring_t  ring;
+    size_t  received;
+
+    hwm_ring_init(&ring, backlog + CHUNK_SIZE);
+
+    for (received = 0; received < total_size; received += CHUNK_SIZE)
+    {
+        hwm_ring_append_mem(&ring, CHUNK, CHUNK_SIZE);
+
+        while (hwm_ring_current_size(&ring) > backlog)
+        {
+            parse_frame(hwm_ring_mem(&ring, uint8_t));
+            hwm_ring_consume(&ring, FRAME_SIZE);
+        }
+    }
+
+    hwm_ring_done(&ring);
+}
+
+
+static void
+run_memmove(void)
+{
+    hwm_buffer_t  buf;
+    size_t  received;
+
+    hwm_buffer_init(&buf);
+    hwm_buffer_ensure_size(&buf, backlog + CHUNK_SIZE);
+
+    for (received = 0; received < total_size; received += CHUNK_SIZE)
+    {
+        uint8_t  *mem;
+        size_t  parsed = 0;
+
+        hwm_buffer_append_mem(&buf, CHUNK, CHUNK_SIZE);
+        mem = hwm_buffer_writable_mem(&buf, uint8_t);
+
+        while (buf.current_size - parsed > backlog)
+        {
+            parse_frame(mem + parsed);
+            parsed += FRAME_SIZE;
+        }
+
+        memmove(mem, mem + parsed, buf.current_size - parsed);
+        buf.current_size -= parsed;
+    }
+
+    hwm_buffer_done(&buf);
+}
+
+
+static void
+run_consume(void)
+{
+    hwm_buffer_t  buf;
+    size_t  received;
+
+    hwm_buffer_init(&buf);
+    hwm_buffer_ensure_size(&buf, backlog + CHUNK_SIZE);
+
+    for (received = 0; received < total_size; received += CHUNK_SIZE)
+    {
+        hwm_buffer_append_mem(&buf, CHUNK, CHUNK_SIZE);
+
+        while (buf.current_size > backlog)
+        {
+            parse_frame(hwm_buffer_mem(&buf, uint8_t));
+            hwm_buffer_consume(&buf, FRAME_SIZE);
+        }
+    }
+
+    hwm_buffer_done(&buf);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Harness
+ */
+
+static double
+now(void)
+{
+    struct timespec  ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/**
+ * Run one of the workloads, returning its throughput in megabytes per
+ * second.
+ */
+
+static double
+run(void (*workload)(void))
+{
+    double  start = now();
+    workload();
+    return total_size / (now() - start) / (1024 * 1024);
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    size_t  i;
+
+    if (argc > 1)
+        total_size = (size_t) atol(argv[1]) * 1024 * 1024;
+    if (argc > 2)
+        backlog = (size_t) atol(argv[2]);
+
+    for (i = 0; i < CHUNK_SIZE; i++)
+        CHUNK[i] = (uint8_t) i;
+
+    printf("%10s %10s %10s\n", "ring MB/s", "memmove", "consume");
+    printf("%10.1f %10.1f %10.1f\n",
+           run(run_ring), run(run_memmove), run(run_consume));
+
+    return (checksum == 0)? EXIT_FAILURE: EXIT_SUCCESS;
+}
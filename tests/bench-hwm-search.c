@@ -0,0 +1,187 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2009, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Measures the throughput of the buffer search functions at each SIMD
+ * level that the CPU supports, along with a byte-at-a-time loop for
+ * comparison.  The input is text-like: lowercase letters, with a comma
+ * every few bytes.  Searches look for something that isn't there, so
+ * that they scan the whole buffer; the splitter splits on the commas.
+ *
+ * Usage: bench-hwm-search [megabytes] [rounds]
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <hwm-buffer.h>
+
+
+static size_t  total_size = 16 * 1024 * 1024;
+static size_t  rounds = 20;
+
+static hwm_buffer_t  input;
+
+/*
+ * The results are accumulated here, so that the compiler can't skip
+ * the searches.
+ */
+
+static size_t  checksum;
+
+
+/*-----------------------------------------------------------------------
+ * Workloads
+ */
+
+static void
+run_loop(void)
+{
+    const uint8_t  *data = hwm_buffer_mem(&input, uint8_t);
+    size_t  i;
+
+    for (i = 0; i < input.current_size; i++)
+    {
+        if (data[i] == '|')
+            break;
+    }
+
+    checksum += i;
+}
+
+
+static void
+run_find_byte(void)
+{
+    checksum += hwm_buffer_find_byte(&input, 0, '|');
+}
+
+
+static void
+run_find_any(void)
+{
+    checksum += hwm_buffer_find_any(&input, 0, "|\n\r\t", 4);
+}
+
+
+static void
+run_find_mem(void)
+{
+    /*
+     * The needle's first and last bytes are common, so there are
+     * plenty of false candidates to reject.
+     */
+
+    checksum += hwm_buffer_find_mem(&input, 0, "a,|,a", 5);
+}
+
+
+static void
+run_count(void)
+{
+    checksum += hwm_buffer_count_byte(&input, ',');
+}
+
+
+static void
+run_split(void)
+{
+    hwm_buffer_split_t  split;
+    const void  *field;
+    size_t  size;
+
+    hwm_buffer_split_init(&split, &input, ',');
+    while (hwm_buffer_split_next(&split, &field, &size))
+        checksum += size;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Harness
+ */
+
+static double
+now(void)
+{
+    struct timespec  ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/**
+ * Run one of the workloads, returning its throughput in megabytes per
+ * second.
+ */
+
+static double
+run(void (*workload)(void))
+{
+    double  start = now();
+    size_t  i;
+
+    for (i = 0; i < rounds; i++)
+        workload();
+
+    return total_size * rounds / (now() - start) / (1024 * 1024);
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    static const char  *level_names[] = { "scalar", "sse", "avx2" };
+    uint8_t  *data;
+    uint32_t  state = 1;
+    int  best_level;
+    int  level;
+    size_t  i;
+
+    if (argc > 1)
+        total_size = (size_t) atol(argv[1]) * 1024 * 1024;
+    if (argc > 2)
+        rounds = (size_t) atol(argv[2]);
+
+    hwm_buffer_init(&input);
+    data = hwm_buffer_reserve(&input, total_size);
+    if (data == NULL)
+    {
+        fprintf(stderr, "Cannot allocate input\n");
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < total_size; i++)
+    {
+        state = state * 1103515245 + 12345;
+        data[i] = ((state >> 16) % 8 == 0)? ',': 'a' + (state >> 16) % 26;
+    }
+
+    hwm_buffer_commit(&input, total_size);
+
+    printf("%-8s %10s %10s %10s %10s %10s %10s\n", "MB/s", "loop",
+           "find_byte", "find_any", "find_mem", "count", "split");
+
+    best_level = hwm_simd_level();
+    for (level = HWM_SIMD_SCALAR; level <= best_level; level++)
+    {
+        hwm_simd_limit(level);
+        printf("%-8s %10.0f %10.0f %10.0f %10.0f %10.0f %10.0f\n",
+               level_names[level], run(run_loop), run(run_find_byte),
+               run(run_find_any), run(run_find_mem), run(run_count),
+               run(run_split));
+    }
+
+    hwm_buffer_done(&input);
+    return (checksum == 0)? EXIT_FAILURE: EXIT_SUCCESS;
+}
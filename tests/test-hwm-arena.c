@@ -0,0 +1,262 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2009, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+#include <hwm-arena.h>
+#include <hwm-buffer.h>
+
+
+/*-----------------------------------------------------------------------
+ * Sample data
+ */
+
+const char  *DATA_01 = "0123456789";
+size_t  LENGTH_01 = 10;
+
+const char  *DATA_02 = "01234567890123456789";
+size_t  LENGTH_02 = 20;
+
+
+/*-----------------------------------------------------------------------
+ * Helper functions
+ */
+
+#define fail_unless_buf_matches(buffer, other, size)            \
+    {                                                           \
+        fail_if(hwm_buffer_mem(buffer, void) == NULL,           \
+                "Data doesn't match: buffer unallocated");      \
+        fail_unless((buffer)->current_size == size,             \
+                    "Data doesn't match: wrong size (%zu)",     \
+                    (buffer)->current_size);                    \
+        fail_unless(hwm_buffer_equal_mem(buffer, other, size),  \
+                    "Data doesn't match: different contents");  \
+    }
+
+
+/*-----------------------------------------------------------------------
+ * Test cases
+ */
+
+
+START_TEST(test_arena_grow_in_place_01)
+{
+    hwm_arena_t  arena;
+    hwm_buffer_t  buf;
+    const void  *original;
+
+    /*
+     * The buffer's storage is the only allocation in the arena, so
+     * growing it shouldn't move it.
+     */
+
+    hwm_arena_init(&arena, 1024);
+    hwm_buffer_init_in_arena(&buf, &arena);
+
+    fail_unless(hwm_buffer_load_mem(&buf, DATA_01, LENGTH_01),
+                "Cannot load HWM buffer");
+    original = buf.buf;
+    fail_unless(hwm_buffer_append_mem(&buf, DATA_01, LENGTH_01),
+                "Cannot append HWM buffer");
+    fail_unless_buf_matches(&buf, DATA_02, LENGTH_02);
+    fail_unless(buf.buf == original,
+                "Buffer should have grown in place");
+
+    hwm_buffer_done(&buf);
+    hwm_arena_done(&arena);
+}
+END_TEST
+
+
+START_TEST(test_arena_two_buffers_01)
+{
+    hwm_arena_t  arena;
+    hwm_buffer_t  buf1;
+    hwm_buffer_t  buf2;
+
+    /*
+     * Once a second buffer has been allocated after the first, the
+     * first one can't grow in place anymore, but its contents should
+     * survive being moved.
+     */
+
+    hwm_arena_init(&arena, 1024);
+    hwm_buffer_init_in_arena(&buf1, &arena);
+    hwm_buffer_init_in_arena(&buf2, &arena);
+
+    fail_unless(hwm_buffer_load_mem(&buf1, DATA_01, LENGTH_01),
+                "Cannot load HWM buffer");
+    fail_unless(hwm_buffer_load_mem(&buf2, DATA_02, LENGTH_02),
+                "Cannot load HWM buffer");
+    fail_unless(hwm_buffer_append_mem(&buf1, DATA_01, LENGTH_01),
+                "Cannot append HWM buffer");
+
+    fail_unless_buf_matches(&buf1, DATA_02, LENGTH_02);
+    fail_unless_buf_matches(&buf2, DATA_02, LENGTH_02);
+
+    hwm_arena_done(&arena);
+}
+END_TEST
+
+
+START_TEST(test_arena_reset_01)
+{
+    hwm_arena_t  arena;
+    hwm_buffer_t  buf;
+    const void  *original;
+
+    /*
+     * After a reset, the arena should hand out the same memory again.
+     */
+
+    hwm_arena_init(&arena, 1024);
+    hwm_buffer_init_in_arena(&buf, &arena);
+    fail_unless(hwm_buffer_load_mem(&buf, DATA_01, LENGTH_01),
+                "Cannot load HWM buffer");
+    original = buf.buf;
+
+    hwm_arena_reset(&arena);
+
+    hwm_buffer_init_in_arena(&buf, &arena);
+    fail_unless(hwm_buffer_load_mem(&buf, DATA_02, LENGTH_02),
+                "Cannot load HWM buffer");
+    fail_unless_buf_matches(&buf, DATA_02, LENGTH_02);
+    fail_unless(buf.buf == original,
+                "Arena should reuse memory after a reset");
+
+    hwm_arena_done(&arena);
+}
+END_TEST
+
+
+START_TEST(test_arena_large_01)
+{
+    hwm_arena_t  arena;
+    hwm_buffer_t  buf;
+    size_t  i;
+
+    /*
+     * Grow a buffer well past the slab size, to make sure that we
+     * can move into larger dedicated slabs.
+     */
+
+    hwm_arena_init(&arena, 64);
+    hwm_buffer_init_in_arena(&buf, &arena);
+
+    for (i = 0; i < 100; i++)
+    {
+        fail_unless(hwm_buffer_append_mem(&buf, DATA_02, LENGTH_02),
+                    "Cannot append HWM buffer");
+    }
+
+    fail_unless(buf.current_size == 100 * LENGTH_02,
+                "Buffer is wrong size (got %zu, expected %zu)",
+                buf.current_size, 100 * LENGTH_02);
+
+    for (i = 0; i < 100; i++)
+    {
+        fail_unless(memcmp(hwm_buffer_mem(&buf, char) + i * LENGTH_02,
+                           DATA_02, LENGTH_02) == 0,
+                    "Data doesn't match: different contents");
+    }
+
+    hwm_arena_done(&arena);
+}
+END_TEST
+
+
+START_TEST(test_arena_failed_grow_01)
+{
+    hwm_arena_t  arena;
+    hwm_buffer_t  buf;
+    char  data[600];
+    const void  *original;
+
+    /*
+     * A failed allocation can move the arena on to a later slab.  The
+     * buffer's storage is still in the earlier one, so it mustn't be
+     * grown in place afterwards.
+     */
+
+    hwm_arena_init(&arena, 256);
+    fail_if(hwm_arena_alloc(&arena, 200) == NULL,
+            "Cannot allocate from arena");
+    fail_if(hwm_arena_alloc(&arena, 200) == NULL,
+            "Cannot allocate from arena");
+    hwm_arena_reset(&arena);
+
+    hwm_buffer_init_in_arena(&buf, &arena);
+    fail_unless(hwm_buffer_append_mem(&buf, DATA_01, LENGTH_01),
+                "Cannot append HWM buffer");
+    original = buf.buf;
+
+    fail_if(hwm_buffer_ensure_size(&buf, SIZE_MAX / 2),
+            "Shouldn't be able to allocate a huge buffer");
+
+    memset(data, 'x', sizeof(data));
+    fail_unless(hwm_buffer_append_mem(&buf, data, sizeof(data)),
+                "Cannot append HWM buffer");
+
+    fail_unless(buf.buf != original,
+                "Buffer shouldn't have grown in place");
+    fail_unless(buf.current_size == LENGTH_01 + sizeof(data),
+                "Buffer is wrong size (got %zu, expected %zu)",
+                buf.current_size, LENGTH_01 + sizeof(data));
+    fail_unless(memcmp(hwm_buffer_mem(&buf, char), DATA_01, LENGTH_01) == 0,
+                "Data doesn't match: different contents");
+    fail_unless(memcmp(hwm_buffer_mem(&buf, char) + LENGTH_01,
+                       data, sizeof(data)) == 0,
+                "Data doesn't match: different contents");
+
+    hwm_arena_done(&arena);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("hwm-arena");
+
+    TCase  *tc = tcase_create("hwm-arena");
+    tcase_add_test(tc, test_arena_grow_in_place_01);
+    tcase_add_test(tc, test_arena_two_buffers_01);
+    tcase_add_test(tc, test_arena_reset_01);
+    tcase_add_test(tc, test_arena_large_01);
+    tcase_add_test(tc, test_arena_failed_grow_01);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
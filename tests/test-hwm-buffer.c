@@ -14,9 +14,14 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <check.h>
 
 #include <hwm-buffer.h>
+#include <hwm-mmap.h>
 
 
 /*-----------------------------------------------------------------------
@@ -29,6 +34,9 @@ size_t  LENGTH_01 = 10;
 const char  *DATA_02 = "01234567890123456789";
 size_t  LENGTH_02 = 20;
 
+const char  *DATA_03 = "012345678901234567890123456789";
+size_t  LENGTH_03 = 30;
+
 const char  *DATA_EMPTY_01 = "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00";
 size_t  LENGTH_EMPTY_01 = 10;
 
@@ -45,8 +53,7 @@ size_t  LENGTH_EMPTY_01 = 10;
                     "Data doesn't match: wrong size (%zu)",     \
                     (buffer)->current_size);                    \
                                                                 \
-        if (memcmp(hwm_buffer_mem(buffer, void),                \
-                   other, size) != 0)                           \
+        if (!hwm_buffer_equal_mem(buffer, other, size))         \
         {                                                       \
             hwm_buffer_t  __expected;                           \
             hwm_buffer_init(&__expected);                       \
@@ -82,6 +89,76 @@ size_t  LENGTH_EMPTY_01 = 10;
     }
 
 
+/*
+ * An allocator that wraps malloc, keeping count of how many
+ * allocations are outstanding.  If its context's round_to field is
+ * nonzero, it reports each allocation's usable size as rounded up to
+ * a multiple of that value.
+ */
+
+typedef struct counting_allocator
+{
+    size_t  allocations;
+    size_t  frees;
+    size_t  round_to;
+} counting_allocator_t;
+
+static void *
+counting_allocate(void *vctx, size_t size)
+{
+    counting_allocator_t  *ctx = vctx;
+    size_t  real_size = size;
+
+    if (ctx->round_to > 0)
+        real_size = ((size + ctx->round_to - 1) / ctx->round_to)
+            * ctx->round_to;
+
+    ctx->allocations++;
+    return malloc(real_size);
+}
+
+static void *
+counting_reallocate(void *vctx, void *ptr, size_t old_size, size_t new_size)
+{
+    counting_allocator_t  *ctx = vctx;
+    size_t  real_size = new_size;
+
+    if (ctx->round_to > 0)
+        real_size = ((new_size + ctx->round_to - 1) / ctx->round_to)
+            * ctx->round_to;
+
+    return realloc(ptr, real_size);
+}
+
+static void
+counting_deallocate(void *vctx, void *ptr, size_t size)
+{
+    counting_allocator_t  *ctx = vctx;
+    ctx->frees++;
+    free(ptr);
+}
+
+static size_t
+counting_usable_size(void *vctx, void *ptr, size_t size)
+{
+    counting_allocator_t  *ctx = vctx;
+
+    if (ctx->round_to == 0)
+        return size;
+
+    return ((size + ctx->round_to - 1) / ctx->round_to) * ctx->round_to;
+}
+
+static const hwm_allocator_t  counting_allocator =
+{
+    counting_allocate,
+    counting_reallocate,
+    counting_deallocate,
+    counting_usable_size,
+    NULL
+};
+
+
 /*-----------------------------------------------------------------------
  * Test cases
  */
@@ -838,6 +915,2523 @@ START_TEST(test_ensure_list_size_01)
 END_TEST
 
 
+START_TEST(test_growth_exact_01)
+{
+    hwm_buffer_t  buf;
+    size_t  i;
+
+    /*
+     * With the exact policy, every append that passes the high-water
+     * mark needs its own allocation.
+     */
+
+    hwm_buffer_init_with_growth(&buf, &hwm_growth_exact);
+    for (i = 0; i < LENGTH_02; i++)
+    {
+        fail_unless(hwm_buffer_append_mem(&buf, DATA_02 + i, 1),
+                    "Cannot append HWM buffer");
+    }
+
+    fail_unless_buf_matches(&buf, DATA_02, LENGTH_02);
+    fail_unless(buf.allocation_count == LENGTH_02,
+                "Didn't allocate the right number of times "
+                "(got %u, expected %zu)",
+                buf.allocation_count, LENGTH_02);
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_growth_double_01)
+{
+    hwm_buffer_t  buf;
+    size_t  i;
+
+    /*
+     * Appending 20 bytes one at a time should allocate 1, 2, 4, 8,
+     * 16, and 32 bytes.
+     */
+
+    hwm_buffer_init_with_growth(&buf, &hwm_growth_double);
+    for (i = 0; i < LENGTH_02; i++)
+    {
+        fail_unless(hwm_buffer_append_mem(&buf, DATA_02 + i, 1),
+                    "Cannot append HWM buffer");
+    }
+
+    fail_unless_buf_matches(&buf, DATA_02, LENGTH_02);
+    fail_unless(buf.allocation_count == 6,
+                "Didn't allocate the right number of times "
+                "(got %u, expected %u)",
+                buf.allocation_count, 6);
+    fail_unless(buf.allocated_size == 32,
+                "Buffer didn't allocate the right amount memory "
+                "(got %zu bytes, expected %zu)",
+                buf.allocated_size, (size_t) 32);
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_growth_size_class_01)
+{
+    hwm_buffer_t  buf = HWM_BUFFER_INIT_WITH_GROWTH(&hwm_growth_size_class);
+
+    fail_unless(hwm_buffer_ensure_size(&buf, 10),
+                "Cannot grow HWM buffer");
+    fail_unless(buf.allocated_size == 16,
+                "Buffer didn't allocate the right amount memory "
+                "(got %zu bytes, expected %zu)",
+                buf.allocated_size, (size_t) 16);
+
+    fail_unless(hwm_buffer_ensure_size(&buf, 33),
+                "Cannot grow HWM buffer");
+    fail_unless(buf.allocated_size == 40,
+                "Buffer didn't allocate the right amount memory "
+                "(got %zu bytes, expected %zu)",
+                buf.allocated_size, (size_t) 40);
+
+    fail_unless(hwm_buffer_ensure_size(&buf, 1000),
+                "Cannot grow HWM buffer");
+    fail_unless(buf.allocated_size == 1024,
+                "Buffer didn't allocate the right amount memory "
+                "(got %zu bytes, expected %zu)",
+                buf.allocated_size, (size_t) 1024);
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_growth_capped_linear_01)
+{
+    static const hwm_growth_policy_t  policy =
+        HWM_GROWTH_CAPPED_LINEAR(64);
+    hwm_buffer_t  buf;
+
+    /*
+     * Below the threshold we double, but never past the threshold
+     * itself; above it we grow in threshold-sized steps.
+     */
+
+    hwm_buffer_init_with_growth(&buf, &policy);
+    fail_unless(hwm_buffer_ensure_size(&buf, 40),
+                "Cannot grow HWM buffer");
+    fail_unless(hwm_buffer_ensure_size(&buf, 41),
+                "Cannot grow HWM buffer");
+    fail_unless(buf.allocated_size == 64,
+                "Buffer didn't allocate the right amount memory "
+                "(got %zu bytes, expected %zu)",
+                buf.allocated_size, (size_t) 64);
+
+    fail_unless(hwm_buffer_ensure_size(&buf, 65),
+                "Cannot grow HWM buffer");
+    fail_unless(buf.allocated_size == 128,
+                "Buffer didn't allocate the right amount memory "
+                "(got %zu bytes, expected %zu)",
+                buf.allocated_size, (size_t) 128);
+
+    fail_unless(hwm_buffer_ensure_size(&buf, 129),
+                "Cannot grow HWM buffer");
+    fail_unless(buf.allocated_size == 192,
+                "Buffer didn't allocate the right amount memory "
+                "(got %zu bytes, expected %zu)",
+                buf.allocated_size, (size_t) 192);
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_allocator_01)
+{
+    counting_allocator_t  ctx = { 0, 0, 0 };
+    hwm_buffer_t  *buf;
+
+    /*
+     * Both the buffer struct and its storage should come from our
+     * allocator, and should all be returned to it.
+     */
+
+    buf = hwm_buffer_new_with_allocator(&counting_allocator, &ctx);
+    fail_if(buf == NULL,
+            "Cannot allocate HWM buffer");
+    fail_unless(hwm_buffer_load_mem(buf, DATA_01, LENGTH_01),
+                "Cannot load HWM buffer");
+    fail_unless(hwm_buffer_append_mem(buf, DATA_01, LENGTH_01),
+                "Cannot append HWM buffer");
+    fail_unless_buf_matches(buf, DATA_02, LENGTH_02);
+    fail_unless(ctx.allocations == 2,
+                "Didn't use the allocator the right number of times "
+                "(got %zu, expected %zu)",
+                ctx.allocations, (size_t) 2);
+
+    hwm_buffer_free(buf);
+    fail_unless(ctx.frees == 2,
+                "Didn't free through the allocator "
+                "(got %zu, expected %zu)",
+                ctx.frees, (size_t) 2);
+}
+END_TEST
+
+
+START_TEST(test_allocator_usable_size_01)
+{
+    counting_allocator_t  ctx = { 0, 0, 16 };
+    hwm_buffer_t  buf = HWM_BUFFER_INIT_WITH_ALLOCATOR
+        (&counting_allocator, &ctx);
+
+    /*
+     * The allocator rounds up to 16 bytes, so loading 10 and then 15
+     * bytes should only need one allocation.
+     */
+
+    fail_unless(hwm_buffer_load_mem(&buf, DATA_01, LENGTH_01),
+                "Cannot load HWM buffer");
+    fail_unless(buf.allocated_size == 16,
+                "Buffer didn't allocate the right amount memory "
+                "(got %zu bytes, expected %zu)",
+                buf.allocated_size, (size_t) 16);
+    fail_unless(hwm_buffer_load_mem(&buf, DATA_02, 15),
+                "Cannot load HWM buffer");
+    fail_unless_buf_matches(&buf, DATA_02, 15);
+    fail_unless(buf.allocation_count == 1,
+                "Didn't allocate the right number of times "
+                "(got %u, expected %u)",
+                buf.allocation_count, 1);
+
+    hwm_buffer_done(&buf);
+    fail_unless(ctx.frees == 1,
+                "Didn't free through the allocator "
+                "(got %zu, expected %zu)",
+                ctx.frees, (size_t) 1);
+}
+END_TEST
+
+
+START_TEST(test_trim_01)
+{
+    hwm_buffer_t  buf;
+
+    /*
+     * Trimming shouldn't discard the buffer's current contents.
+     */
+
+    hwm_buffer_init(&buf);
+    fail_unless(hwm_buffer_load_mem(&buf, DATA_02, LENGTH_02),
+                "Cannot load HWM buffer");
+    fail_unless(hwm_buffer_load_mem(&buf, DATA_01, LENGTH_01),
+                "Cannot load HWM buffer");
+    fail_unless(hwm_buffer_trim(&buf, 0),
+                "Cannot trim HWM buffer");
+    fail_unless_buf_matches(&buf, DATA_01, LENGTH_01);
+    fail_unless(buf.allocated_size == LENGTH_01,
+                "Buffer didn't allocate the right amount memory "
+                "(got %zu bytes, expected %zu)",
+                buf.allocated_size, LENGTH_01);
+
+    /*
+     * Once the buffer is empty, trimming to 0 frees everything.
+     */
+
+    fail_unless(hwm_buffer_clear(&buf),
+                "Cannot clear HWM buffer");
+    fail_unless(hwm_buffer_trim(&buf, 0),
+                "Cannot trim HWM buffer");
+    fail_unless(buf.buf == NULL,
+                "Trimming to 0 should free the buffer's storage");
+    fail_unless(hwm_buffer_load_mem(&buf, DATA_01, LENGTH_01),
+                "Cannot load HWM buffer");
+    fail_unless_buf_matches(&buf, DATA_01, LENGTH_01);
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_decay_01)
+{
+    hwm_buffer_t  buf;
+    char  large[1000];
+    unsigned int  i;
+
+    memset(large, 'x', sizeof(large));
+
+    /*
+     * One large value, followed by three cycles of small ones,
+     * should shrink the buffer down to the small size.
+     */
+
+    hwm_buffer_init(&buf);
+    hwm_buffer_set_decay(&buf, 3);
+
+    fail_unless(hwm_buffer_load_mem(&buf, large, sizeof(large)),
+                "Cannot load HWM buffer");
+    fail_unless(hwm_buffer_clear(&buf),
+                "Cannot clear HWM buffer");
+
+    for (i = 0; i < 3; i++)
+    {
+        fail_unless(buf.allocated_size == sizeof(large),
+                    "Buffer shrank too early (cycle %u)", i);
+        fail_unless(hwm_buffer_load_mem(&buf, DATA_01, LENGTH_01),
+                    "Cannot load HWM buffer");
+        fail_unless(hwm_buffer_clear(&buf),
+                    "Cannot clear HWM buffer");
+    }
+
+    fail_unless(buf.allocated_size == LENGTH_01,
+                "Buffer didn't allocate the right amount memory "
+                "(got %zu bytes, expected %zu)",
+                buf.allocated_size, LENGTH_01);
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_mmap_01)
+{
+    hwm_mmap_config_t  config = HWM_MMAP_CONFIG_INIT(65536, 0);
+    hwm_buffer_t  buf;
+    char  chunk[4096];
+    size_t  i;
+    size_t  j;
+
+    /*
+     * Grow a buffer across the mmap threshold and well past it, then
+     * shrink it back below the threshold, checking the contents along
+     * the way.
+     */
+
+    hwm_buffer_init_with_mmap(&buf, &config);
+    hwm_buffer_set_growth(&buf, &hwm_growth_double);
+
+    for (i = 0; i < 256; i++)
+    {
+        memset(chunk, (int) i, sizeof(chunk));
+        fail_unless(hwm_buffer_append_mem(&buf, chunk, sizeof(chunk)),
+                    "Cannot append HWM buffer");
+    }
+
+    fail_unless(buf.allocated_size == 256 * sizeof(chunk),
+                "Buffer didn't allocate the right amount memory "
+                "(got %zu bytes, expected %zu)",
+                buf.allocated_size, 256 * sizeof(chunk));
+    fail_unless(((uintptr_t) buf.buf % 4096) == 0,
+                "Large buffer should be page-aligned");
+
+    for (i = 0; i < 256; i++)
+    {
+        for (j = 0; j < sizeof(chunk); j++)
+        {
+            fail_unless(hwm_buffer_mem(&buf, uint8_t)
+                        [i * sizeof(chunk) + j] == (uint8_t) i,
+                        "Data doesn't match: different contents");
+        }
+    }
+
+    fail_unless(hwm_buffer_load_mem(&buf, DATA_01, LENGTH_01),
+                "Cannot load HWM buffer");
+    fail_unless(hwm_buffer_trim(&buf, 0),
+                "Cannot trim HWM buffer");
+    fail_unless_buf_matches(&buf, DATA_01, LENGTH_01);
+    fail_unless(buf.allocated_size == LENGTH_01,
+                "Buffer didn't allocate the right amount memory "
+                "(got %zu bytes, expected %zu)",
+                buf.allocated_size, LENGTH_01);
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_mmap_reserve_01)
+{
+    hwm_mmap_config_t  config = HWM_MMAP_CONFIG_INIT(4096, 1 << 20);
+    hwm_buffer_t  buf;
+    char  chunk[4096];
+    size_t  i;
+
+    /*
+     * With a reservation, the buffer should be able to grow to 1MB
+     * with only the initial allocation.
+     */
+
+    memset(chunk, 'x', sizeof(chunk));
+    hwm_buffer_init_with_mmap(&buf, &config);
+
+    for (i = 0; i < 256; i++)
+    {
+        fail_unless(hwm_buffer_append_mem(&buf, chunk, sizeof(chunk)),
+                    "Cannot append HWM buffer");
+    }
+
+    fail_unless(buf.allocation_count == 1,
+                "Didn't allocate the right number of times "
+                "(got %u, expected %u)",
+                buf.allocation_count, 1);
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_mmap_advise_01)
+{
+    hwm_mmap_config_t  config = HWM_MMAP_CONFIG_INIT(65536, 0);
+    hwm_buffer_t  buf;
+    size_t  size = 4 * 1024 * 1024;
+    uint8_t  *mem;
+    size_t  i;
+
+    /*
+     * A large buffer should be aligned for huge pages, and clearing
+     * it with DONTNEED should hand its pages back to the kernel, which
+     * we can see because they read back as zeroes.
+     */
+
+    hwm_buffer_init_with_mmap(&buf, &config);
+    hwm_buffer_set_advice(&buf,
+                          HWM_BUFFER_ADVISE_HUGEPAGE |
+                          HWM_BUFFER_ADVISE_SEQUENTIAL |
+                          HWM_BUFFER_ADVISE_DONTNEED_ON_CLEAR);
+
+    fail_unless(hwm_buffer_ensure_size(&buf, size),
+                "Cannot grow HWM buffer");
+    fail_unless(((uintptr_t) buf.buf % (2 * 1024 * 1024)) == 0,
+                "Large buffer should be aligned to a huge page");
+
+    memset(buf.buf, 'x', size);
+    fail_unless(hwm_buffer_clear(&buf),
+                "Cannot clear HWM buffer");
+
+    mem = (uint8_t *) buf.buf;
+    for (i = 0; i < size; i += 4096)
+    {
+        fail_unless(mem[i] == 0,
+                    "Cleared pages should have been released");
+    }
+
+    fail_unless(hwm_buffer_load_mem(&buf, DATA_01, LENGTH_01),
+                "Cannot load HWM buffer");
+    fail_unless_buf_matches(&buf, DATA_01, LENGTH_01);
+    fail_unless(buf.allocation_count == 1,
+                "Didn't allocate the right number of times "
+                "(got %u, expected %u)",
+                buf.allocation_count, 1);
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+/*
+ * Create a temporary file containing the given data, and return its
+ * name in path, which must be at least 64 bytes long.
+ */
+
+static void
+make_temp_file(char *path, const void *data, size_t size)
+{
+    int  fd;
+
+    strcpy(path, "/tmp/test-hwm-buffer-XXXXXX");
+    fd = mkstemp(path);
+    fail_if(fd < 0, "Cannot create temporary file");
+    fail_unless(write(fd, data, size) == (ssize_t) size,
+                "Cannot write temporary file");
+    close(fd);
+}
+
+
+START_TEST(test_load_file_01)
+{
+    hwm_buffer_t  buf;
+    char  path[64];
+    char  *str;
+
+    /*
+     * Loading a file should map it without allocating anything, and
+     * writing to the buffer should copy it into our own storage
+     * without changing the file.
+     */
+
+    make_temp_file(path, DATA_02, LENGTH_02);
+
+    hwm_buffer_init(&buf);
+    fail_unless(hwm_buffer_load_file(&buf, path, 0),
+                "Cannot load file");
+    fail_unless_buf_matches(&buf, DATA_02, LENGTH_02);
+    fail_unless(buf.allocation_count == 0,
+                "Didn't allocate the right number of times "
+                "(got %u, expected %u)",
+                buf.allocation_count, 0);
+
+    str = hwm_buffer_writable_mem(&buf, char);
+    fail_if(str == NULL,
+            "Cannot get writable pointer");
+    fail_unless_buf_matches(&buf, DATA_02, LENGTH_02);
+    str[0] = 'Q';
+    hwm_buffer_done(&buf);
+
+    hwm_buffer_init(&buf);
+    fail_unless(hwm_buffer_load_file(&buf, path,
+                                     HWM_BUFFER_LOAD_FILE_NO_MMAP),
+                "Cannot load file");
+    fail_unless_buf_matches(&buf, DATA_02, LENGTH_02);
+    fail_unless(hwm_buffer_append_mem(&buf, DATA_01, LENGTH_01),
+                "Cannot append HWM buffer");
+    hwm_buffer_done(&buf);
+
+    unlink(path);
+}
+END_TEST
+
+
+START_TEST(test_load_file_append_01)
+{
+    hwm_buffer_t  buf;
+    char  path[64];
+
+    /*
+     * Appending to a mapped file should copy it first.
+     */
+
+    make_temp_file(path, DATA_01, LENGTH_01);
+
+    hwm_buffer_init(&buf);
+    fail_unless(hwm_buffer_load_file(&buf, path, 0),
+                "Cannot load file");
+    fail_unless(hwm_buffer_append_mem(&buf, DATA_01, LENGTH_01),
+                "Cannot append HWM buffer");
+    fail_unless_buf_matches(&buf, DATA_02, LENGTH_02);
+    fail_unless(buf.mapping == NULL,
+                "Mapping should be released after appending");
+    hwm_buffer_done(&buf);
+
+    unlink(path);
+}
+END_TEST
+
+
+START_TEST(test_load_fd_pipe_01)
+{
+    hwm_buffer_t  buf;
+    int  fds[2];
+
+    /*
+     * Pipes can't be mapped, so we should fall back on reading.
+     */
+
+    fail_unless(pipe(fds) == 0,
+                "Cannot create pipe");
+    fail_unless(write(fds[1], DATA_02, LENGTH_02) == (ssize_t) LENGTH_02,
+                "Cannot write to pipe");
+    close(fds[1]);
+
+    hwm_buffer_init(&buf);
+    fail_unless(hwm_buffer_load_fd(&buf, fds[0], 0),
+                "Cannot load pipe");
+    fail_unless_buf_matches(&buf, DATA_02, LENGTH_02);
+    close(fds[0]);
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_append_from_fd_01)
+{
+    hwm_buffer_t  buf;
+    int  fds[2];
+
+    /*
+     * Each call should append at most the requested number of bytes
+     * after whatever's already in the buffer.
+     */
+
+    fail_unless(pipe(fds) == 0,
+                "Cannot create pipe");
+    fail_unless(write(fds[1], DATA_01, LENGTH_01) == (ssize_t) LENGTH_01,
+                "Cannot write to pipe");
+    close(fds[1]);
+
+    hwm_buffer_init(&buf);
+    fail_unless(hwm_buffer_append_mem(&buf, DATA_02, LENGTH_02),
+                "Cannot append data");
+    fail_unless(hwm_buffer_append_from_fd(&buf, fds[0], 4) == 4,
+                "Should read 4 bytes");
+    fail_unless(hwm_buffer_append_from_fd(&buf, fds[0], 0) == 6,
+                "Should read remaining 6 bytes");
+    fail_unless(hwm_buffer_append_from_fd(&buf, fds[0], 0) == 0,
+                "Should be at end-of-file");
+    fail_unless_buf_matches(&buf, DATA_03, LENGTH_03);
+    close(fds[0]);
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_append_from_fd_nonblocking_01)
+{
+    hwm_buffer_t  buf;
+    int  fds[2];
+    size_t  bytes_read;
+
+    /*
+     * A non-blocking descriptor with no data should report EAGAIN,
+     * without losing anything that was read before it.
+     */
+
+    fail_unless(pipe(fds) == 0,
+                "Cannot create pipe");
+    fail_unless(fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0,
+                "Cannot make pipe non-blocking");
+
+    hwm_buffer_init(&buf);
+    fail_unless(hwm_buffer_append_from_fd(&buf, fds[0], 0) == -1 &&
+                (errno == EAGAIN || errno == EWOULDBLOCK),
+                "Empty pipe should report EAGAIN");
+
+    fail_unless(write(fds[1], DATA_01, LENGTH_01) == (ssize_t) LENGTH_01,
+                "Cannot write to pipe");
+    fail_unless(!hwm_buffer_append_from_fd_until_eof
+                (&buf, fds[0], &bytes_read) &&
+                (errno == EAGAIN || errno == EWOULDBLOCK),
+                "Drained pipe should report EAGAIN");
+    fail_unless(bytes_read == LENGTH_01,
+                "Should have read %zu bytes, got %zu",
+                LENGTH_01, bytes_read);
+
+    fail_unless(write(fds[1], DATA_02, LENGTH_02) == (ssize_t) LENGTH_02,
+                "Cannot write to pipe");
+    close(fds[1]);
+    fail_unless(hwm_buffer_append_from_fd_until_eof
+                (&buf, fds[0], &bytes_read),
+                "Should reach end-of-file");
+    fail_unless(bytes_read == LENGTH_02,
+                "Should have read %zu bytes, got %zu",
+                LENGTH_02, bytes_read);
+    fail_unless_buf_matches(&buf, DATA_03, LENGTH_03);
+
+    close(fds[0]);
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_point_at_append_from_fd_01)
+{
+    hwm_buffer_t  buf;
+    int  fds[2];
+    size_t  bytes_read;
+
+    /*
+     * Reading into a buffer that points at someone else's memory
+     * should copy that memory first.
+     */
+
+    fail_unless(pipe(fds) == 0,
+                "Cannot create pipe");
+    fail_unless(write(fds[1], DATA_02, LENGTH_02) == (ssize_t) LENGTH_02,
+                "Cannot write to pipe");
+    close(fds[1]);
+
+    hwm_buffer_init(&buf);
+    hwm_buffer_point_at_mem(&buf, DATA_01, LENGTH_01);
+    fail_unless(hwm_buffer_append_from_fd_until_eof
+                (&buf, fds[0], &bytes_read),
+                "Should reach end-of-file");
+    fail_unless(bytes_read == LENGTH_02,
+                "Should have read %zu bytes, got %zu",
+                LENGTH_02, bytes_read);
+    fail_unless_buf_matches(&buf, DATA_03, LENGTH_03);
+    close(fds[0]);
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_write_fd_01)
+{
+    hwm_buffer_t  header;
+    hwm_buffer_t  empty;
+    hwm_buffer_t  body;
+    const hwm_buffer_t  *bufs[3] = { &header, &empty, &body };
+    hwm_buffer_t  buf;
+    int  fds[2];
+    size_t  written = 0;
+
+    /*
+     * Owned, empty, and pointed-at buffers should all be written in
+     * order.
+     */
+
+    hwm_buffer_init(&header);
+    hwm_buffer_init(&empty);
+    hwm_buffer_init(&body);
+    hwm_buffer_init(&buf);
+
+    fail_unless(hwm_buffer_load_mem(&header, DATA_02, LENGTH_02),
+                "Cannot load header");
+    hwm_buffer_point_at_mem(&body, DATA_01, LENGTH_01);
+
+    fail_unless(pipe(fds) == 0,
+                "Cannot create pipe");
+    fail_unless(hwm_buffer_write_fd(fds[1], bufs, 3, &written),
+                "Cannot write buffers");
+    fail_unless(written == LENGTH_03,
+                "Should have written %zu bytes, got %zu",
+                LENGTH_03, written);
+    close(fds[1]);
+
+    fail_unless(hwm_buffer_append_from_fd_until_eof(&buf, fds[0], NULL),
+                "Cannot read pipe");
+    fail_unless_buf_matches(&buf, DATA_03, LENGTH_03);
+    close(fds[0]);
+
+    hwm_buffer_done(&header);
+    hwm_buffer_done(&empty);
+    hwm_buffer_done(&body);
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_write_fd_resume_01)
+{
+    hwm_buffer_t  big;
+    hwm_buffer_t  small;
+    const hwm_buffer_t  *bufs[2] = { &big, &small };
+    hwm_buffer_t  buf;
+    int  fds[2];
+    size_t  written = 0;
+    size_t  big_size = 1024 * 1024;
+    size_t  i;
+    unsigned char  *mem;
+    bool  done = false;
+
+    /*
+     * Writing more than a pipe can hold to a non-blocking pipe should
+     * stop with EAGAIN, and pick up where it left off.
+     */
+
+    hwm_buffer_init(&big);
+    hwm_buffer_init(&small);
+    hwm_buffer_init(&buf);
+
+    fail_unless(hwm_buffer_ensure_size(&big, big_size),
+                "Cannot allocate buffer");
+    mem = hwm_buffer_writable_mem(&big, unsigned char);
+    for (i = 0; i < big_size; i++)
+        mem[i] = i * 7;
+    big.current_size = big_size;
+    hwm_buffer_point_at_mem(&small, DATA_01, LENGTH_01);
+
+    fail_unless(pipe(fds) == 0,
+                "Cannot create pipe");
+    fail_unless(fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0 &&
+                fcntl(fds[1], F_SETFL, O_NONBLOCK) == 0,
+                "Cannot make pipe non-blocking");
+
+    while (!done)
+    {
+        done = hwm_buffer_write_fd(fds[1], bufs, 2, &written);
+        fail_unless(done || errno == EAGAIN || errno == EWOULDBLOCK,
+                    "Unexpected write error");
+        fail_unless(!hwm_buffer_append_from_fd_until_eof
+                    (&buf, fds[0], NULL) &&
+                    (errno == EAGAIN || errno == EWOULDBLOCK),
+                    "Unexpected read error");
+    }
+
+    fail_unless(written == big_size + LENGTH_01,
+                "Should have written %zu bytes, got %zu",
+                big_size + LENGTH_01, written);
+    fail_unless(buf.current_size == big_size + LENGTH_01,
+                "Should have read %zu bytes, got %zu",
+                big_size + LENGTH_01, buf.current_size);
+    fail_unless(memcmp(buf.data, big.data, big_size) == 0 &&
+                memcmp(buf.data + big_size, DATA_01, LENGTH_01) == 0,
+                "Data doesn't match");
+
+    close(fds[0]);
+    close(fds[1]);
+    hwm_buffer_done(&big);
+    hwm_buffer_done(&small);
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_consume_01)
+{
+    hwm_buffer_t  buf;
+
+    hwm_buffer_init(&buf);
+    fail_unless(hwm_buffer_load_mem(&buf, DATA_02, LENGTH_02),
+                "Cannot load data");
+
+    hwm_buffer_consume(&buf, 4);
+    fail_unless_buf_matches(&buf, DATA_02 + 4, LENGTH_02 - 4);
+
+    hwm_buffer_consume(&buf, 6);
+    fail_unless_buf_matches(&buf, DATA_02 + 10, LENGTH_02 - 10);
+
+    /*
+     * Consuming everything should reset the buffer to the start of
+     * its storage.
+     */
+
+    hwm_buffer_consume(&buf, 100);
+    fail_unless(buf.current_size == 0,
+                "Buffer should be empty");
+    fail_unless(buf.data == buf.buf,
+                "Empty buffer should point at the start of its storage");
+
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_consume_compact_01)
+{
+    hwm_buffer_t  buf;
+    unsigned int  allocation_count;
+
+    /*
+     * Appending after consuming most of the buffer should move the
+     * remaining data back to the start, rather than growing.
+     */
+
+    hwm_buffer_init(&buf);
+    fail_unless(hwm_buffer_load_mem(&buf, DATA_02, LENGTH_02),
+                "Cannot load data");
+    allocation_count = buf.allocation_count;
+
+    hwm_buffer_consume(&buf, 15);
+    fail_unless(hwm_buffer_append_mem(&buf, DATA_01, LENGTH_01),
+                "Cannot append data");
+
+    fail_unless(buf.allocation_count == allocation_count,
+                "Buffer shouldn't have been reallocated");
+    fail_unless(buf.data == buf.buf,
+                "Buffer should have been compacted");
+    fail_unless_buf_matches(&buf, "56789" "0123456789", 15);
+
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_consume_load_01)
+{
+    hwm_buffer_t  buf;
+    size_t  i;
+
+    /*
+     * Loading new contents after consuming some of the old ones
+     * should reuse the consumed space, rather than growing past it.
+     */
+
+    hwm_buffer_init(&buf);
+
+    for (i = 0; i < 2; i++)
+    {
+        char  data[2000];
+
+        memset(data, 'a' + i, sizeof(data));
+        fail_unless(hwm_buffer_load_mem(&buf, data, 1000),
+                    "Cannot load data");
+        hwm_buffer_consume(&buf, 100);
+
+        if (i == 0)
+        {
+            fail_unless(hwm_buffer_load_mem(&buf, data, 2000),
+                        "Cannot load data");
+            fail_unless_buf_matches(&buf, data, 2000);
+        } else {
+            data[1999] = '\0';
+            fail_unless(hwm_buffer_load_str(&buf, data),
+                        "Cannot load string");
+            fail_unless_buf_matches(&buf, data, 2000);
+        }
+
+        fail_unless(buf.allocated_size == 2000,
+                    "Buffer is the wrong size (got %zu, expected %zu)",
+                    buf.allocated_size, (size_t) 2000);
+        fail_unless(buf.consumed == 0 && buf.data == buf.buf,
+                    "Consumed space should have been reclaimed");
+    }
+
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_consume_no_compact_01)
+{
+    hwm_buffer_t  buf;
+    const void  *data;
+
+    /*
+     * If only a little has been consumed, and there's room after the
+     * contents, appending shouldn't move anything.
+     */
+
+    hwm_buffer_init(&buf);
+    fail_unless(hwm_buffer_ensure_size(&buf, 64),
+                "Cannot allocate buffer");
+    fail_unless(hwm_buffer_load_mem(&buf, DATA_02, LENGTH_02),
+                "Cannot load data");
+
+    hwm_buffer_consume(&buf, 2);
+    data = buf.data;
+    fail_unless(hwm_buffer_append_mem(&buf, DATA_01, LENGTH_01),
+                "Cannot append data");
+    fail_unless(buf.data == data,
+                "Buffer shouldn't have been compacted");
+    fail_unless_buf_matches(&buf, "234567890123456789" "0123456789", 28);
+
+    /*
+     * Growing past the end of the storage, with only a few bytes
+     * consumed, should keep the consumed prefix.
+     */
+
+    fail_unless(hwm_buffer_append_mem(&buf, DATA_03, LENGTH_03),
+                "Cannot append data");
+    fail_unless(buf.data == buf.buf + 2,
+                "Buffer shouldn't have been compacted");
+    fail_unless(buf.allocated_size >= 2 + 28 + LENGTH_03,
+                "Buffer is too small");
+    fail_unless(memcmp(hwm_buffer_mem(&buf, char) + 28,
+                       DATA_03, LENGTH_03) == 0,
+                "Data doesn't match");
+
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_consume_list_01)
+{
+    hwm_buffer_t  buf;
+    uint32_t  *elem;
+    uint32_t  i;
+
+    /*
+     * The list macros should only see the elements that haven't been
+     * consumed.
+     */
+
+    hwm_buffer_init(&buf);
+
+    for (i = 0; i < 8; i++)
+    {
+        elem = hwm_buffer_append_list_elem(&buf, uint32_t);
+        fail_if(elem == NULL,
+                "Cannot append list element");
+        *elem = i;
+    }
+
+    hwm_buffer_consume(&buf, 3 * sizeof(uint32_t));
+    fail_unless(hwm_buffer_current_list_size(&buf, uint32_t) == 5,
+                "List should have 5 elements");
+    fail_unless(*hwm_buffer_list_elem(&buf, uint32_t, 0) == 3,
+                "First element should be 3");
+
+    elem = hwm_buffer_append_list_elem(&buf, uint32_t);
+    fail_if(elem == NULL,
+            "Cannot append list element");
+    *elem = 8;
+
+    for (i = 0; i < 6; i++)
+    {
+        fail_unless(*hwm_buffer_list_elem(&buf, uint32_t, i) == i + 3,
+                    "Element %u is wrong", (unsigned int) i);
+    }
+
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_point_at_consume_01)
+{
+    hwm_buffer_t  buf;
+
+    /*
+     * Consuming from memory that the buffer doesn't own should just
+     * move the pointer.
+     */
+
+    hwm_buffer_init(&buf);
+    hwm_buffer_point_at_mem(&buf, DATA_02, LENGTH_02);
+    hwm_buffer_consume(&buf, 5);
+    fail_unless(buf.data == DATA_02 + 5,
+                "Buffer should point into the original data");
+    fail_unless(hwm_buffer_append_mem(&buf, DATA_01, LENGTH_01),
+                "Cannot append data");
+    fail_unless_buf_matches(&buf, "567890123456789" "0123456789", 25);
+
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_reserve_01)
+{
+    hwm_buffer_t  buf;
+    char  *dest;
+    int  length;
+
+    /*
+     * A producer should be able to write straight into the reserved
+     * space, and only what it commits should be added.
+     */
+
+    hwm_buffer_init(&buf);
+    fail_unless(hwm_buffer_append_mem(&buf, DATA_01, LENGTH_01),
+                "Cannot append data");
+
+    dest = hwm_buffer_reserve(&buf, 32);
+    fail_if(dest == NULL,
+            "Cannot reserve space");
+    fail_unless(buf.allocated_size >= LENGTH_01 + 32,
+                "Buffer is too small");
+    fail_unless(buf.current_size == LENGTH_01,
+                "Reserving shouldn't change the buffer's size");
+
+    length = snprintf(dest, 32, "%s", DATA_02);
+    hwm_buffer_commit(&buf, length);
+    fail_unless_buf_matches(&buf, DATA_03, LENGTH_03);
+
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_point_at_reserve_01)
+{
+    hwm_buffer_t  buf;
+    char  *dest;
+
+    /*
+     * Reserving space in a buffer that points at someone else's
+     * memory should copy that memory first.
+     */
+
+    hwm_buffer_init(&buf);
+    hwm_buffer_point_at_mem(&buf, DATA_01, LENGTH_01);
+
+    dest = hwm_buffer_reserve(&buf, LENGTH_02);
+    fail_if(dest == NULL,
+            "Cannot reserve space");
+    fail_if(hwm_buffer_mem(&buf, char) == DATA_01,
+            "Buffer should have copied its data");
+    memcpy(dest, DATA_02, LENGTH_02);
+    hwm_buffer_commit(&buf, LENGTH_02);
+    fail_unless_buf_matches(&buf, DATA_03, LENGTH_03);
+
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_reserve_list_01)
+{
+    hwm_buffer_t  buf;
+    uint32_t  *elems;
+    uint32_t  i;
+
+    hwm_buffer_init(&buf);
+
+    elems = hwm_buffer_reserve_list_elems(&buf, uint32_t, 4);
+    fail_if(elems == NULL,
+            "Cannot reserve list elements");
+    for (i = 0; i < 3; i++)
+        elems[i] = i;
+    hwm_buffer_commit_list_elems(&buf, uint32_t, 3);
+
+    elems = hwm_buffer_reserve_list_elems(&buf, uint32_t, 5);
+    fail_if(elems == NULL,
+            "Cannot reserve list elements");
+    for (i = 0; i < 5; i++)
+        elems[i] = i + 3;
+    hwm_buffer_commit_list_elems(&buf, uint32_t, 5);
+
+    fail_unless(hwm_buffer_current_list_size(&buf, uint32_t) == 8,
+                "List should have 8 elements");
+
+    for (i = 0; i < 8; i++)
+    {
+        fail_unless(*hwm_buffer_list_elem(&buf, uint32_t, i) == i,
+                    "Element %u is wrong", (unsigned int) i);
+    }
+
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_append_iov_01)
+{
+    hwm_buffer_t  buf;
+    struct iovec  iov[3];
+    unsigned int  allocation_count;
+
+    /*
+     * Appending several pieces should only grow the buffer once.
+     */
+
+    hwm_buffer_init(&buf);
+    fail_unless(hwm_buffer_append_mem(&buf, DATA_01, 4),
+                "Cannot append data");
+    allocation_count = buf.allocation_count;
+
+    iov[0].iov_base = (void *) (DATA_01 + 4);
+    iov[0].iov_len = 6;
+    iov[1].iov_base = (void *) DATA_01;
+    iov[1].iov_len = 0;
+    iov[2].iov_base = (void *) DATA_02;
+    iov[2].iov_len = LENGTH_02;
+
+    fail_unless(hwm_buffer_append_iov(&buf, iov, 3),
+                "Cannot append iovecs");
+    fail_unless(buf.allocation_count == allocation_count + 1,
+                "Buffer should only grow once");
+    fail_unless_buf_matches(&buf, DATA_03, LENGTH_03);
+
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_append_mems_01)
+{
+    hwm_buffer_t  buf;
+
+    /*
+     * Appending to a buffer that points at someone else's memory
+     * should copy that memory first.
+     */
+
+    hwm_buffer_init(&buf);
+    hwm_buffer_point_at_mem(&buf, DATA_01, 5);
+
+    fail_unless(hwm_buffer_append_mems(&buf,
+                                       DATA_01 + 5, (size_t) 5,
+                                       DATA_02, LENGTH_02,
+                                       NULL),
+                "Cannot append data");
+    fail_unless(buf.allocation_count == 1,
+                "Buffer should only grow once");
+    fail_unless_buf_matches(&buf, DATA_03, LENGTH_03);
+
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_append_strs_01)
+{
+    hwm_buffer_t  buf;
+    const char  *strs[] = { "45", "", "6789" };
+
+    /*
+     * Each existing NUL terminator should be overwritten, leaving a
+     * single one at the end.
+     */
+
+    hwm_buffer_init(&buf);
+    fail_unless(hwm_buffer_load_str(&buf, "0123"),
+                "Cannot load string");
+    fail_unless(hwm_buffer_append_strv(&buf, strs, 3),
+                "Cannot append strings");
+    fail_unless(hwm_buffer_append_strs(&buf, "0123", "456789", NULL),
+                "Cannot append strings");
+    fail_unless_buf_matches(&buf, "01234567890123456789", 21);
+
+    /*
+     * Appending no strings to an empty buffer gives an empty string.
+     */
+
+    hwm_buffer_clear(&buf);
+    fail_unless(hwm_buffer_append_strs(&buf, NULL),
+                "Cannot append strings");
+    fail_unless_buf_matches(&buf, "", 1);
+
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_appendf_01)
+{
+    hwm_buffer_t  buf;
+
+    hwm_buffer_init(&buf);
+    fail_unless(hwm_buffer_appendf(&buf, "%s", DATA_01),
+                "Cannot append formatted string");
+    fail_unless(hwm_buffer_appendf(&buf, "%c%d%s", '0', 123, "456789"),
+                "Cannot append formatted string");
+    fail_unless(hwm_buffer_appendf(&buf, "%s", DATA_01),
+                "Cannot append formatted string");
+    fail_unless_buf_matches(&buf, DATA_03, LENGTH_03 + 1);
+    fail_unless(strcmp(hwm_buffer_str(&buf), DATA_03) == 0,
+                "Buffer should hold a NUL-terminated string");
+
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_appendf_fits_01)
+{
+    hwm_buffer_t  buf;
+    unsigned int  allocation_count;
+
+    /*
+     * If there's already room for the output, the buffer shouldn't be
+     * reallocated.
+     */
+
+    hwm_buffer_init(&buf);
+    fail_unless(hwm_buffer_ensure_size(&buf, 64),
+                "Cannot allocate buffer");
+    fail_unless(hwm_buffer_load_str(&buf, "0123"),
+                "Cannot load string");
+    allocation_count = buf.allocation_count;
+
+    fail_unless(hwm_buffer_appendf(&buf, "%s%d", "45678", 9),
+                "Cannot append formatted string");
+    fail_unless(buf.allocation_count == allocation_count,
+                "Buffer shouldn't have been reallocated");
+    fail_unless_buf_matches(&buf, DATA_01, LENGTH_01 + 1);
+
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_loadf_01)
+{
+    hwm_buffer_t  buf;
+
+    hwm_buffer_init(&buf);
+    fail_unless(hwm_buffer_load_str(&buf, "garbage"),
+                "Cannot load string");
+    fail_unless(hwm_buffer_loadf(&buf, "%s%s%s", DATA_01, DATA_01,
+                                 DATA_01),
+                "Cannot load formatted string");
+    fail_unless_buf_matches(&buf, DATA_03, LENGTH_03 + 1);
+
+    /*
+     * Loading into a buffer that points at someone else's memory
+     * shouldn't touch that memory.
+     */
+
+    hwm_buffer_point_at_str(&buf, DATA_02);
+    fail_unless(hwm_buffer_loadf(&buf, "%.3s", DATA_01),
+                "Cannot load formatted string");
+    fail_unless_buf_matches(&buf, "012", 4);
+    fail_unless(strcmp(DATA_02, "01234567890123456789") == 0,
+                "Original string was modified");
+
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_append_u64_01)
+{
+    hwm_buffer_t  buf;
+
+    hwm_buffer_init(&buf);
+
+#define APPEND_U64(value) \
+    fail_unless(hwm_buffer_append_u64(&buf, (value)), \
+                "Cannot append integer"); \
+    fail_unless(hwm_buffer_append_mem(&buf, " ", 1), \
+                "Cannot append separator");
+
+    APPEND_U64(0);
+    APPEND_U64(9);
+    APPEND_U64(10);
+    APPEND_U64(99);
+    APPEND_U64(100);
+    APPEND_U64(1000000007);
+    APPEND_U64(UINT64_MAX);
+#undef APPEND_U64
+
+    fail_unless_buf_matches
+        (&buf, "0 9 10 99 100 1000000007 18446744073709551615 ", 46);
+
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_append_i64_01)
+{
+    hwm_buffer_t  buf;
+
+    hwm_buffer_init(&buf);
+    fail_unless(hwm_buffer_append_i64(&buf, INT64_MIN),
+                "Cannot append integer");
+    fail_unless(hwm_buffer_append_i64(&buf, -1),
+                "Cannot append integer");
+    fail_unless(hwm_buffer_append_i64(&buf, INT64_MAX),
+                "Cannot append integer");
+    fail_unless_buf_matches
+        (&buf, "-9223372036854775808-19223372036854775807", 41);
+
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_append_u64_hex_01)
+{
+    hwm_buffer_t  buf;
+
+    hwm_buffer_init(&buf);
+    fail_unless(hwm_buffer_append_u64_hex(&buf, 0),
+                "Cannot append integer");
+    fail_unless(hwm_buffer_append_u64_hex(&buf, 0xdeadbeef),
+                "Cannot append integer");
+    fail_unless(hwm_buffer_append_u64_hex(&buf, UINT64_MAX),
+                "Cannot append integer");
+    fail_unless_buf_matches(&buf, "0deadbeefffffffffffffffff", 25);
+
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_append_double_01)
+{
+    hwm_buffer_t  buf;
+
+    hwm_buffer_init(&buf);
+
+#define APPEND_DOUBLE(value) \
+    fail_unless(hwm_buffer_append_double(&buf, (value)), \
+                "Cannot append double"); \
+    fail_unless(hwm_buffer_append_mem(&buf, " ", 1), \
+                "Cannot append separator");
+
+    APPEND_DOUBLE(0.0);
+    APPEND_DOUBLE(-0.0);
+    APPEND_DOUBLE(123.0);
+    APPEND_DOUBLE(0.1);
+    APPEND_DOUBLE(-1.5);
+    APPEND_DOUBLE(1.0 / 3);
+    APPEND_DOUBLE(0.001);
+    APPEND_DOUBLE(1e-7);
+    APPEND_DOUBLE(1e21);
+    APPEND_DOUBLE(1.5e300);
+    APPEND_DOUBLE(5e-324);
+    APPEND_DOUBLE(1.7976931348623157e308);
+    APPEND_DOUBLE(1.0 / 0.0);
+    APPEND_DOUBLE(-1.0 / 0.0);
+    APPEND_DOUBLE(0.0 / 0.0);
+#undef APPEND_DOUBLE
+
+    fail_unless_buf_matches
+        (&buf,
+         "0 -0 123 0.1 -1.5 0.3333333333333333 0.001 1e-7 1e21 1.5e300 "
+         "5e-324 1.7976931348623157e308 inf -inf nan ", 104);
+
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_append_double_roundtrip_01)
+{
+    hwm_buffer_t  buf;
+    uint64_t  bits = 0x0123456789abcdef;
+    size_t  i;
+
+    hwm_buffer_init(&buf);
+
+    /*
+     * Every finite double should read back as exactly the same value.
+     */
+
+    for (i = 0; i < 100000; i++)
+    {
+        double  value;
+        double  parsed;
+
+        bits ^= bits << 13;
+        bits ^= bits >> 7;
+        bits ^= bits << 17;
+
+        memcpy(&value, &bits, sizeof(value));
+        if (value != value || value - value != 0.0)
+            continue;
+
+        hwm_buffer_clear(&buf);
+        fail_unless(hwm_buffer_append_double(&buf, value),
+                    "Cannot append double");
+        fail_unless(hwm_buffer_append_mem(&buf, "", 1),
+                    "Cannot append terminator");
+
+        parsed = strtod(hwm_buffer_mem(&buf, char), NULL);
+        fail_unless(memcmp(&parsed, &value, sizeof(value)) == 0,
+                    "Double %s doesn't round-trip",
+                    hwm_buffer_mem(&buf, char));
+    }
+
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+/**
+ * Return whether any decimal number with one less significant digit
+ * than str reads back as value.  Such a number would be within one
+ * step of the correctly rounded one, so we only have to try three.
+ */
+
+static bool
+double_has_shorter(double value, const char *str)
+{
+    char  scratch[64];
+    char  digits[32];
+    size_t  digit_count = 0;
+    const char  *c;
+    unsigned long long  nearest;
+    int  exponent;
+    int  delta;
+
+    for (c = str; *c != '\0' && *c != 'e'; c++)
+    {
+        if (*c >= '0' && *c <= '9' && (digit_count > 0 || *c != '0'))
+            digits[digit_count++] = *c;
+    }
+
+    while (digit_count > 0 && digits[digit_count - 1] == '0')
+        digit_count--;
+
+    if (digit_count <= 1)
+        return false;
+
+    snprintf(scratch, sizeof(scratch), "%.*e",
+             (int) digit_count - 2, value);
+    c = strchr(scratch, 'e');
+    exponent = atoi(c + 1) - ((int) digit_count - 2);
+    nearest = 0;
+    for (c = scratch; *c != 'e'; c++)
+    {
+        if (*c >= '0' && *c <= '9')
+            nearest = nearest * 10 + (*c - '0');
+    }
+
+    for (delta = -1; delta <= 1; delta++)
+    {
+        snprintf(scratch, sizeof(scratch), "%llue%d",
+                 nearest + delta, exponent);
+        if (strtod(scratch, NULL) == value)
+            return true;
+    }
+
+    return false;
+}
+
+
+START_TEST(test_append_double_shortest_01)
+{
+    hwm_buffer_t  buf;
+    uint64_t  bits = 0x0123456789abcdef;
+    size_t  i;
+
+    hwm_buffer_init(&buf);
+
+    /*
+     * Some values where a less careful algorithm produces extra
+     * digits.
+     */
+
+    fail_unless(hwm_buffer_append_double(&buf, 122.008356545961),
+                "Cannot append double");
+    fail_unless(hwm_buffer_append_mem(&buf, " ", 1),
+                "Cannot append separator");
+    fail_unless(hwm_buffer_append_double(&buf, 1.2177806878781e-27),
+                "Cannot append double");
+    fail_unless(hwm_buffer_append_mem(&buf, " ", 1),
+                "Cannot append separator");
+    fail_unless(hwm_buffer_append_double(&buf, 2.2250738585072014e-308),
+                "Cannot append double");
+    fail_unless(hwm_buffer_append_mem(&buf, " ", 1),
+                "Cannot append separator");
+    fail_unless(hwm_buffer_append_double(&buf, 9007199254740993.0),
+                "Cannot append double");
+
+    fail_unless_buf_matches
+        (&buf,
+         "122.008356545961 1.2177806878781e-27 "
+         "2.2250738585072014e-308 9007199254740992", 77);
+
+    /*
+     * No finite double should have a shorter string that reads back
+     * as the same value.  Every other value gets an exponent from the
+     * range where the rounding boundaries matter the most.
+     */
+
+    for (i = 0; i < 100000; i++)
+    {
+        double  value;
+
+        bits ^= bits << 13;
+        bits ^= bits >> 7;
+        bits ^= bits << 17;
+
+        if (i % 2 == 1)
+        {
+            bits = (bits & UINT64_C(0x800fffffffffffff)) |
+                ((uint64_t) (1077 + (i / 2) % 2) << 52);
+        }
+
+        memcpy(&value, &bits, sizeof(value));
+        if (value != value || value - value != 0.0)
+            continue;
+
+        hwm_buffer_clear(&buf);
+        fail_unless(hwm_buffer_append_double(&buf, value),
+                    "Cannot append double");
+        fail_unless(hwm_buffer_append_mem(&buf, "", 1),
+                    "Cannot append terminator");
+
+        fail_if(double_has_shorter(value, hwm_buffer_mem(&buf, char)),
+                "Double %s isn't the shortest representation",
+                hwm_buffer_mem(&buf, char));
+    }
+
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_hexdump_01)
+{
+    hwm_buffer_t  buf;
+    const char  *data = "0123456789abcdef\x01\xff";
+    const char  *expected =
+        "00000010  30 31 32 33 34 35 36 37   "
+        "38 39 61 62 63 64 65 66  |0123456789abcdef|\n"
+        "00000020  01 ff                        "
+        "                      |..|\n";
+
+    hwm_buffer_init(&buf);
+    fail_unless(hwm_buffer_hexdump_size
+                (18, 0x10, HWM_BUFFER_HEXDUMP_OFFSET |
+                 HWM_BUFFER_HEXDUMP_ASCII) == 146,
+                "Wrong hex dump size");
+    fail_unless(hwm_buffer_append_hexdump
+                (&buf, data, 18, 0x10, HWM_BUFFER_HEXDUMP_OFFSET |
+                 HWM_BUFFER_HEXDUMP_ASCII),
+                "Cannot append hex dump");
+    fail_unless_buf_matches(&buf, expected, 146);
+
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+/**
+ * Print a hex dump of the buffer into a temporary file, and load the
+ * file's contents into dest.
+ */
+
+static void
+fprint_to_buffer(hwm_buffer_t *dest, const hwm_buffer_t *hwm,
+                 size_t offset, size_t size, unsigned int flags)
+{
+    FILE  *stream = tmpfile();
+    char  chunk[256];
+    size_t  bytes_read;
+
+    fail_if(stream == NULL, "Cannot create temporary file");
+    fail_unless(hwm_buffer_fprint_hexdump(stream, hwm, offset, size,
+                                          flags),
+                "Cannot print hex dump");
+
+    rewind(stream);
+    hwm_buffer_clear(dest);
+
+    while ((bytes_read = fread(chunk, 1, sizeof(chunk), stream)) > 0)
+    {
+        fail_unless(hwm_buffer_append_mem(dest, chunk, bytes_read),
+                    "Cannot append hex dump");
+    }
+
+    fclose(stream);
+}
+
+
+START_TEST(test_fprint_hexdump_01)
+{
+    hwm_buffer_t  buf;
+    hwm_buffer_t  dump;
+    uint8_t  data[20];
+    size_t  i;
+
+    for (i = 0; i < sizeof(data); i++)
+        data[i] = (uint8_t) i;
+
+    hwm_buffer_init(&buf);
+    hwm_buffer_init(&dump);
+    fail_unless(hwm_buffer_load_mem(&buf, data, sizeof(data)),
+                "Cannot load data");
+
+    /*
+     * The default layout, which includes the final newline.
+     */
+
+    fprint_to_buffer(&dump, &buf, 0, SIZE_MAX, 0);
+    fail_unless_buf_matches
+        (&dump,
+         "  00 01 02 03 04 05 06 07   08 09 0a 0b 0c 0d 0e 0f\n"
+         "  10 11 12 13\n", 66);
+
+    /*
+     * A range of the buffer, with offsets relative to its start.
+     */
+
+    fprint_to_buffer(&dump, &buf, 16, SIZE_MAX,
+                     HWM_BUFFER_HEXDUMP_OFFSET);
+    fail_unless_buf_matches(&dump, "00000010  10 11 12 13\n", 22);
+
+    fprint_to_buffer(&dump, &buf, 2, 3, 0);
+    fail_unless_buf_matches(&dump, "  02 03 04\n", 11);
+
+    fprint_to_buffer(&dump, &buf, 100, SIZE_MAX, 0);
+    fail_unless(dump.current_size == 0,
+                "Dump past the end of the buffer isn't empty");
+
+    hwm_buffer_done(&buf);
+    hwm_buffer_done(&dump);
+}
+END_TEST
+
+
+START_TEST(test_append_hex_01)
+{
+    hwm_buffer_t  buf;
+    hwm_buffer_t  decoded;
+
+    hwm_buffer_init(&buf);
+    hwm_buffer_init(&decoded);
+
+    fail_unless(hwm_buffer_append_hex(&buf, "\x01\xab\xff\x00", 4),
+                "Cannot append hex");
+    fail_unless_buf_matches(&buf, "01abff00", 8);
+
+    fail_unless(hwm_buffer_append_from_hex(&decoded, "01ABff00", 8),
+                "Cannot decode hex");
+    fail_unless_buf_matches(&decoded, "\x01\xab\xff\x00", 4);
+
+    /*
+     * Invalid input leaves the buffer alone.
+     */
+
+    errno = 0;
+    fail_if(hwm_buffer_append_from_hex(&decoded, "012", 3),
+            "Decoded odd-length hex");
+    fail_unless(errno == EINVAL, "Wrong errno");
+    fail_if(hwm_buffer_append_from_hex(&decoded, "0g", 2),
+            "Decoded invalid hex");
+    fail_unless_buf_matches(&decoded, "\x01\xab\xff\x00", 4);
+
+    hwm_buffer_done(&buf);
+    hwm_buffer_done(&decoded);
+}
+END_TEST
+
+
+START_TEST(test_append_base64_01)
+{
+    /*
+     * The test vectors from RFC 4648.
+     */
+
+    static const char  *const plain[] =
+        { "", "f", "fo", "foo", "foob", "fooba", "foobar" };
+    static const char  *const encoded[] =
+        { "", "Zg==", "Zm8=", "Zm9v", "Zm9vYg==", "Zm9vYmE=", "Zm9vYmFy" };
+
+    hwm_buffer_t  buf;
+    size_t  i;
+
+    hwm_buffer_init(&buf);
+
+    for (i = 0; i < sizeof(plain) / sizeof(plain[0]); i++)
+    {
+        hwm_buffer_clear(&buf);
+        fail_unless(hwm_buffer_append_base64(&buf, plain[i],
+                                             strlen(plain[i])),
+                    "Cannot append base64");
+        fail_unless_buf_matches(&buf, encoded[i], strlen(encoded[i]));
+
+        hwm_buffer_clear(&buf);
+        fail_unless(hwm_buffer_append_from_base64(&buf, encoded[i],
+                                                  strlen(encoded[i])),
+                    "Cannot decode base64");
+        fail_unless_buf_matches(&buf, plain[i], strlen(plain[i]));
+    }
+
+    hwm_buffer_clear(&buf);
+    fail_if(hwm_buffer_append_from_base64(&buf, "Zm9", 3),
+            "Decoded truncated base64");
+    fail_if(hwm_buffer_append_from_base64(&buf, "Zg==Zm8=", 8),
+            "Decoded base64 with padding in the middle");
+    fail_if(hwm_buffer_append_from_base64(&buf, "Zm9v\nYmFy", 9),
+            "Decoded base64 with whitespace");
+    fail_if(hwm_buffer_append_from_base64(&buf, "Z===", 4),
+            "Decoded base64 with too much padding");
+    fail_unless(buf.current_size == 0, "Failed decode changed buffer");
+
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+/**
+ * Encode and decode data of many different lengths at the current
+ * SIMD level, and check that the results match reference encodings
+ * produced by the scalar code.
+ */
+
+static void
+check_codecs_against(const uint8_t *data, size_t max_size,
+                     const hwm_buffer_t *hex, const hwm_buffer_t *base64)
+{
+    hwm_buffer_t  encoded;
+    hwm_buffer_t  decoded;
+    size_t  size;
+
+    hwm_buffer_init(&encoded);
+    hwm_buffer_init(&decoded);
+
+    for (size = 0; size <= max_size; size++)
+    {
+        const hwm_buffer_t  *expected_hex =
+            hwm_buffer_list_elem(hex, hwm_buffer_t, size);
+        const hwm_buffer_t  *expected_base64 =
+            hwm_buffer_list_elem(base64, hwm_buffer_t, size);
+
+        hwm_buffer_clear(&encoded);
+        fail_unless(hwm_buffer_append_hex(&encoded, data, size),
+                    "Cannot append hex");
+        fail_unless(hwm_buffer_equal(&encoded, expected_hex),
+                    "Hex of %zu bytes doesn't match at level %d",
+                    size, hwm_simd_level());
+
+        hwm_buffer_clear(&decoded);
+        fail_unless(hwm_buffer_append_from_hex
+                    (&decoded, hwm_buffer_mem(&encoded, char),
+                     encoded.current_size),
+                    "Cannot decode hex");
+        fail_unless(hwm_buffer_equal_mem(&decoded, data, size),
+                    "Hex of %zu bytes doesn't round-trip at level %d",
+                    size, hwm_simd_level());
+
+        hwm_buffer_clear(&encoded);
+        fail_unless(hwm_buffer_append_base64(&encoded, data, size),
+                    "Cannot append base64");
+        fail_unless(hwm_buffer_equal(&encoded, expected_base64),
+                    "Base64 of %zu bytes doesn't match at level %d",
+                    size, hwm_simd_level());
+
+        hwm_buffer_clear(&decoded);
+        fail_unless(hwm_buffer_append_from_base64
+                    (&decoded, hwm_buffer_mem(&encoded, char),
+                     encoded.current_size),
+                    "Cannot decode base64");
+        fail_unless(hwm_buffer_equal_mem(&decoded, data, size),
+                    "Base64 of %zu bytes doesn't round-trip at level %d",
+                    size, hwm_simd_level());
+
+        /*
+         * A bad character anywhere in the input must be caught,
+         * whichever kernel it lands in.
+         */
+
+        if (encoded.current_size > 4)
+        {
+            char  *bad = hwm_buffer_writable_mem(&encoded, char);
+            bad[size % (encoded.current_size - 4)] = '*';
+            fail_if(hwm_buffer_append_from_base64
+                    (&decoded, bad, encoded.current_size),
+                    "Decoded invalid base64 at level %d",
+                    hwm_simd_level());
+        }
+    }
+
+    hwm_buffer_done(&encoded);
+    hwm_buffer_done(&decoded);
+}
+
+
+START_TEST(test_codecs_simd_01)
+{
+    const size_t  max_size = 300;
+    uint8_t  data[300];
+    hwm_buffer_t  hex;
+    hwm_buffer_t  base64;
+    uint32_t  state = 12345;
+    int  best_level;
+    int  level;
+    size_t  size;
+
+    for (size = 0; size < max_size; size++)
+    {
+        state = state * 1103515245 + 12345;
+        data[size] = (uint8_t) (state >> 16);
+    }
+
+    /*
+     * Build reference encodings with the scalar code.
+     */
+
+    best_level = hwm_simd_level();
+    hwm_simd_limit(HWM_SIMD_SCALAR);
+    fail_unless(hwm_simd_level() == HWM_SIMD_SCALAR,
+                "Cannot limit SIMD level");
+
+    hwm_buffer_init(&hex);
+    hwm_buffer_init(&base64);
+
+    for (size = 0; size <= max_size; size++)
+    {
+        hwm_buffer_t  *elem;
+
+        elem = hwm_buffer_append_list_elem(&hex, hwm_buffer_t);
+        hwm_buffer_init(elem);
+        fail_unless(hwm_buffer_append_hex(elem, data, size),
+                    "Cannot append hex");
+
+        elem = hwm_buffer_append_list_elem(&base64, hwm_buffer_t);
+        hwm_buffer_init(elem);
+        fail_unless(hwm_buffer_append_base64(elem, data, size),
+                    "Cannot append base64");
+    }
+
+    for (level = HWM_SIMD_SCALAR; level <= best_level; level++)
+    {
+        fail_unless(hwm_simd_limit(level) == level,
+                    "Cannot select SIMD level %d", level);
+        check_codecs_against(data, max_size, &hex, &base64);
+    }
+
+    hwm_simd_limit(HWM_SIMD_AVX2);
+
+    for (size = 0; size <= max_size; size++)
+    {
+        hwm_buffer_done(hwm_buffer_writable_list_elem
+                        (&hex, hwm_buffer_t, size));
+        hwm_buffer_done(hwm_buffer_writable_list_elem
+                        (&base64, hwm_buffer_t, size));
+    }
+
+    hwm_buffer_done(&hex);
+    hwm_buffer_done(&base64);
+}
+END_TEST
+
+
+START_TEST(test_find_01)
+{
+    hwm_buffer_t  owned;
+    hwm_buffer_t  pointed = HWM_BUFFER_INIT(DATA_03, LENGTH_03);
+    hwm_buffer_t  empty;
+    hwm_buffer_t  *bufs[2];
+    size_t  i;
+
+    hwm_buffer_init(&owned);
+    hwm_buffer_init(&empty);
+    fail_unless(hwm_buffer_load_mem(&owned, DATA_03, LENGTH_03),
+                "Cannot load data");
+
+    bufs[0] = &owned;
+    bufs[1] = &pointed;
+
+    /*
+     * The search functions shouldn't care whether the buffer owns its
+     * data.
+     */
+
+    for (i = 0; i < 2; i++)
+    {
+        hwm_buffer_t  *buf = bufs[i];
+
+        fail_unless(hwm_buffer_find_byte(buf, 0, '5') == 5,
+                    "Wrong first match");
+        fail_unless(hwm_buffer_find_byte(buf, 6, '5') == 15,
+                    "Wrong match after start");
+        fail_unless(hwm_buffer_find_byte(buf, 0, 'x') ==
+                    HWM_BUFFER_NOT_FOUND,
+                    "Found missing byte");
+        fail_unless(hwm_buffer_find_byte(buf, LENGTH_03, '0') ==
+                    HWM_BUFFER_NOT_FOUND,
+                    "Found byte past the end");
+
+        fail_unless(hwm_buffer_find_any(buf, 0, "x98", 3) == 8,
+                    "Wrong match from set");
+        fail_unless(hwm_buffer_find_any(buf, 10, "x98", 3) == 18,
+                    "Wrong match from set after start");
+        fail_unless(hwm_buffer_find_any(buf, 0, "xyz", 3) ==
+                    HWM_BUFFER_NOT_FOUND,
+                    "Found missing set");
+
+        fail_unless(hwm_buffer_find_mem(buf, 0, "901", 3) == 9,
+                    "Wrong substring match");
+        fail_unless(hwm_buffer_find_mem(buf, 10, "901", 3) == 19,
+                    "Wrong substring match after start");
+        fail_unless(hwm_buffer_find_mem(buf, 0, "789", 3) == 7,
+                    "Wrong substring match");
+        fail_unless(hwm_buffer_find_mem(buf, 27, "789", 3) == 27,
+                    "Wrong substring match at the end");
+        fail_unless(hwm_buffer_find_mem(buf, 28, "789", 3) ==
+                    HWM_BUFFER_NOT_FOUND,
+                    "Found substring past the end");
+        fail_unless(hwm_buffer_find_mem(buf, 0, "910", 3) ==
+                    HWM_BUFFER_NOT_FOUND,
+                    "Found missing substring");
+        fail_unless(hwm_buffer_find_mem(buf, 4, "", 0) == 4,
+                    "Empty needle doesn't match at start");
+
+        fail_unless(hwm_buffer_count_byte(buf, '0') == 3,
+                    "Wrong byte count");
+        fail_unless(hwm_buffer_count_byte(buf, 'x') == 0,
+                    "Wrong byte count");
+    }
+
+    fail_unless(hwm_buffer_find_byte(&empty, 0, 0) == HWM_BUFFER_NOT_FOUND,
+                "Found byte in empty buffer");
+    fail_unless(hwm_buffer_find_mem(&empty, 0, "", 0) == 0,
+                "Empty needle doesn't match empty buffer");
+    fail_unless(hwm_buffer_count_byte(&empty, 0) == 0,
+                "Wrong byte count in empty buffer");
+
+    hwm_buffer_done(&owned);
+    hwm_buffer_done(&empty);
+}
+END_TEST
+
+
+START_TEST(test_split_01)
+{
+    hwm_buffer_t  buf = HWM_BUFFER_INIT("a,bc,,d,", 8);
+    hwm_buffer_split_t  split;
+    const char  *expected[] = { "a", "bc", "", "d", "" };
+    const void  *field;
+    size_t  size;
+    size_t  i;
+
+    hwm_buffer_split_init(&split, &buf, ',');
+
+    for (i = 0; hwm_buffer_split_next(&split, &field, &size); i++)
+    {
+        fail_unless(i < 5, "Too many fields");
+        fail_unless(size == strlen(expected[i]) &&
+                    memcmp(field, expected[i], size) == 0,
+                    "Wrong field %zu", i);
+        fail_unless((const char *) field >= hwm_buffer_mem(&buf, char) &&
+                    (const char *) field <= hwm_buffer_mem(&buf, char) + 8,
+                    "Field doesn't point into the buffer");
+    }
+
+    fail_unless(i == 5, "Wrong number of fields");
+
+    /*
+     * Empty memory has no fields, and memory without delimiters has
+     * one.
+     */
+
+    hwm_buffer_split_init_mem(&split, "", 0, ',');
+    fail_if(hwm_buffer_split_next(&split, &field, &size),
+            "Found a field in empty memory");
+
+    hwm_buffer_split_init_mem(&split, "abc", 3, ',');
+    fail_unless(hwm_buffer_split_next(&split, &field, &size) &&
+                size == 3, "Wrong single field");
+    fail_if(hwm_buffer_split_next(&split, &field, &size),
+            "Found a second field");
+}
+END_TEST
+
+
+START_TEST(test_search_simd_01)
+{
+    /*
+     * Sparse matches, so that every kernel's tail handling gets
+     * exercised as well as its main loop.
+     */
+
+    const size_t  max_size = 200;
+    uint8_t  data[200];
+    uint32_t  state = 54321;
+    int  best_level = hwm_simd_level();
+    size_t  size;
+
+    for (size = 0; size < max_size; size++)
+    {
+        state = state * 1103515245 + 12345;
+        data[size] = (uint8_t) ((state >> 16) % 64);
+    }
+
+    for (size = 0; size <= max_size; size++)
+    {
+        hwm_buffer_t  buf = HWM_BUFFER_INIT(data, size);
+        size_t  start = size % 7;
+        const uint8_t  *needle = data + size / 2;
+        size_t  expected_byte;
+        size_t  expected_any;
+        size_t  expected_mem;
+        size_t  expected_count;
+        int  level;
+
+        hwm_simd_limit(HWM_SIMD_SCALAR);
+        expected_byte = hwm_buffer_find_byte(&buf, start, 5);
+        expected_any = hwm_buffer_find_any(&buf, start, "\x06\x05", 2);
+        expected_mem = hwm_buffer_find_mem(&buf, start, needle, 3);
+        expected_count = hwm_buffer_count_byte(&buf, 4);
+
+        for (level = HWM_SIMD_SCALAR + 1; level <= best_level; level++)
+        {
+            hwm_simd_limit(level);
+            fail_unless(hwm_buffer_find_byte(&buf, start, 5) ==
+                        expected_byte,
+                        "find_byte mismatch at level %d", level);
+            fail_unless(hwm_buffer_find_any(&buf, start, "\x06\x05", 2) ==
+                        expected_any,
+                        "find_any mismatch at level %d", level);
+            fail_unless(hwm_buffer_find_mem(&buf, start, needle, 3) ==
+                        expected_mem,
+                        "find_mem mismatch at level %d", level);
+            fail_unless(hwm_buffer_count_byte(&buf, 4) == expected_count,
+                        "count_byte mismatch at level %d", level);
+        }
+
+        /*
+         * Every field that the splitter returns should end right
+         * before a delimiter, or at the end of the data.
+         */
+
+        for (level = HWM_SIMD_SCALAR; level <= best_level; level++)
+        {
+            hwm_buffer_split_t  split;
+            const void  *field;
+            size_t  field_size;
+            size_t  offset = 0;
+
+            hwm_simd_limit(level);
+            hwm_buffer_split_init(&split, &buf, 4);
+
+            while (hwm_buffer_split_next(&split, &field, &field_size))
+            {
+                fail_unless((const uint8_t *) field == data + offset,
+                            "Split field in the wrong place");
+                fail_unless(memchr(field, 4, field_size) == NULL,
+                            "Split field contains a delimiter");
+                offset += field_size;
+                fail_unless(offset == size || data[offset] == 4,
+                            "Split field ends too early at level %d",
+                            level);
+                offset++;
+            }
+
+            fail_unless(offset == size + 1 || size == 0,
+                        "Split didn't cover all of the data");
+        }
+    }
+
+    hwm_simd_limit(HWM_SIMD_AVX2);
+}
+END_TEST
+
+
+START_TEST(test_hash_01)
+{
+    /*
+     * XXH64 test vectors, with a seed of 0.  The last one is long
+     * enough to use all four lanes.
+     */
+
+    static const char  LONG[] =
+        "abcdefghijklmnopqrstuvwxyz0123456789"
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    hwm_buffer_t  buf = HWM_BUFFER_INIT("abc", 3);
+    uint8_t  data[100];
+    size_t  size;
+
+    fail_unless(hwm_buffer_hash_mem("", 0) ==
+                UINT64_C(0xef46db3751d8e999),
+                "Empty hash doesn't match");
+    fail_unless(hwm_buffer_hash_mem("a", 1) ==
+                UINT64_C(0xd24ec4f1a98c6e5b),
+                "Hash of \"a\" doesn't match");
+    fail_unless(hwm_buffer_hash_mem("abc", 3) ==
+                UINT64_C(0x44bc2cf5ad770999),
+                "Hash of \"abc\" doesn't match");
+    fail_unless(hwm_buffer_hash(&buf) == UINT64_C(0x44bc2cf5ad770999),
+                "Buffer hash doesn't match");
+
+    /*
+     * Every way of splitting the data into pieces should give the
+     * same hash as hashing it all at once.
+     */
+
+    for (size = 0; size < sizeof(data); size++)
+        data[size] = (uint8_t) (size * 37 + 11);
+
+    for (size = 1; size < 70; size++)
+    {
+        hwm_buffer_t  pieces;
+        size_t  offset;
+
+        hwm_buffer_init(&pieces);
+        fail_unless(hwm_buffer_enable_hash(&pieces),
+                    "Cannot enable hashing");
+
+        for (offset = 0; offset < sizeof(data); offset += size)
+        {
+            size_t  piece = sizeof(data) - offset;
+
+            if (piece > size)
+                piece = size;
+
+            hwm_buffer_append_mem(&pieces, data + offset, piece);
+            fail_unless(hwm_buffer_hash(&pieces) ==
+                        hwm_buffer_hash_mem(data, offset + piece),
+                        "Hash mismatch after %zu bytes in pieces of %zu",
+                        offset + piece, size);
+        }
+
+        hwm_buffer_done(&pieces);
+    }
+
+    fail_unless(hwm_buffer_hash_mem(LONG, sizeof(LONG) - 1) ==
+                UINT64_C(0xd5000c4ac53d14a0),
+                "Hash of a long string doesn't match");
+}
+END_TEST
+
+
+/**
+ * Check that a buffer's incremental hash matches a one-shot hash of
+ * its contents.
+ */
+
+static void
+check_hash(hwm_buffer_t *buf, const char *where)
+{
+    fail_unless(hwm_buffer_hash(buf) ==
+                hwm_buffer_hash_mem(buf->data, buf->current_size),
+                "Incremental hash is wrong after %s", where);
+}
+
+
+START_TEST(test_hash_incremental_01)
+{
+    hwm_buffer_t  buf;
+    char  *str;
+
+    hwm_buffer_init(&buf);
+    fail_unless(hwm_buffer_enable_hash(&buf),
+                "Cannot enable hashing");
+    check_hash(&buf, "init");
+
+    /*
+     * String appends overwrite the previous NUL terminator.
+     */
+
+    hwm_buffer_load_str(&buf, "Hello");
+    check_hash(&buf, "load_str");
+    hwm_buffer_append_str(&buf, ", world");
+    check_hash(&buf, "append_str");
+    hwm_buffer_append_str(&buf, "! This string is long enough to "
+                          "fill a few stripes of the hash.");
+    check_hash(&buf, "second append_str");
+
+    /*
+     * Mutating through writable_mem has to be noticed.
+     */
+
+    str = hwm_buffer_writable_str(&buf);
+    str[0] = 'J';
+    check_hash(&buf, "writable_str");
+
+    hwm_buffer_consume(&buf, 7);
+    check_hash(&buf, "consume");
+
+    /*
+     * Appenders that don't update the hash themselves are caught up
+     * with lazily.
+     */
+
+    hwm_buffer_append_u64(&buf, 1234567890);
+    check_hash(&buf, "append_u64");
+    hwm_buffer_appendf(&buf, "%d", 42);
+    check_hash(&buf, "appendf");
+
+    hwm_buffer_load_mem(&buf, "abc", 3);
+    check_hash(&buf, "load_mem");
+    fail_unless(hwm_buffer_hash(&buf) == UINT64_C(0x44bc2cf5ad770999),
+                "Hash of \"abc\" doesn't match");
+
+    hwm_buffer_clear(&buf);
+    hwm_buffer_append_mem(&buf, "xyz", 3);
+    check_hash(&buf, "clear");
+
+    hwm_buffer_point_at_str(&buf, "Pointed at");
+    check_hash(&buf, "point_at_str");
+    hwm_buffer_append_mem(&buf, "!", 1);
+    check_hash(&buf, "append to pointed-at data");
+
+    /*
+     * Turning hashing off doesn't change the result.
+     */
+
+    {
+        uint64_t  expected = hwm_buffer_hash(&buf);
+        hwm_buffer_disable_hash(&buf);
+        fail_unless(hwm_buffer_hash(&buf) == expected,
+                    "Hash changes when incremental hashing is off");
+    }
+
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_crc32c_01)
+{
+    hwm_buffer_t  buf = HWM_BUFFER_INIT("123456789", 9);
+    hwm_buffer_t  stream;
+    uint32_t  crc = 0;
+    size_t  covered = 0;
+    size_t  i;
+
+    fail_unless(hwm_buffer_crc32c(&buf) == UINT32_C(0xe3069283),
+                "CRC-32C of \"123456789\" doesn't match");
+    fail_unless(hwm_buffer_crc32c_mem(0, "", 0) == 0,
+                "CRC-32C of empty input should be 0");
+    fail_unless(hwm_buffer_crc32c_mem
+                (hwm_buffer_crc32c_mem(0, "1234", 4), "56789", 5) ==
+                UINT32_C(0xe3069283),
+                "Split CRC-32C doesn't match");
+
+    /*
+     * Extending a running CRC as the buffer grows.
+     */
+
+    hwm_buffer_init(&stream);
+
+    for (i = 0; i < 10; i++)
+    {
+        hwm_buffer_append_mem(&stream, "123456789", 9);
+        crc = hwm_buffer_crc32c_extend(&stream, crc, covered);
+        covered = stream.current_size;
+        fail_unless(crc == hwm_buffer_crc32c(&stream),
+                    "Extended CRC-32C doesn't match after %zu bytes",
+                    covered);
+    }
+
+    hwm_buffer_done(&stream);
+}
+END_TEST
+
+
+START_TEST(test_crc32c_simd_01)
+{
+    /*
+     * Big enough for several runs of the longest interleaved blocks,
+     * and started at every alignment.
+     */
+
+    static uint8_t  data[3 * 3 * 8192 + 1000];
+    const size_t  sizes[] =
+        { 0, 1, 7, 8, 9, 100, 767, 768, 769, 3000,
+          3 * 8192 - 1, 3 * 8192, 3 * 8192 + 777, sizeof(data) - 8 };
+    int  best_level = hwm_simd_level();
+    uint32_t  state = 24680;
+    size_t  i;
+    size_t  offset;
+
+    for (i = 0; i < sizeof(data); i++)
+    {
+        state = state * 1103515245 + 12345;
+        data[i] = (uint8_t) (state >> 16);
+    }
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        for (offset = 0; offset < 8; offset++)
+        {
+            uint32_t  expected;
+            int  level;
+
+            hwm_simd_limit(HWM_SIMD_SCALAR);
+            expected = hwm_buffer_crc32c_mem(1, data + offset, sizes[i]);
+
+            for (level = HWM_SIMD_SCALAR + 1; level <= best_level; level++)
+            {
+                hwm_simd_limit(level);
+                fail_unless(hwm_buffer_crc32c_mem
+                            (1, data + offset, sizes[i]) == expected,
+                            "CRC-32C mismatch for %zu bytes at level %d",
+                            sizes[i], level);
+            }
+        }
+    }
+
+    hwm_simd_limit(HWM_SIMD_AVX2);
+}
+END_TEST
+
+
+START_TEST(test_equal_01)
+{
+    hwm_buffer_t  buf1 = HWM_BUFFER_INIT(DATA_01, LENGTH_01);
+    hwm_buffer_t  buf2 = HWM_BUFFER_INIT(DATA_02, LENGTH_02);
+    hwm_buffer_t  buf3;
+    hwm_buffer_t  empty;
+
+    hwm_buffer_init(&buf3);
+    hwm_buffer_init(&empty);
+    hwm_buffer_load_mem(&buf3, DATA_01, LENGTH_01);
+
+    fail_unless(hwm_buffer_equal(&buf1, &buf3),
+                "Buffers should be equal");
+    fail_if(hwm_buffer_equal(&buf1, &buf2),
+            "Buffers of different sizes shouldn't be equal");
+    fail_unless(hwm_buffer_equal(&empty, &empty),
+                "Empty buffers should be equal");
+    fail_unless(hwm_buffer_equal_mem(&buf1, DATA_01, LENGTH_01),
+                "Buffer should equal its contents");
+    fail_if(hwm_buffer_equal_mem(&buf1, "0123456788", LENGTH_01),
+            "Buffer shouldn't equal different contents");
+
+    fail_unless(hwm_buffer_has_prefix(&buf2, DATA_01, LENGTH_01),
+                "Buffer should start with DATA_01");
+    fail_unless(hwm_buffer_has_prefix(&buf2, "", 0),
+                "Every buffer has an empty prefix");
+    fail_if(hwm_buffer_has_prefix(&buf1, DATA_02, LENGTH_02),
+            "A prefix can't be longer than the buffer");
+    fail_unless(hwm_buffer_has_suffix(&buf2, "6789", 4),
+                "Buffer should end with \"6789\"");
+    fail_if(hwm_buffer_has_suffix(&buf2, "5678", 4),
+            "Buffer shouldn't end with \"5678\"");
+
+    /*
+     * Buffers with up-to-date hashes still compare correctly, whether
+     * or not the hashes match.
+     */
+
+    hwm_buffer_enable_hash(&buf3);
+    hwm_buffer_enable_hash(&empty);
+    hwm_buffer_load_mem(&empty, DATA_01, LENGTH_01);
+    hwm_buffer_hash(&buf3);
+    fail_unless(hwm_buffer_equal(&buf3, &empty),
+                "Hashed buffers should be equal");
+    hwm_buffer_load_mem(&empty, "0123456788", LENGTH_01);
+    fail_if(hwm_buffer_equal(&buf3, &empty),
+            "Hashed buffers shouldn't be equal");
+
+    hwm_buffer_done(&buf3);
+    hwm_buffer_done(&empty);
+}
+END_TEST
+
+
+START_TEST(test_cmp_01)
+{
+    hwm_buffer_t  abc = HWM_BUFFER_INIT("abc", 3);
+    hwm_buffer_t  abd = HWM_BUFFER_INIT("abd", 3);
+    hwm_buffer_t  ab = HWM_BUFFER_INIT("ab", 2);
+    hwm_buffer_t  high = HWM_BUFFER_INIT("a\xff", 2);
+    hwm_buffer_t  empty = HWM_BUFFER_INIT(NULL, 0);
+
+    fail_unless(hwm_buffer_cmp(&abc, &abc) == 0,
+                "Buffer should compare equal to itself");
+    fail_unless(hwm_buffer_cmp(&abc, &abd) < 0, "abc should be < abd");
+    fail_unless(hwm_buffer_cmp(&abd, &abc) > 0, "abd should be > abc");
+    fail_unless(hwm_buffer_cmp(&ab, &abc) < 0, "ab should be < abc");
+    fail_unless(hwm_buffer_cmp(&abc, &ab) > 0, "abc should be > ab");
+    fail_unless(hwm_buffer_cmp(&empty, &ab) < 0, "Empty should be first");
+    fail_unless(hwm_buffer_cmp(&high, &abc) > 0,
+                "Bytes should compare as unsigned");
+
+    fail_unless(hwm_buffer_common_prefix_size(&abc, &abd) == 2,
+                "abc and abd share two bytes");
+    fail_unless(hwm_buffer_common_prefix_size(&ab, &abc) == 2,
+                "ab and abc share two bytes");
+    fail_unless(hwm_buffer_common_prefix_size(&empty, &abc) == 0,
+                "Empty buffer shares nothing");
+}
+END_TEST
+
+
+START_TEST(test_compare_simd_01)
+{
+    /*
+     * Put a single difference at every position, so that each
+     * kernel's main loop and tail both find it.
+     */
+
+    uint8_t  a[100];
+    uint8_t  b[100];
+    int  best_level = hwm_simd_level();
+    int  level;
+    size_t  size;
+    size_t  i;
+
+    for (i = 0; i < sizeof(a); i++)
+        a[i] = b[i] = (uint8_t) (i * 7);
+
+    for (level = HWM_SIMD_SCALAR; level <= best_level; level++)
+    {
+        hwm_simd_limit(level);
+
+        for (size = 1; size <= sizeof(a); size++)
+        {
+            hwm_buffer_t  a_buf = HWM_BUFFER_INIT(a, size);
+            hwm_buffer_t  b_buf = HWM_BUFFER_INIT(b, size);
+
+            fail_unless(hwm_buffer_common_prefix_size(&a_buf, &b_buf) ==
+                        size && hwm_buffer_cmp(&a_buf, &b_buf) == 0,
+                        "Identical %zu bytes differ at level %d",
+                        size, level);
+
+            for (i = 0; i < size; i++)
+            {
+                b[i] ^= 0x80;
+                fail_unless(hwm_buffer_common_prefix_size
+                            (&a_buf, &b_buf) == i,
+                            "Wrong mismatch for %zu bytes at level %d",
+                            size, level);
+                fail_unless((hwm_buffer_cmp(&a_buf, &b_buf) < 0) ==
+                            (a[i] < b[i]),
+                            "Wrong order for %zu bytes at level %d",
+                            size, level);
+                b[i] ^= 0x80;
+            }
+        }
+    }
+
+    hwm_simd_limit(HWM_SIMD_AVX2);
+}
+END_TEST
+
+
+START_TEST(test_share_01)
+{
+    counting_allocator_t  ctx = { 0, 0, 0 };
+    hwm_buffer_t  src;
+    hwm_buffer_t  dest[3];
+    char  *str;
+    size_t  i;
+
+    /*
+     * Sharing shouldn't copy anything, and the storage should be
+     * freed once, when the last buffer lets go of it.
+     */
+
+    hwm_buffer_init_with_allocator(&src, &counting_allocator, &ctx);
+    fail_unless(hwm_buffer_load_mem(&src, DATA_02, LENGTH_02),
+                "Cannot load HWM buffer");
+
+    for (i = 0; i < 3; i++)
+    {
+        hwm_buffer_init(&dest[i]);
+        fail_unless(hwm_buffer_share(&dest[i], &src),
+                    "Cannot share HWM buffer");
+        fail_unless(dest[i].data == src.data,
+                    "Shared buffer should point at the same data");
+        fail_unless_buf_matches(&dest[i], DATA_02, LENGTH_02);
+    }
+
+    fail_unless(ctx.allocations == 2,
+                "Didn't allocate the right number of times "
+                "(got %zu, expected %zu)",
+                ctx.allocations, (size_t) 2);
+
+    /*
+     * Writing to any of the buffers, including the source, detaches
+     * it without affecting the others.
+     */
+
+    fail_unless(hwm_buffer_append_mem(&dest[0], DATA_01, LENGTH_01),
+                "Cannot append HWM buffer");
+    fail_unless_buf_matches(&dest[0], DATA_03, LENGTH_03);
+
+    str = hwm_buffer_writable_mem(&src, char);
+    fail_if(str == NULL, "Cannot get writable pointer");
+    str[0] = 'Q';
+    fail_unless_buf_matches(&dest[1], DATA_02, LENGTH_02);
+    fail_unless_buf_matches(&dest[2], DATA_02, LENGTH_02);
+
+    hwm_buffer_consume(&dest[1], LENGTH_01);
+    fail_unless_buf_matches(&dest[1], DATA_01, LENGTH_01);
+    fail_unless(ctx.frees == 0, "Shared storage freed too early");
+
+    /*
+     * Loading new contents releases the reference without copying.
+     */
+
+    hwm_buffer_load_str(&dest[1], "");
+    hwm_buffer_done(&dest[0]);
+    fail_unless(ctx.frees == 0, "Shared storage freed too early");
+
+    hwm_buffer_done(&dest[2]);
+    fail_unless(ctx.frees == 2,
+                "Shared storage not freed (got %zu frees, expected %zu)",
+                ctx.frees, (size_t) 2);
+
+    hwm_buffer_done(&dest[1]);
+    hwm_buffer_done(&src);
+}
+END_TEST
+
+
+START_TEST(test_share_file_01)
+{
+    hwm_buffer_t  src;
+    hwm_buffer_t  dest;
+    hwm_buffer_t  other = HWM_BUFFER_INIT(DATA_01, LENGTH_01);
+    char  path[64];
+
+    /*
+     * A file mapping can be shared too, and outlives the buffer that
+     * mapped it.
+     */
+
+    make_temp_file(path, DATA_02, LENGTH_02);
+
+    hwm_buffer_init(&src);
+    hwm_buffer_init(&dest);
+    fail_unless(hwm_buffer_load_file(&src, path, 0),
+                "Cannot load file");
+    fail_unless(hwm_buffer_share(&dest, &src),
+                "Cannot share HWM buffer");
+    hwm_buffer_done(&src);
+    unlink(path);
+    fail_unless_buf_matches(&dest, DATA_02, LENGTH_02);
+
+    /*
+     * Sharing a buffer that points at outside memory just points at
+     * the same memory.
+     */
+
+    fail_unless(hwm_buffer_share(&dest, &other),
+                "Cannot share HWM buffer");
+    fail_unless(dest.data == DATA_01,
+                "Shared buffer should point at the same data");
+    fail_unless_buf_matches(&dest, DATA_01, LENGTH_01);
+
+    hwm_buffer_done(&dest);
+}
+END_TEST
+
+
 /*-----------------------------------------------------------------------
  * Testing harness
  */
@@ -883,6 +3477,63 @@ test_suite()
     tcase_add_test(tc, test_append_list_01);
     tcase_add_test(tc, test_append_list_02);
     tcase_add_test(tc, test_ensure_list_size_01);
+    tcase_add_test(tc, test_growth_exact_01);
+    tcase_add_test(tc, test_growth_double_01);
+    tcase_add_test(tc, test_growth_size_class_01);
+    tcase_add_test(tc, test_growth_capped_linear_01);
+    tcase_add_test(tc, test_allocator_01);
+    tcase_add_test(tc, test_allocator_usable_size_01);
+    tcase_add_test(tc, test_trim_01);
+    tcase_add_test(tc, test_decay_01);
+    tcase_add_test(tc, test_mmap_01);
+    tcase_add_test(tc, test_mmap_reserve_01);
+    tcase_add_test(tc, test_mmap_advise_01);
+    tcase_add_test(tc, test_load_file_01);
+    tcase_add_test(tc, test_load_file_append_01);
+    tcase_add_test(tc, test_load_fd_pipe_01);
+    tcase_add_test(tc, test_append_from_fd_01);
+    tcase_add_test(tc, test_append_from_fd_nonblocking_01);
+    tcase_add_test(tc, test_point_at_append_from_fd_01);
+    tcase_add_test(tc, test_write_fd_01);
+    tcase_add_test(tc, test_write_fd_resume_01);
+    tcase_add_test(tc, test_consume_01);
+    tcase_add_test(tc, test_consume_compact_01);
+    tcase_add_test(tc, test_consume_load_01);
+    tcase_add_test(tc, test_consume_no_compact_01);
+    tcase_add_test(tc, test_consume_list_01);
+    tcase_add_test(tc, test_point_at_consume_01);
+    tcase_add_test(tc, test_reserve_01);
+    tcase_add_test(tc, test_point_at_reserve_01);
+    tcase_add_test(tc, test_reserve_list_01);
+    tcase_add_test(tc, test_append_iov_01);
+    tcase_add_test(tc, test_append_mems_01);
+    tcase_add_test(tc, test_append_strs_01);
+    tcase_add_test(tc, test_appendf_01);
+    tcase_add_test(tc, test_appendf_fits_01);
+    tcase_add_test(tc, test_loadf_01);
+    tcase_add_test(tc, test_append_u64_01);
+    tcase_add_test(tc, test_append_i64_01);
+    tcase_add_test(tc, test_append_u64_hex_01);
+    tcase_add_test(tc, test_append_double_01);
+    tcase_add_test(tc, test_append_double_roundtrip_01);
+    tcase_add_test(tc, test_append_double_shortest_01);
+    tcase_add_test(tc, test_hexdump_01);
+    tcase_add_test(tc, test_fprint_hexdump_01);
+    tcase_add_test(tc, test_append_hex_01);
+    tcase_add_test(tc, test_append_base64_01);
+    tcase_add_test(tc, test_codecs_simd_01);
+    tcase_add_test(tc, test_find_01);
+    tcase_add_test(tc, test_split_01);
+    tcase_add_test(tc, test_search_simd_01);
+    tcase_add_test(tc, test_hash_01);
+    tcase_add_test(tc, test_hash_incremental_01);
+    tcase_add_test(tc, test_crc32c_01);
+    tcase_add_test(tc, test_crc32c_simd_01);
+    tcase_add_test(tc, test_equal_01);
+    tcase_add_test(tc, test_cmp_01);
+    tcase_add_test(tc, test_compare_simd_01);
+    tcase_add_test(tc, test_share_01);
+    tcase_add_test(tc, test_share_file_01);
     suite_add_tcase(s, tc);
 
     return s;
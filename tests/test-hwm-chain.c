@@ -0,0 +1,296 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2009, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/uio.h>
+
+#include <check.h>
+
+#include <hwm-buffer.h>
+#include <hwm-chain.h>
+
+
+/*-----------------------------------------------------------------------
+ * Sample data
+ */
+
+const char  *DATA_01 = "0123456789";
+size_t  LENGTH_01 = 10;
+
+const char  *DATA_02 = "01234567890123456789";
+size_t  LENGTH_02 = 20;
+
+
+/*-----------------------------------------------------------------------
+ * Helper functions
+ */
+
+#define fail_unless_buf_matches(buffer, other, size)            \
+    {                                                           \
+        fail_if(hwm_buffer_mem(buffer, void) == NULL,           \
+                "Data doesn't match: buffer unallocated");      \
+        fail_unless((buffer)->current_size == size,             \
+                    "Data doesn't match: wrong size (%zu)",     \
+                    (buffer)->current_size);                    \
+        fail_unless(memcmp(hwm_buffer_mem(buffer, void),        \
+                           other, size) == 0,                   \
+                    "Data doesn't match: different contents");  \
+    }
+
+
+/*-----------------------------------------------------------------------
+ * Test cases
+ */
+
+START_TEST(test_chain_starts_empty)
+{
+    hwm_chain_t  chain;
+    hwm_chain_iter_t  iter;
+    const void  *data;
+    size_t  size;
+
+    hwm_chain_init(&chain, 0, 0);
+    fail_unless(hwm_chain_current_size(&chain) == 0,
+                "New chain should be empty");
+    fail_unless(hwm_chain_segment_count(&chain) == 0,
+                "New chain shouldn't have any segments");
+
+    hwm_chain_iter_init(&iter, &chain);
+    fail_if(hwm_chain_iter_next(&iter, &data, &size),
+            "Empty chain shouldn't have any segments to iterate");
+
+    hwm_chain_done(&chain);
+}
+END_TEST
+
+
+START_TEST(test_chain_append_01)
+{
+    hwm_chain_t  chain;
+    hwm_buffer_t  buf;
+
+    /*
+     * With 8-byte segments that grow to 32 bytes, appending 10 and 20
+     * bytes should use segments of 8, 16, and 32 bytes.
+     */
+
+    hwm_chain_init(&chain, 8, 32);
+    hwm_buffer_init(&buf);
+
+    fail_unless(hwm_chain_append_mem(&chain, DATA_01, LENGTH_01),
+                "Cannot append to chain");
+    fail_unless(hwm_chain_append_str(&chain, DATA_02),
+                "Cannot append to chain");
+
+    fail_unless(hwm_chain_current_size(&chain) == LENGTH_01 + LENGTH_02,
+                "Chain should have %zu bytes, got %zu",
+                LENGTH_01 + LENGTH_02, hwm_chain_current_size(&chain));
+    fail_unless(hwm_chain_segment_count(&chain) == 3,
+                "Chain should have 3 segments, got %zu",
+                hwm_chain_segment_count(&chain));
+
+    fail_unless(hwm_chain_flatten(&chain, &buf),
+                "Cannot flatten chain");
+    fail_unless_buf_matches(&buf, "0123456789" "01234567890123456789",
+                            LENGTH_01 + LENGTH_02);
+
+    hwm_buffer_done(&buf);
+    hwm_chain_done(&chain);
+}
+END_TEST
+
+
+START_TEST(test_chain_no_copy_01)
+{
+    hwm_chain_t  chain;
+    hwm_chain_iter_t  iter;
+    const void  *data;
+    const void  *first_data = NULL;
+    const char  *pattern = "01234567890123456789012345";
+    size_t  size;
+    size_t  i;
+
+    /*
+     * Data that's already in the chain should never move as the chain
+     * grows.
+     */
+
+    hwm_chain_init(&chain, 16, 16);
+
+    for (i = 0; i < 100; i++)
+    {
+        fail_unless(hwm_chain_append_mem(&chain, DATA_01, LENGTH_01),
+                    "Cannot append to chain");
+
+        hwm_chain_iter_init(&iter, &chain);
+        fail_unless(hwm_chain_iter_next(&iter, &data, &size),
+                    "Chain should have a segment");
+
+        if (first_data == NULL)
+            first_data = data;
+
+        fail_unless(data == first_data,
+                    "First segment shouldn't move");
+    }
+
+    fail_unless(hwm_chain_current_size(&chain) == 100 * LENGTH_01,
+                "Chain has the wrong size");
+
+    /*
+     * Every segment but the last should be full.
+     */
+
+    hwm_chain_iter_init(&iter, &chain);
+    i = 0;
+    while (hwm_chain_iter_next(&iter, &data, &size))
+    {
+        i += size;
+        fail_unless(size == 16 || i == 100 * LENGTH_01,
+                    "Segment should be full");
+        fail_unless(memcmp(data, pattern + (i - size) % 10, size) == 0,
+                    "Segment has the wrong contents");
+    }
+
+    fail_unless(i == 100 * LENGTH_01,
+                "Iterator returned %zu bytes", i);
+
+    hwm_chain_done(&chain);
+}
+END_TEST
+
+
+START_TEST(test_chain_iov_01)
+{
+    hwm_chain_t  chain;
+    struct iovec  iov[8];
+    size_t  iov_count;
+
+    hwm_chain_init(&chain, 8, 8);
+    fail_unless(hwm_chain_append_mem(&chain, DATA_02, LENGTH_02),
+                "Cannot append to chain");
+
+    iov_count = hwm_chain_fill_iov(&chain, 0, iov, 8);
+    fail_unless(iov_count == 3,
+                "Should have 3 iovecs, got %zu", iov_count);
+    fail_unless(iov[0].iov_len == 8 && iov[1].iov_len == 8 &&
+                iov[2].iov_len == 4,
+                "Wrong iovec lengths");
+
+    /*
+     * Skip the first 10 bytes, as if a writev() had only written that
+     * much.
+     */
+
+    iov_count = hwm_chain_fill_iov(&chain, 10, iov, 8);
+    fail_unless(iov_count == 2,
+                "Should have 2 iovecs, got %zu", iov_count);
+    fail_unless(iov[0].iov_len == 6 &&
+                memcmp(iov[0].iov_base, DATA_02 + 10, 6) == 0,
+                "Wrong first iovec");
+    fail_unless(iov[1].iov_len == 4 &&
+                memcmp(iov[1].iov_base, DATA_02 + 16, 4) == 0,
+                "Wrong second iovec");
+
+    iov_count = hwm_chain_fill_iov(&chain, 0, iov, 1);
+    fail_unless(iov_count == 1,
+                "Should have 1 iovec, got %zu", iov_count);
+
+    hwm_chain_done(&chain);
+}
+END_TEST
+
+
+START_TEST(test_chain_clear_01)
+{
+    hwm_chain_t  chain;
+    hwm_chain_iter_t  iter;
+    const void  *data;
+    const void  *first;
+    size_t  size;
+    size_t  allocation_count;
+
+    /*
+     * Clearing the chain should keep the segments' allocations, so
+     * filling it up to the same size again doesn't allocate anything.
+     */
+
+    hwm_chain_init(&chain, 8, 32);
+    fail_unless(hwm_chain_append_mem(&chain, DATA_02, LENGTH_02),
+                "Cannot append to chain");
+    fail_unless(hwm_chain_append_mem(&chain, DATA_02, LENGTH_02),
+                "Cannot append to chain");
+
+    hwm_chain_iter_init(&iter, &chain);
+    hwm_chain_iter_next(&iter, &first, &size);
+    allocation_count = chain.segments.allocation_count;
+
+    hwm_chain_clear(&chain);
+    fail_unless(hwm_chain_current_size(&chain) == 0,
+                "Cleared chain should be empty");
+    hwm_chain_iter_init(&iter, &chain);
+    fail_if(hwm_chain_iter_next(&iter, &data, &size),
+            "Cleared chain shouldn't have any segments to iterate");
+
+    fail_unless(hwm_chain_append_mem(&chain, DATA_02, LENGTH_02),
+                "Cannot append to chain");
+    fail_unless(hwm_chain_append_mem(&chain, DATA_02, LENGTH_02),
+                "Cannot append to chain");
+
+    hwm_chain_iter_init(&iter, &chain);
+    hwm_chain_iter_next(&iter, &data, &size);
+    fail_unless(data == first,
+                "Cleared chain should reuse its segments");
+    fail_unless(chain.segments.allocation_count == allocation_count,
+                "Cleared chain shouldn't reallocate its segment list");
+
+    hwm_chain_done(&chain);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("hwm-chain");
+
+    TCase  *tc = tcase_create("hwm-chain");
+    tcase_add_test(tc, test_chain_starts_empty);
+    tcase_add_test(tc, test_chain_append_01);
+    tcase_add_test(tc, test_chain_no_copy_01);
+    tcase_add_test(tc, test_chain_iov_01);
+    tcase_add_test(tc, test_chain_clear_01);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
@@ -0,0 +1,472 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2009, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+#include <hwm-buffer.h>
+#include <hwm-pool.h>
+
+
+/*-----------------------------------------------------------------------
+ * Sample data
+ */
+
+const char  *DATA_01 = "0123456789";
+size_t  LENGTH_01 = 10;
+
+
+/*-----------------------------------------------------------------------
+ * Test cases
+ */
+
+
+START_TEST(test_pool_reuse_01)
+{
+    hwm_pool_t  pool;
+    hwm_buffer_t  *buf;
+    const void  *storage;
+
+    /*
+     * A buffer that's released and then acquired again should come
+     * back empty, but with its allocation intact.
+     */
+
+    hwm_pool_init(&pool, 0, 0);
+
+    buf = hwm_pool_acquire(&pool, 0);
+    fail_if(buf == NULL,
+            "Cannot acquire HWM buffer");
+    fail_unless(hwm_buffer_load_mem(buf, DATA_01, LENGTH_01),
+                "Cannot load HWM buffer");
+    storage = buf->buf;
+    hwm_pool_release(&pool, buf);
+
+    buf = hwm_pool_acquire(&pool, LENGTH_01);
+    fail_if(buf == NULL,
+            "Cannot acquire HWM buffer");
+    fail_unless(hwm_buffer_is_empty(buf),
+                "Acquired buffer should be empty");
+    fail_unless(buf->buf == storage,
+                "Acquired buffer should reuse retained storage");
+    fail_unless(buf->allocation_count == 1,
+                "Didn't allocate the right number of times "
+                "(got %u, expected %u)",
+                buf->allocation_count, 1);
+    hwm_pool_release(&pool, buf);
+
+    fail_unless(hwm_pool_hits(&pool) == 1,
+                "Wrong number of hits (got %zu, expected %zu)",
+                hwm_pool_hits(&pool), (size_t) 1);
+    fail_unless(hwm_pool_misses(&pool) == 1,
+                "Wrong number of misses (got %zu, expected %zu)",
+                hwm_pool_misses(&pool), (size_t) 1);
+
+    hwm_pool_done(&pool);
+}
+END_TEST
+
+
+START_TEST(test_pool_size_class_01)
+{
+    hwm_pool_t  pool;
+    hwm_buffer_t  *small;
+    hwm_buffer_t  *large;
+    hwm_buffer_t  *buf;
+
+    /*
+     * Asking for a large buffer shouldn't hand out a small retained
+     * one, and asking for a small buffer should prefer the small one.
+     */
+
+    hwm_pool_init(&pool, 0, 0);
+    small = hwm_pool_acquire(&pool, 16);
+    large = hwm_pool_acquire(&pool, 4096);
+    hwm_pool_release(&pool, small);
+    hwm_pool_release(&pool, large);
+
+    buf = hwm_pool_acquire(&pool, 1000);
+    fail_unless(buf == large,
+                "Should have reused the large buffer");
+    fail_unless(buf->allocated_size >= 1000,
+                "Acquired buffer is too small");
+
+    buf = hwm_pool_acquire(&pool, 8);
+    fail_unless(buf == small,
+                "Should have reused the small buffer");
+
+    buf = hwm_pool_acquire(&pool, 100);
+    fail_unless(buf->allocated_size >= 100,
+                "Acquired buffer is too small");
+    fail_unless(hwm_pool_misses(&pool) == 3,
+                "Wrong number of misses (got %zu, expected %zu)",
+                hwm_pool_misses(&pool), (size_t) 3);
+
+    hwm_pool_release(&pool, small);
+    hwm_pool_release(&pool, large);
+    hwm_pool_release(&pool, buf);
+    hwm_pool_done(&pool);
+}
+END_TEST
+
+
+START_TEST(test_pool_same_bin_01)
+{
+    hwm_pool_t  pool;
+    hwm_buffer_t  *buf1;
+    hwm_buffer_t  *buf2;
+    hwm_buffer_t  *buf;
+
+    /*
+     * Both buffers land in the same bin, with the one that's too small
+     * at its head.  The pool should look past it for the one that's
+     * large enough, rather than creating a new buffer.
+     */
+
+    hwm_pool_init(&pool, 0, 0);
+    buf1 = hwm_pool_acquire(&pool, 120);
+    buf2 = hwm_pool_acquire(&pool, 100);
+    hwm_pool_release(&pool, buf1);
+    hwm_pool_release(&pool, buf2);
+
+    buf = hwm_pool_acquire(&pool, 110);
+    fail_unless(buf == buf1,
+                "Should have reused the 120-byte buffer");
+    fail_unless(hwm_pool_hits(&pool) == 1,
+                "Wrong number of hits (got %zu, expected %zu)",
+                hwm_pool_hits(&pool), (size_t) 1);
+    fail_unless(hwm_pool_misses(&pool) == 2,
+                "Wrong number of misses (got %zu, expected %zu)",
+                hwm_pool_misses(&pool), (size_t) 2);
+    fail_unless(hwm_pool_retained_buffers(&pool) == 1,
+                "Wrong number of retained buffers (got %zu, expected %zu)",
+                hwm_pool_retained_buffers(&pool), (size_t) 1);
+
+    hwm_pool_release(&pool, buf);
+    hwm_pool_done(&pool);
+}
+END_TEST
+
+
+START_TEST(test_pool_limits_01)
+{
+    hwm_pool_t  pool;
+    hwm_buffer_t  *buf1;
+    hwm_buffer_t  *buf2;
+    hwm_buffer_t  *buf3;
+
+    /*
+     * With room for two buffers but only 100 bytes, the pool should
+     * retain the two small buffers and free the large one.
+     */
+
+    hwm_pool_init(&pool, 2, 100);
+    buf1 = hwm_pool_acquire(&pool, 200);
+    buf2 = hwm_pool_acquire(&pool, 20);
+    buf3 = hwm_pool_acquire(&pool, 30);
+
+    hwm_pool_release(&pool, buf1);
+    hwm_pool_release(&pool, buf2);
+    hwm_pool_release(&pool, buf3);
+
+    fail_unless(hwm_pool_retained_buffers(&pool) == 2,
+                "Wrong number of retained buffers (got %zu, expected %zu)",
+                hwm_pool_retained_buffers(&pool), (size_t) 2);
+    fail_unless(hwm_pool_retained_bytes(&pool) == 50,
+                "Wrong number of retained bytes (got %zu, expected %zu)",
+                hwm_pool_retained_bytes(&pool), (size_t) 50);
+
+    hwm_pool_done(&pool);
+}
+END_TEST
+
+
+START_TEST(test_mt_pool_reuse_01)
+{
+    hwm_mt_pool_t  pool;
+    hwm_buffer_t  *buf;
+    const void  *storage;
+
+    fail_unless(hwm_mt_pool_init(&pool, 4, 0),
+                "Cannot create pool");
+
+    buf = hwm_mt_pool_acquire(&pool, LENGTH_01);
+    fail_if(buf == NULL,
+            "Cannot acquire HWM buffer");
+    fail_unless(hwm_buffer_load_mem(buf, DATA_01, LENGTH_01),
+                "Cannot load HWM buffer");
+    storage = buf->buf;
+    hwm_mt_pool_release(&pool, buf);
+
+    buf = hwm_mt_pool_acquire(&pool, LENGTH_01);
+    fail_if(buf == NULL,
+            "Cannot acquire HWM buffer");
+    fail_unless(hwm_buffer_is_empty(buf),
+                "Acquired buffer should be empty");
+    fail_unless(buf->buf == storage,
+                "Acquired buffer should reuse retained storage");
+    hwm_mt_pool_release(&pool, buf);
+
+    fail_unless(hwm_mt_pool_hits(&pool) == 1,
+                "Wrong number of hits (got %zu, expected %zu)",
+                hwm_mt_pool_hits(&pool), (size_t) 1);
+    fail_unless(hwm_mt_pool_misses(&pool) == 1,
+                "Wrong number of misses (got %zu, expected %zu)",
+                hwm_mt_pool_misses(&pool), (size_t) 1);
+
+    hwm_mt_pool_done(&pool);
+}
+END_TEST
+
+
+START_TEST(test_pool_reset_settings_01)
+{
+    hwm_pool_t  pool;
+    hwm_mt_pool_t  mt_pool;
+    hwm_buffer_t  *buf;
+
+    /*
+     * Settings that one user makes on a buffer shouldn't carry over
+     * to the next user of the same buffer.
+     */
+
+    hwm_pool_init(&pool, 0, 0);
+
+    buf = hwm_pool_acquire(&pool, LENGTH_01);
+    fail_if(buf == NULL,
+            "Cannot acquire HWM buffer");
+    hwm_buffer_set_growth(buf, &hwm_growth_exact);
+    fail_unless(hwm_buffer_enable_hash(buf),
+                "Cannot enable hash");
+    hwm_buffer_set_advice(buf, HWM_BUFFER_ADVISE_SEQUENTIAL);
+    hwm_buffer_set_decay(buf, 4);
+    fail_unless(hwm_buffer_load_mem(buf, DATA_01, LENGTH_01),
+                "Cannot load HWM buffer");
+    hwm_pool_release(&pool, buf);
+
+    buf = hwm_pool_acquire(&pool, LENGTH_01);
+    fail_if(buf == NULL,
+            "Cannot acquire HWM buffer");
+    fail_unless(hwm_pool_hits(&pool) == 1,
+                "Should have reused the released buffer");
+    fail_unless(buf->growth == pool.growth,
+                "Growth policy should have been reset");
+    fail_unless(buf->hash == NULL,
+                "Hash should have been disabled");
+    fail_unless(buf->advice == 0,
+                "Advice should have been reset");
+    fail_unless(buf->decay_cycles == 0,
+                "Decay should have been disabled");
+    hwm_pool_release(&pool, buf);
+
+    hwm_pool_done(&pool);
+
+    fail_unless(hwm_mt_pool_init(&mt_pool, 1, 0),
+                "Cannot create pool");
+
+    buf = hwm_mt_pool_acquire(&mt_pool, LENGTH_01);
+    fail_if(buf == NULL,
+            "Cannot acquire HWM buffer");
+    hwm_buffer_set_growth(buf, &hwm_growth_exact);
+    fail_unless(hwm_buffer_enable_hash(buf),
+                "Cannot enable hash");
+    hwm_buffer_set_advice(buf, HWM_BUFFER_ADVISE_SEQUENTIAL);
+    hwm_buffer_set_decay(buf, 4);
+    fail_unless(hwm_buffer_load_mem(buf, DATA_01, LENGTH_01),
+                "Cannot load HWM buffer");
+    hwm_mt_pool_release(&mt_pool, buf);
+
+    buf = hwm_mt_pool_acquire(&mt_pool, LENGTH_01);
+    fail_if(buf == NULL,
+            "Cannot acquire HWM buffer");
+    fail_unless(hwm_mt_pool_hits(&mt_pool) == 1,
+                "Should have reused the released buffer");
+    fail_unless(buf->growth == mt_pool.growth,
+                "Growth policy should have been reset");
+    fail_unless(buf->hash == NULL,
+                "Hash should have been disabled");
+    fail_unless(buf->advice == 0,
+                "Advice should have been reset");
+    fail_unless(buf->decay_cycles == 0,
+                "Decay should have been disabled");
+    hwm_mt_pool_release(&mt_pool, buf);
+
+    hwm_mt_pool_done(&mt_pool);
+}
+END_TEST
+
+
+START_TEST(test_mt_pool_exhausted_01)
+{
+    hwm_mt_pool_t  pool;
+    hwm_buffer_t  *bufs[4];
+    size_t  i;
+
+    /*
+     * A pool with two slots should still hand out four buffers.
+     */
+
+    fail_unless(hwm_mt_pool_init(&pool, 2, 0),
+                "Cannot create pool");
+
+    for (i = 0; i < 4; i++)
+    {
+        bufs[i] = hwm_mt_pool_acquire(&pool, LENGTH_01);
+        fail_if(bufs[i] == NULL,
+                "Cannot acquire HWM buffer");
+        fail_unless(hwm_buffer_load_mem(bufs[i], DATA_01, LENGTH_01),
+                    "Cannot load HWM buffer");
+    }
+
+    for (i = 0; i < 4; i++)
+        hwm_mt_pool_release(&pool, bufs[i]);
+
+    hwm_mt_pool_done(&pool);
+}
+END_TEST
+
+
+#define STRESS_THREADS  4
+#define STRESS_ROUNDS  20000
+
+static hwm_mt_pool_t  stress_pool;
+
+/*
+ * Buffers that one thread acquires and another releases.
+ */
+
+static hwm_buffer_t  *handoff[STRESS_THREADS];
+
+static void *
+stress_thread(void *varg)
+{
+    uint8_t  id = (uint8_t) (uintptr_t) varg;
+    size_t  round;
+
+    for (round = 0; round < STRESS_ROUNDS; round++)
+    {
+        hwm_buffer_t  *buf;
+        hwm_buffer_t  *other;
+        size_t  i;
+
+        buf = hwm_mt_pool_acquire(&stress_pool, 16);
+        if (buf == NULL)
+            return "Cannot acquire HWM buffer";
+
+        /*
+         * Fill the buffer with our ID; if anyone else is using the
+         * same buffer at the same time, we'll notice below.
+         */
+
+        for (i = 0; i < 64; i++)
+        {
+            if (!hwm_buffer_append_mem(buf, &id, 1))
+                return "Cannot append HWM buffer";
+        }
+
+        for (i = 0; i < 64; i++)
+        {
+            if (hwm_buffer_mem(buf, uint8_t)[i] != id)
+                return "Buffer was shared between threads";
+        }
+
+        /*
+         * Swap our buffer with one that some thread left in the
+         * handoff array, so that buffers often get released on
+         * different threads than the ones that acquired them.
+         */
+
+        other = __atomic_exchange_n(&handoff[round % STRESS_THREADS],
+                                    buf, __ATOMIC_ACQ_REL);
+        if (other != NULL)
+            hwm_mt_pool_release(&stress_pool, other);
+    }
+
+    return NULL;
+}
+
+
+START_TEST(test_mt_pool_threads_01)
+{
+    pthread_t  threads[STRESS_THREADS];
+    size_t  i;
+
+    fail_unless(hwm_mt_pool_init(&stress_pool, 8, 0),
+                "Cannot create pool");
+
+    for (i = 0; i < STRESS_THREADS; i++)
+    {
+        fail_unless(pthread_create(&threads[i], NULL, stress_thread,
+                                   (void *) (uintptr_t) i) == 0,
+                    "Cannot create thread");
+    }
+
+    for (i = 0; i < STRESS_THREADS; i++)
+    {
+        void  *result;
+
+        pthread_join(threads[i], &result);
+        fail_unless(result == NULL, "%s", (const char *) result);
+    }
+
+    for (i = 0; i < STRESS_THREADS; i++)
+    {
+        if (handoff[i] != NULL)
+            hwm_mt_pool_release(&stress_pool, handoff[i]);
+    }
+
+    hwm_mt_pool_done(&stress_pool);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("hwm-pool");
+
+    TCase  *tc = tcase_create("hwm-pool");
+    tcase_add_test(tc, test_pool_reuse_01);
+    tcase_add_test(tc, test_pool_size_class_01);
+    tcase_add_test(tc, test_pool_same_bin_01);
+    tcase_add_test(tc, test_pool_limits_01);
+    tcase_add_test(tc, test_mt_pool_reuse_01);
+    tcase_add_test(tc, test_pool_reset_settings_01);
+    tcase_add_test(tc, test_mt_pool_exhausted_01);
+    tcase_add_test(tc, test_mt_pool_threads_01);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
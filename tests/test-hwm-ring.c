@@ -0,0 +1,260 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2009, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+#include <hwm-buffer.h>
+#include <hwm-ring.h>
+
+
+/*-----------------------------------------------------------------------
+ * Sample data
+ */
+
+const char  *DATA_01 = "0123456789";
+size_t  LENGTH_01 = 10;
+
+
+/*-----------------------------------------------------------------------
+ * Helper functions
+ */
+
+/**
+ * Fill a region of memory with a pattern that depends on each byte's
+ * position in a stream.
+ */
+
+static void
+fill_pattern(void *dest, size_t stream_offset, size_t size)
+{
+    uint8_t  *bytes = dest;
+    size_t  i;
+
+    for (i = 0; i < size; i++)
+        bytes[i] = (uint8_t) ((stream_offset + i) * 31);
+}
+
+
+static bool
+check_pattern(const void *src, size_t stream_offset, size_t size)
+{
+    const uint8_t  *bytes = src;
+    size_t  i;
+
+    for (i = 0; i < size; i++)
+    {
+        if (bytes[i] != (uint8_t) ((stream_offset + i) * 31))
+            return false;
+    }
+
+    return true;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Test cases
+ */
+
+START_TEST(test_ring_append_01)
+{
+    hwm_ring_t  ring;
+    hwm_buffer_t  view;
+    FILE  *devnull;
+
+    fail_unless(hwm_ring_init(&ring, 0),
+                "Cannot create ring");
+    fail_unless(hwm_ring_append_mem(&ring, DATA_01, LENGTH_01),
+                "Cannot append to ring");
+    fail_unless(hwm_ring_current_size(&ring) == LENGTH_01,
+                "Ring should have %zu bytes, got %zu",
+                LENGTH_01, hwm_ring_current_size(&ring));
+    fail_unless(hwm_ring_capacity(&ring) > 0,
+                "Ring should have some storage");
+
+    /*
+     * A view should work with the normal buffer functions.
+     */
+
+    hwm_buffer_init(&view);
+    hwm_ring_view(&ring, &view);
+    fail_unless(view.current_size == LENGTH_01 &&
+                memcmp(hwm_buffer_mem(&view, void),
+                       DATA_01, LENGTH_01) == 0,
+                "View doesn't match");
+
+    devnull = fopen("/dev/null", "w");
+    if (devnull != NULL)
+    {
+        hwm_buffer_fprint(devnull, &view);
+        fclose(devnull);
+    }
+
+    hwm_ring_consume(&ring, 4);
+    fail_unless(memcmp(hwm_ring_mem(&ring, char), DATA_01 + 4, 6) == 0,
+                "Ring has the wrong contents after consuming");
+
+    hwm_buffer_done(&view);
+    hwm_ring_done(&ring);
+}
+END_TEST
+
+
+START_TEST(test_ring_wrap_01)
+{
+    hwm_ring_t  ring;
+    size_t  capacity;
+    size_t  stream_in = 0;
+    size_t  stream_out = 0;
+    size_t  round;
+
+    /*
+     * Write and consume in uneven chunks, so that the contents keep
+     * wrapping around the end of the storage.  Every reservation and
+     * every read should be contiguous, and the ring should never need
+     * to grow.
+     */
+
+    fail_unless(hwm_ring_init(&ring, 1),
+                "Cannot create ring");
+    capacity = hwm_ring_capacity(&ring);
+
+    for (round = 0; round < 1000; round++)
+    {
+        size_t  chunk = (capacity / 3) + (round % 97);
+        void  *dest;
+
+        if (chunk > hwm_ring_available(&ring))
+            chunk = hwm_ring_available(&ring);
+
+        dest = hwm_ring_reserve(&ring, chunk);
+        fail_if(dest == NULL,
+                "Cannot reserve space");
+        fill_pattern(dest, stream_in, chunk);
+        hwm_ring_commit(&ring, chunk);
+        stream_in += chunk;
+
+        fail_unless(check_pattern(hwm_ring_mem(&ring, void), stream_out,
+                                  hwm_ring_current_size(&ring)),
+                    "Ring contents don't match in round %zu", round);
+
+        chunk = hwm_ring_current_size(&ring) / 2 + 1;
+        hwm_ring_consume(&ring, chunk);
+        stream_out += chunk;
+        if (stream_out > stream_in)
+            stream_out = stream_in;
+    }
+
+    fail_unless(hwm_ring_capacity(&ring) == capacity,
+                "Ring shouldn't have grown");
+
+    hwm_ring_done(&ring);
+}
+END_TEST
+
+
+START_TEST(test_ring_grow_01)
+{
+    hwm_ring_t  ring;
+    size_t  capacity;
+    size_t  size;
+    void  *dest;
+
+    /*
+     * Growing a ring whose contents wrap around should keep the
+     * contents intact.
+     */
+
+    fail_unless(hwm_ring_init(&ring, 1),
+                "Cannot create ring");
+    capacity = hwm_ring_capacity(&ring);
+
+    dest = hwm_ring_reserve(&ring, capacity);
+    fail_if(dest == NULL,
+            "Cannot reserve space");
+    fill_pattern(dest, 0, capacity);
+    hwm_ring_commit(&ring, capacity);
+    hwm_ring_consume(&ring, capacity - 100);
+
+    dest = hwm_ring_reserve(&ring, 200);
+    fail_if(dest == NULL,
+            "Cannot reserve space");
+    fill_pattern(dest, capacity, 200);
+    hwm_ring_commit(&ring, 200);
+
+    /*
+     * The contents now wrap around.  Ask for more than the ring can
+     * hold.
+     */
+
+    size = hwm_ring_current_size(&ring);
+    dest = hwm_ring_reserve(&ring, capacity);
+    fail_if(dest == NULL,
+            "Cannot grow ring");
+    fail_unless(hwm_ring_capacity(&ring) >= 2 * capacity,
+                "Ring should have doubled");
+    fail_unless(hwm_ring_current_size(&ring) == size,
+                "Growing shouldn't change the ring's size");
+    fail_unless(check_pattern(hwm_ring_mem(&ring, void),
+                              capacity - 100, size),
+                "Ring contents don't match after growing");
+
+    /*
+     * Explicitly resizing to something smaller is a no-op.
+     */
+
+    capacity = hwm_ring_capacity(&ring);
+    fail_unless(hwm_ring_resize(&ring, 1),
+                "Cannot resize ring");
+    fail_unless(hwm_ring_capacity(&ring) == capacity,
+                "Ring shouldn't shrink");
+
+    hwm_ring_done(&ring);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("hwm-ring");
+
+    TCase  *tc = tcase_create("hwm-ring");
+    tcase_add_test(tc, test_ring_append_01);
+    tcase_add_test(tc, test_ring_wrap_01);
+    tcase_add_test(tc, test_ring_grow_01);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}